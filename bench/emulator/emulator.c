@@ -0,0 +1,856 @@
+/**
+ * @file emulator.c
+ *
+ * Device emulator on a Linux pseudo-terminal. It runs TinyFrame as TF_SLAVE
+ * and answers the comhdlc protocol like a bootloader would, so transfers can
+ * be measured without hardware.
+ *
+ * The slave side of the terminal is printed on the first line of stdout,
+ * the host opens it like any serial port. Flash writes take a configurable
+ * time and the link can be throttled to a byte rate. Rate switches are
+ * taken like a bootloader takes them: the terminal speed changes once the
+ * acknowledgement is out and goes back when no probe follows. One rate can
+ * be made unusable to test the host's fallback. Chunk frames or their
+ * ACKs can be dropped to test the host's resends, and the terminal can be
+ * hung up mid-transfer like an unplugged adapter.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tinyframe/TinyFrame.h"
+#include "checksum/checksum.h"
+#include "compress/lz.h"
+#include "transport/transport.h"
+
+/* Protocol values, see comhdlc.h */
+#define CMD_WRITE_FILE            1
+#define CMD_WRITE_FILE_SIZE       2
+#define CMD_WRITE_FILE_FINISH     3
+#define CMD_HANDSHAKE             4
+#define CMD_BAUD_RATE_LIST        5
+#define CMD_BAUD_RATE_SWITCH      6
+#define CMD_BAUD_RATE_PROBE       7
+#define CMD_WRITE_FILE_COMPRESSED 8
+#define CMD_WRITE_FILE_RESUME     9
+
+#define CAP_COMPRESS_LZ           0x01
+
+#define CHUNK_STORED              0
+#define CHUNK_LZ                  1
+
+#define FINISH_OK                 0
+#define FINISH_DIGEST_MISMATCH    1
+
+#define BAUD_RATE_BASE            38400
+#define BAUD_REVERT_US            1000000u  /* no probe this long after the acknowledgement reverts a switch */
+
+#define ACK_QUEUE_LEN             64
+#define FRAME_OVERHEAD_MAX        16    /* TinyFrame header and checksums */
+#define IO_BLOCK                  4096
+
+struct pending_ack
+{
+    uint64_t due_us;
+    TF_ID frame_id;
+    TF_TYPE type;
+};
+
+static struct
+{
+    int master_fd;
+    int slave_fd;
+    TinyFrame *tf;
+    transport link;
+
+    /* Settings */
+    uint64_t write_latency_us;
+    uint64_t bytes_per_second;   /* 0 is unthrottled */
+    bool compression;
+    transport_framing framing;
+    uint16_t max_payload;        /* offered in the handshake */
+    uint16_t frame_payload;      /* agreed in the handshake, buffers are resized outside the listener */
+    uint32_t drop_frame_every;   /* every Nth chunk frame is ignored, 0 drops none */
+    uint32_t drop_ack_every;     /* every Nth chunk is written but not acknowledged, 0 drops none */
+    uint32_t hangup_after;       /* the terminal is closed after N chunk frames, 0 keeps it open */
+    uint32_t bad_rate;           /* bytes received at this rate are garbled, 0 for none */
+    uint32_t chunk_frames;
+
+    /* Line rate */
+    uint32_t baud_rate;          /* rate the terminal runs at */
+    uint32_t baud_previous;      /* rate to go back to if the switch is not confirmed */
+    uint32_t baud_switch_to;     /* acknowledged switch, taken once the acknowledgement is out, 0 for none */
+    uint64_t baud_revert_us;     /* the switch is reverted then unless a probe arrives, 0 once confirmed */
+
+    /* Image */
+    uint8_t *image;
+    uint32_t image_size;
+    uint8_t *image_written;      /* a flag per byte, chunks arrive out of order after a loss */
+    uint32_t image_committed;    /* bytes written from the start without a gap */
+    uint32_t image_crc;          /* CRC32 register over the committed bytes */
+
+    /* Flash writes finish one after another, each ACK waits for its write */
+    struct pending_ack acks[ACK_QUEUE_LEN];
+    unsigned ack_head;
+    unsigned ack_count;
+    uint64_t flash_busy_until_us;
+
+    /* Bytes towards the host, sent as fast as the throttle allows */
+    uint8_t *tx;
+    size_t tx_len;
+    size_t tx_cap;
+
+    /* Token buckets, in bytes */
+    double rx_tokens;
+    double tx_tokens;
+    uint64_t tokens_us;
+} emu;
+
+static volatile sig_atomic_t emu_stop = 0;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000u + (uint64_t) ts.tv_nsec / 1000u;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+//
+// TinyFrame glue
+//
+
+static void link_output(transport *t, const uint8_t *data, uint32_t len)
+{
+    (void) t;
+
+    if (emu.tx_len + len > emu.tx_cap)
+    {
+        emu.tx_cap = (emu.tx_len + len) * 2;
+        emu.tx = realloc(emu.tx, emu.tx_cap);
+    }
+
+    memcpy(emu.tx + emu.tx_len, data, len);
+    emu.tx_len += len;
+}
+
+void TF_WriteImpl(TinyFrame *tf, const uint8_t *buff, uint32_t len)
+{
+    (void) tf;
+    transport_write(&emu.link, buff, len);
+}
+
+void TF_FrameEndImpl(TinyFrame *tf)
+{
+    (void) tf;
+    transport_frame_end(&emu.link);
+}
+
+TF_TIME TF_GetTime(TinyFrame *tf)
+{
+    (void) tf;
+    return (TF_TIME) (now_us() / 1000u);
+}
+
+void TF_ErrorImpl(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fputs("emulator: ", stderr);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+static void respond(TF_Msg *msg, TF_TYPE type, const uint8_t *data, TF_LEN len)
+{
+    TF_Msg answer;
+    TF_ClearMsg(&answer);
+    answer.frame_id = msg->frame_id;
+    answer.type     = type;
+    answer.data     = data;
+    answer.len      = len;
+    TF_Respond(emu.tf, &answer);
+}
+
+//
+// Image handling
+//
+
+/* Counts a chunk frame, true if it is the Nth */
+static bool chunk_drop(uint32_t every)
+{
+    return (every != 0) && (emu.chunk_frames % every == 0);
+}
+
+/* True once the terminal is to be hung up, the main loop closes it */
+static bool chunk_hangup(void)
+{
+    if ((emu.hangup_after == 0) || (emu.chunk_frames < emu.hangup_after))
+    {
+        return false;
+    }
+
+    if (!emu_stop)
+    {
+        fprintf(stderr, "emulator: hanging up after %u chunk frames\n", emu.chunk_frames);
+        emu_stop = 1;
+    }
+
+    return true;
+}
+
+static bool image_has(uint32_t offset, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (!emu.image_written[offset + i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void image_write(TF_Msg *msg, uint32_t offset, const uint8_t *data, uint32_t len)
+{
+    uint64_t due_us = now_us();
+
+    if ((emu.image == NULL) || (offset > emu.image_size) || (len > emu.image_size - offset))
+    {
+        fprintf(stderr, "emulator: chunk past the end of the image\n");
+        return;
+    }
+
+    /* A resend of a chunk whose ACK was lost is acknowledged, the flash is not written again */
+    if (!image_has(offset, len))
+    {
+        const uint64_t start = (emu.flash_busy_until_us > due_us) ? emu.flash_busy_until_us : due_us;
+
+        memcpy(emu.image + offset, data, len);
+        memset(emu.image_written + offset, 1, len);
+
+        /* The CRC follows the bytes without a gap, chunks after a lost one join once it is resent */
+        while ((emu.image_committed < emu.image_size) && emu.image_written[emu.image_committed])
+        {
+            uint32_t end = emu.image_committed;
+
+            while ((end < emu.image_size) && emu.image_written[end])
+            {
+                end++;
+            }
+
+            emu.image_crc = checksum_crc32(emu.image_crc, emu.image + emu.image_committed, end - emu.image_committed);
+            emu.image_committed = end;
+        }
+
+        emu.flash_busy_until_us = start + emu.write_latency_us;
+        due_us = emu.flash_busy_until_us;
+    }
+
+    if (chunk_drop(emu.drop_ack_every))
+    {
+        return;
+    }
+
+    if (emu.ack_count == ACK_QUEUE_LEN)
+    {
+        fprintf(stderr, "emulator: too many writes queued\n");
+        return;
+    }
+
+    /* The ACK goes out once the flash write is done */
+    {
+        struct pending_ack *ack = &emu.acks[(emu.ack_head + emu.ack_count) % ACK_QUEUE_LEN];
+
+        ack->due_us   = due_us;
+        ack->frame_id = msg->frame_id;
+        ack->type     = msg->type;
+        ++emu.ack_count;
+    }
+}
+
+static void acks_flush(void)
+{
+    const uint64_t now = now_us();
+
+    while ((emu.ack_count > 0) && (emu.acks[emu.ack_head].due_us <= now))
+    {
+        TF_Msg msg;
+        TF_ClearMsg(&msg);
+        msg.frame_id = emu.acks[emu.ack_head].frame_id;
+        respond(&msg, emu.acks[emu.ack_head].type, NULL, 0);
+
+        emu.ack_head = (emu.ack_head + 1) % ACK_QUEUE_LEN;
+        --emu.ack_count;
+    }
+}
+
+//
+// Listeners
+//
+
+static TF_Result handshake_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    const uint8_t answer[] = {
+        0xBE, 0xEF, emu.compression ? CAP_COMPRESS_LZ : 0,
+        (uint8_t) emu.max_payload, (uint8_t) (emu.max_payload >> 8)
+    };
+
+    (void) tf;
+
+    /* Hosts that do not offer a payload size send the old fixed chunks */
+    if (msg->len >= 4)
+    {
+        const uint16_t host_payload = (uint16_t) (msg->data[2] | (msg->data[3] << 8));
+        emu.frame_payload = (host_payload < emu.max_payload) ? host_payload : emu.max_payload;
+    }
+
+    respond(msg, CMD_HANDSHAKE, answer, sizeof(answer));
+    return TF_STAY;
+}
+
+static TF_Result write_file_size_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    (void) tf;
+
+    if (msg->len < 4)
+    {
+        return TF_STAY;
+    }
+
+    free(emu.image);
+    free(emu.image_written);
+    emu.image_size      = get_le32(msg->data);
+    emu.image           = malloc(emu.image_size ? emu.image_size : 1);
+    emu.image_written   = calloc(emu.image_size ? emu.image_size : 1, 1);
+    emu.image_committed = 0;
+    emu.image_crc       = 0xFFFFFFFFu;
+
+    fprintf(stderr, "emulator: receiving %u bytes\n", emu.image_size);
+
+    respond(msg, CMD_WRITE_FILE_SIZE, NULL, 0);
+    return TF_STAY;
+}
+
+static TF_Result write_file_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    (void) tf;
+
+    emu.chunk_frames++;
+
+    if ((msg->len < 4) || chunk_hangup() || chunk_drop(emu.drop_frame_every))
+    {
+        return TF_STAY;
+    }
+
+    image_write(msg, get_le32(msg->data), msg->data + 4, msg->len - 4u);
+    return TF_STAY;
+}
+
+static TF_Result write_file_compressed_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    static uint8_t chunk[LZ_BLOCK_MAX];
+    size_t chunk_len = 0;
+
+    (void) tf;
+
+    emu.chunk_frames++;
+
+    if ((msg->len < 5) || chunk_hangup() || chunk_drop(emu.drop_frame_every))
+    {
+        return TF_STAY;
+    }
+
+    if (msg->data[4] == CHUNK_STORED)
+    {
+        image_write(msg, get_le32(msg->data), msg->data + 5, msg->len - 5u);
+    }
+    else if ((msg->data[4] == CHUNK_LZ)
+            && lz_block_decompress(msg->data + 5, msg->len - 5u, chunk, sizeof(chunk), &chunk_len))
+    {
+        image_write(msg, get_le32(msg->data), chunk, (uint32_t) chunk_len);
+    }
+    else
+    {
+        fprintf(stderr, "emulator: malformed compressed chunk\n");
+    }
+
+    return TF_STAY;
+}
+
+static TF_Result write_file_resume_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    uint8_t answer[8];
+
+    (void) tf;
+
+    /* Only the image of the current session can be resumed */
+    if ((msg->len >= 4) && (emu.image != NULL) && (get_le32(msg->data) == emu.image_size))
+    {
+        put_le32(answer, emu.image_committed);
+        put_le32(answer + 4, ~emu.image_crc);
+    }
+    else
+    {
+        put_le32(answer, 0);
+        put_le32(answer + 4, 0);
+    }
+
+    respond(msg, CMD_WRITE_FILE_RESUME, answer, sizeof(answer));
+    return TF_STAY;
+}
+
+static TF_Result write_file_finish_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    uint8_t status = FINISH_DIGEST_MISMATCH;
+
+    (void) tf;
+
+    if ((msg->len >= 8)
+            && (get_le32(msg->data) == emu.image_size)
+            && (emu.image_committed == emu.image_size)
+            && (get_le32(msg->data + 4) == ~emu.image_crc))
+    {
+        status = FINISH_OK;
+    }
+
+    fprintf(stderr, "emulator: image %s\n", status == FINISH_OK ? "verified" : "does not match");
+
+    respond(msg, CMD_WRITE_FILE_FINISH, &status, 1);
+    return TF_STAY;
+}
+
+/* Terminal speed of a rate, 0 if termios has none */
+static speed_t baud_speed(uint32_t rate)
+{
+    switch (rate)
+    {
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+    case 460800:  return B460800;
+    case 921600:  return B921600;
+    case 1000000: return B1000000;
+    case 2000000: return B2000000;
+    case 3000000: return B3000000;
+    case 4000000: return B4000000;
+    default:      return 0;
+    }
+}
+
+/* A pseudo terminal keeps the speed but does not pace by it, the speed is set as a UART's would be */
+static void baud_apply(uint32_t rate)
+{
+    struct termios tio;
+
+    if ((tcgetattr(emu.slave_fd, &tio) != 0)
+            || (cfsetispeed(&tio, baud_speed(rate)) != 0)
+            || (cfsetospeed(&tio, baud_speed(rate)) != 0)
+            || (tcsetattr(emu.slave_fd, TCSANOW, &tio) != 0))
+    {
+        perror("emulator: terminal speed");
+    }
+
+    emu.baud_rate = rate;
+
+    /* Bytes half received at the old rate are lost */
+    TF_ResetParser(emu.tf);
+}
+
+/* Takes an acknowledged switch once the acknowledgement has left, reverts an unconfirmed one */
+static void baud_service(void)
+{
+    if ((emu.baud_switch_to != 0) && (emu.tx_len == 0))
+    {
+        emu.baud_previous  = emu.baud_rate;
+        emu.baud_revert_us = now_us() + BAUD_REVERT_US;
+        baud_apply(emu.baud_switch_to);
+        emu.baud_switch_to = 0;
+
+        fprintf(stderr, "emulator: %u baud\n", emu.baud_rate);
+    }
+
+    if ((emu.baud_revert_us != 0) && (now_us() >= emu.baud_revert_us))
+    {
+        fprintf(stderr, "emulator: no probe at %u baud, back to %u baud\n", emu.baud_rate, emu.baud_previous);
+
+        emu.baud_revert_us = 0;
+        baud_apply(emu.baud_previous);
+    }
+}
+
+static TF_Result baud_list_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    uint8_t answer[64];
+    TF_LEN answer_len = 0;
+    TF_LEN i;
+
+    (void) tf;
+
+    /* Every offered rate the terminal has a speed for, the bad rate too: the device cannot tell */
+    for (i = 0; (i + 4u <= msg->len) && (answer_len + 4u <= sizeof(answer)); i += 4u)
+    {
+        if (baud_speed(get_le32(msg->data + i)) != 0)
+        {
+            memcpy(answer + answer_len, msg->data + i, 4);
+            answer_len += 4u;
+        }
+    }
+
+    respond(msg, CMD_BAUD_RATE_LIST, answer, answer_len);
+    return TF_STAY;
+}
+
+static TF_Result baud_switch_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    (void) tf;
+
+    /* A rate without a speed is not acknowledged, the host moves on to the next one */
+    if ((msg->len < 4) || (baud_speed(get_le32(msg->data)) == 0))
+    {
+        return TF_STAY;
+    }
+
+    respond(msg, CMD_BAUD_RATE_SWITCH, msg->data, 4);
+    emu.baud_switch_to = get_le32(msg->data);
+    return TF_STAY;
+}
+
+static TF_Result baud_probe_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    (void) tf;
+
+    /* A probe that made it at the new rate confirms the switch */
+    emu.baud_revert_us = 0;
+
+    respond(msg, CMD_BAUD_RATE_PROBE, msg->data, msg->len);
+    return TF_STAY;
+}
+
+//
+// Link
+//
+
+static void tokens_refill(void)
+{
+    const uint64_t now = now_us();
+    const double burst = (double) IO_BLOCK;
+
+    if (emu.bytes_per_second == 0)
+    {
+        return;
+    }
+
+    emu.rx_tokens += (double) (now - emu.tokens_us) * (double) emu.bytes_per_second / 1e6;
+    emu.tx_tokens += (double) (now - emu.tokens_us) * (double) emu.bytes_per_second / 1e6;
+    emu.tokens_us  = now;
+
+    if (emu.rx_tokens > burst)
+    {
+        emu.rx_tokens = burst;
+    }
+
+    if (emu.tx_tokens > burst)
+    {
+        emu.tx_tokens = burst;
+    }
+}
+
+static size_t tokens_take(double *tokens, size_t want)
+{
+    if (emu.bytes_per_second == 0)
+    {
+        return want;
+    }
+
+    if (*tokens < 1.0)
+    {
+        return 0;
+    }
+
+    if ((double) want > *tokens)
+    {
+        want = (size_t) *tokens;
+    }
+
+    *tokens -= (double) want;
+    return want;
+}
+
+static int pty_open(void)
+{
+    struct termios tio;
+
+    emu.master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if ((emu.master_fd < 0) || (grantpt(emu.master_fd) != 0) || (unlockpt(emu.master_fd) != 0))
+    {
+        perror("emulator: pty");
+        return -1;
+    }
+
+    /* Kept open so the master does not see a hangup between host sessions */
+    emu.slave_fd = open(ptsname(emu.master_fd), O_RDWR | O_NOCTTY);
+
+    if ((emu.slave_fd < 0) || (tcgetattr(emu.slave_fd, &tio) != 0))
+    {
+        perror("emulator: pty slave");
+        return -1;
+    }
+
+    cfmakeraw(&tio);
+    tcsetattr(emu.slave_fd, TCSANOW, &tio);
+
+    fcntl(emu.master_fd, F_SETFL, fcntl(emu.master_fd, F_GETFL) | O_NONBLOCK);
+
+    return 0;
+}
+
+static void on_signal(int sig)
+{
+    (void) sig;
+    emu_stop = 1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--latency-us N] [--bandwidth BYTES_PER_S] [--max-payload N] [--no-compress]\n"
+            "       [--framing raw|hdlc] [--drop-frame N] [--drop-ack N] [--hangup N] [--bad-rate BAUD]\n"
+            "  --latency-us   time one flash write takes, default 0\n"
+            "  --bandwidth    link throttle in bytes/s each way, default unthrottled\n"
+            "  --max-payload  largest frame payload offered in the handshake, default 8192\n"
+            "  --no-compress  do not advertise compressed transfers\n"
+            "  --framing      wire framing under TinyFrame, default raw\n"
+            "  --drop-frame   ignore every Nth chunk frame\n"
+            "  --drop-ack     write every Nth chunk but do not acknowledge it\n"
+            "  --hangup       close the terminal after N chunk frames\n"
+            "  --bad-rate     garble every byte received at this rate, a switch to it is never confirmed\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    emu.compression = true;
+    emu.max_payload = 8192;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--latency-us") == 0) && (i + 1 < argc))
+        {
+            emu.write_latency_us = strtoull(argv[++i], NULL, 10);
+        }
+        else if ((strcmp(argv[i], "--bandwidth") == 0) && (i + 1 < argc))
+        {
+            emu.bytes_per_second = strtoull(argv[++i], NULL, 10);
+        }
+        else if ((strcmp(argv[i], "--max-payload") == 0) && (i + 1 < argc))
+        {
+            const unsigned long max_payload = strtoul(argv[++i], NULL, 10);
+            emu.max_payload = (uint16_t) ((max_payload > 0xFFFF) ? 0xFFFF : max_payload);
+        }
+        else if ((strcmp(argv[i], "--drop-frame") == 0) && (i + 1 < argc))
+        {
+            emu.drop_frame_every = (uint32_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if ((strcmp(argv[i], "--drop-ack") == 0) && (i + 1 < argc))
+        {
+            emu.drop_ack_every = (uint32_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if ((strcmp(argv[i], "--hangup") == 0) && (i + 1 < argc))
+        {
+            emu.hangup_after = (uint32_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if ((strcmp(argv[i], "--bad-rate") == 0) && (i + 1 < argc))
+        {
+            emu.bad_rate = (uint32_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--no-compress") == 0)
+        {
+            emu.compression = false;
+        }
+        else if ((strcmp(argv[i], "--framing") == 0) && (i + 1 < argc)
+                 && transport_framing_parse(argv[i + 1], &emu.framing))
+        {
+            i++;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    checksum_init();
+    minihdlc_encode_init();
+
+    if (pty_open() != 0)
+    {
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    emu.tf = TF_Init(TF_SLAVE);
+    emu.tokens_us = now_us();
+    baud_apply(BAUD_RATE_BASE);
+
+    /* Over HDLC a whole frame has to fit one minihdlc frame */
+    transport_init(&emu.link, emu.tf, emu.framing, link_output, NULL);
+    if (emu.max_payload > transport_max_payload(&emu.link))
+    {
+        emu.max_payload = transport_max_payload(&emu.link);
+    }
+
+    TF_AddTypeListener(emu.tf, CMD_HANDSHAKE,             handshake_listener);
+    TF_AddTypeListener(emu.tf, CMD_WRITE_FILE_SIZE,       write_file_size_listener);
+    TF_AddTypeListener(emu.tf, CMD_WRITE_FILE,            write_file_listener);
+    TF_AddTypeListener(emu.tf, CMD_WRITE_FILE_COMPRESSED, write_file_compressed_listener);
+    TF_AddTypeListener(emu.tf, CMD_WRITE_FILE_RESUME,     write_file_resume_listener);
+    TF_AddTypeListener(emu.tf, CMD_WRITE_FILE_FINISH,     write_file_finish_listener);
+    TF_AddTypeListener(emu.tf, CMD_BAUD_RATE_LIST,        baud_list_listener);
+    TF_AddTypeListener(emu.tf, CMD_BAUD_RATE_SWITCH,      baud_switch_listener);
+    TF_AddTypeListener(emu.tf, CMD_BAUD_RATE_PROBE,       baud_probe_listener);
+
+    printf("%s\n", ptsname(emu.master_fd));
+    fflush(stdout);
+
+    while (!emu_stop)
+    {
+        struct pollfd pfd = { emu.master_fd, POLLIN, 0 };
+        uint8_t buf[IO_BLOCK];
+        int timeout_ms = -1;
+
+        if ((emu.ack_count > 0) || (emu.tx_len > 0) || (emu.bytes_per_second > 0)
+                || (emu.baud_switch_to != 0) || (emu.baud_revert_us != 0))
+        {
+            timeout_ms = 1;
+        }
+
+        if (emu.tx_len > 0)
+        {
+            pfd.events |= POLLOUT;
+        }
+
+        if (poll(&pfd, 1, timeout_ms) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        tokens_refill();
+
+        if (pfd.revents & POLLIN)
+        {
+            const size_t want = tokens_take(&emu.rx_tokens, sizeof(buf));
+
+            if (want > 0)
+            {
+                const ssize_t got = read(emu.master_fd, buf, want);
+
+                if (got > 0)
+                {
+                    /* The line does not hold the bad rate, nothing sent at it arrives intact */
+                    if ((emu.bad_rate != 0) && (emu.baud_rate == emu.bad_rate))
+                    {
+                        ssize_t k;
+
+                        for (k = 0; k < got; k++)
+                        {
+                            buf[k] ^= 0xA5;
+                        }
+                    }
+
+                    transport_receive(&emu.link, buf, (size_t) got);
+
+                    if (emu.frame_payload != 0)
+                    {
+                        if (!TF_ResizeBuffers(emu.tf, emu.frame_payload, emu.frame_payload + FRAME_OVERHEAD_MAX))
+                        {
+                            fprintf(stderr, "emulator: no memory for %u byte frames\n", emu.frame_payload);
+                        }
+
+                        emu.frame_payload = 0;
+                    }
+
+                    /* Unused tokens go back to the bucket */
+                    if (emu.bytes_per_second > 0)
+                    {
+                        emu.rx_tokens += (double) (want - (size_t) got);
+                    }
+                }
+            }
+        }
+
+        acks_flush();
+
+        if (emu.tx_len > 0)
+        {
+            const size_t want = tokens_take(&emu.tx_tokens, emu.tx_len);
+
+            if (want > 0)
+            {
+                const ssize_t sent = write(emu.master_fd, emu.tx, want);
+
+                if (sent > 0)
+                {
+                    memmove(emu.tx, emu.tx + sent, emu.tx_len - (size_t) sent);
+                    emu.tx_len -= (size_t) sent;
+                }
+
+                if (emu.bytes_per_second > 0)
+                {
+                    emu.tx_tokens += (double) (want - (sent > 0 ? (size_t) sent : 0));
+                }
+            }
+        }
+
+        baud_service();
+    }
+
+    TF_DeInit(emu.tf);
+    close(emu.slave_fd);
+    close(emu.master_fd);
+    free(emu.image);
+    free(emu.image_written);
+    free(emu.tx);
+
+    return 0;
+}
@@ -0,0 +1,633 @@
+/**
+ * @file microbench.c
+ *
+ * Runs every case over a set of payload mixes and prints ns/byte and
+ * frames/s, as a table or as JSON lines for comparing runs over time.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "microbench.h"
+#include "checksum/checksum.h"
+#include "minihdlc.h"
+
+#define MIX_TARGET_BYTES (64u * 1024u)  /* payload bytes of one pass */
+#define HDLC_FLAG        0x7E
+#define HDLC_ESCAPE      0x7D
+
+static struct
+{
+    bool json;
+    uint64_t min_time_ns;
+    const char *filter;
+} options = { false, 100000000u, NULL };
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+bool bench_selected(const struct bench_case *bench_case)
+{
+    char name[128];
+
+    if (options.filter == NULL)
+    {
+        return true;
+    }
+
+    snprintf(name, sizeof(name), "%s/%s/%s/%s", bench_case->group, bench_case->bench,
+             bench_case->variant, bench_case->mix->name);
+
+    return strstr(name, options.filter) != NULL;
+}
+
+void bench_measure(const struct bench_case *bench_case, bench_pass pass, void *context, const bool *ok)
+{
+    const struct bench_mix *mix = bench_case->mix;
+    uint64_t elapsed = 0;
+    uint64_t passes  = 0;
+    double ns_per_byte;
+    double frames_per_second;
+    double mb_per_second;
+
+    /* Warms caches and branch predictors, not counted */
+    pass(context);
+
+    while ((elapsed < options.min_time_ns) || (passes == 0))
+    {
+        elapsed += pass(context);
+        ++passes;
+    }
+
+    ns_per_byte       = (double) elapsed / ((double) mix->bytes * (double) passes);
+    frames_per_second = (double) mix->frames * (double) passes / ((double) elapsed / 1e9);
+    mb_per_second     = 1e3 / ns_per_byte;
+
+    if (options.json)
+    {
+        printf("{\"event\":\"result\",\"group\":\"%s\",\"bench\":\"%s\",\"variant\":\"%s\",\"mix\":\"%s\","
+               "\"escape_density\":%.4f,\"frames\":%u,\"payload_bytes\":%llu,\"wire_bytes\":%llu,"
+               "\"passes\":%llu,\"ns\":%llu,\"ns_per_byte\":%.4f,\"frames_per_s\":%.1f,\"mb_per_s\":%.2f,"
+               "\"ok\":%s}\n",
+               bench_case->group, bench_case->bench, bench_case->variant, mix->name,
+               mix->escape_density, mix->frames, (unsigned long long) mix->bytes,
+               (unsigned long long) bench_case->wire_bytes, (unsigned long long) passes,
+               (unsigned long long) elapsed, ns_per_byte, frames_per_second, mb_per_second,
+               *ok ? "true" : "false");
+    }
+    else
+    {
+        printf("%-10s %-21s %-9s %-18s %9.3f ns/B %12.0f frames/s %9.1f MB/s%s\n",
+               bench_case->group, bench_case->bench, bench_case->variant, mix->name,
+               ns_per_byte, frames_per_second, mb_per_second, *ok ? "" : "  FAILED");
+    }
+
+    fflush(stdout);
+}
+
+//
+// Payload mixes
+//
+
+static uint32_t rng_state = 0x2545F491u;
+
+static uint32_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/**
+ * A payload byte. With escape_density < 0 the bytes are uniform, otherwise
+ * that share of them is a flag or an escape and the rest never is.
+ */
+static uint8_t payload_byte(double escape_density)
+{
+    uint8_t byte;
+
+    if (escape_density < 0.0)
+    {
+        return (uint8_t) rng_next();
+    }
+
+    if ((double) (rng_next() % 1000000u) < escape_density * 1e6)
+    {
+        return (rng_next() & 1) ? HDLC_FLAG : HDLC_ESCAPE;
+    }
+
+    do
+    {
+        byte = (uint8_t) rng_next();
+    } while ((byte == HDLC_FLAG) || (byte == HDLC_ESCAPE));
+
+    return byte;
+}
+
+/** Frame sizes repeat the pattern until the mix holds MIX_TARGET_BYTES */
+static bool mix_build(struct bench_mix *mix, const char *name, const uint16_t *pattern, size_t pattern_len,
+                      double escape_density)
+{
+    uint64_t bytes  = 0;
+    uint32_t frames = 0;
+    uint64_t i;
+
+    while (bytes < MIX_TARGET_BYTES)
+    {
+        bytes += pattern[frames % pattern_len];
+        ++frames;
+    }
+
+    mix->name           = name;
+    mix->escape_density = (escape_density < 0.0) ? 2.0 / 256.0 : escape_density;
+    mix->frames         = frames;
+    mix->bytes          = bytes;
+    mix->data           = malloc(bytes);
+    mix->lengths        = malloc(frames * sizeof(uint16_t));
+
+    if ((mix->data == NULL) || (mix->lengths == NULL))
+    {
+        return false;
+    }
+
+    for (i = 0; i < frames; i++)
+    {
+        mix->lengths[i] = pattern[i % pattern_len];
+    }
+
+    for (i = 0; i < bytes; i++)
+    {
+        mix->data[i] = payload_byte(escape_density);
+    }
+
+    return true;
+}
+
+static void mix_free(struct bench_mix *mix)
+{
+    free(mix->data);
+    free(mix->lengths);
+}
+
+//
+// minihdlc
+//
+
+#define HDLC_BENCH_READ 256u  /* bytes per minihdlc_context_receive() call */
+
+static struct
+{
+    minihdlc_context link;
+    uint8_t *wire;
+    uint64_t wire_len;
+    uint64_t wire_cap;
+    uint32_t frames_received;
+    uint64_t bytes_received;
+} hdlc;
+
+struct hdlc_pass
+{
+    const struct bench_mix *mix;
+    const uint8_t *stream;
+    uint64_t stream_len;
+    bool ok;
+};
+
+static void hdlc_sendchar(minihdlc_context *ctx, uint8_t data)
+{
+    (void) ctx;
+
+    if ((hdlc.wire != NULL) && (hdlc.wire_len < hdlc.wire_cap))
+    {
+        hdlc.wire[hdlc.wire_len] = data;
+    }
+
+    ++hdlc.wire_len;
+}
+
+static void hdlc_frame_handler(minihdlc_context *ctx, const uint8_t *frame_buffer, uint16_t frame_length)
+{
+    (void) ctx;
+    (void) frame_buffer;
+
+    ++hdlc.frames_received;
+    hdlc.bytes_received += frame_length;
+}
+
+static uint64_t pass_hdlc_send_frame(void *context)
+{
+    struct hdlc_pass *pass = context;
+    const uint8_t *payload = pass->mix->data;
+    const uint64_t start = bench_now_ns();
+    uint32_t i;
+
+    for (i = 0; i < pass->mix->frames; i++)
+    {
+        minihdlc_context_send_frame(&hdlc.link, payload, pass->mix->lengths[i]);
+        payload += pass->mix->lengths[i];
+    }
+
+    return bench_now_ns() - start;
+}
+
+static uint64_t pass_hdlc_send_frame_to_buffer(void *context)
+{
+    struct hdlc_pass *pass = context;
+    const uint8_t *payload = pass->mix->data;
+    const uint64_t start = bench_now_ns();
+    uint32_t i;
+
+    for (i = 0; i < pass->mix->frames; i++)
+    {
+        minihdlc_context_send_frame_to_buffer(&hdlc.link, payload, pass->mix->lengths[i]);
+        payload += pass->mix->lengths[i];
+    }
+
+    return bench_now_ns() - start;
+}
+
+/* Into one buffer back to back, which must come out as the send_frame stream */
+static uint64_t pass_hdlc_encode(void *context)
+{
+    struct hdlc_pass *pass = context;
+    const uint8_t *payload = pass->mix->data;
+    uint8_t *out = malloc(hdlc.wire_cap);
+    uint64_t out_len = 0;
+    uint64_t start;
+    uint64_t elapsed;
+    uint32_t i;
+
+    if (out == NULL)
+    {
+        pass->ok = false;
+        return 0;
+    }
+
+    start = bench_now_ns();
+
+    for (i = 0; i < pass->mix->frames; i++)
+    {
+        out_len += minihdlc_encode(payload, pass->mix->lengths[i], out + out_len,
+                                   (uint32_t) (hdlc.wire_cap - out_len));
+        payload += pass->mix->lengths[i];
+    }
+
+    elapsed = bench_now_ns() - start;
+
+    if ((out_len != pass->stream_len) || (memcmp(out, pass->stream, out_len) != 0))
+    {
+        pass->ok = false;
+    }
+
+    free(out);
+
+    return elapsed;
+}
+
+static void hdlc_check_received(struct hdlc_pass *pass)
+{
+    if ((hdlc.frames_received != pass->mix->frames) || (hdlc.bytes_received != pass->mix->bytes))
+    {
+        pass->ok = false;
+    }
+
+    hdlc.frames_received = 0;
+    hdlc.bytes_received  = 0;
+}
+
+static uint64_t pass_hdlc_char_receiver(void *context)
+{
+    struct hdlc_pass *pass = context;
+    const uint64_t start = bench_now_ns();
+    uint64_t elapsed;
+    uint64_t pos;
+
+    for (pos = 0; pos < pass->stream_len; pos++)
+    {
+        minihdlc_context_char_receiver(&hdlc.link, pass->stream[pos]);
+    }
+
+    elapsed = bench_now_ns() - start;
+
+    hdlc_check_received(pass);
+
+    return elapsed;
+}
+
+/* Spans of a serial port read */
+static uint64_t pass_hdlc_receive(void *context)
+{
+    struct hdlc_pass *pass = context;
+    const uint64_t start = bench_now_ns();
+    uint64_t elapsed;
+    uint64_t pos;
+
+    for (pos = 0; pos < pass->stream_len; pos += HDLC_BENCH_READ)
+    {
+        const uint64_t left = pass->stream_len - pos;
+        minihdlc_context_receive(&hdlc.link, pass->stream + pos, (size_t) (left < HDLC_BENCH_READ ? left : HDLC_BENCH_READ));
+    }
+
+    elapsed = bench_now_ns() - start;
+
+    hdlc_check_received(pass);
+
+    return elapsed;
+}
+
+static void hdlc_bench(const struct bench_mix *mixes, size_t mix_count)
+{
+    static const struct
+    {
+        const char *name;
+        bench_pass pass;
+    } benches[] = {
+        { "send_frame",           pass_hdlc_send_frame },
+        { "send_frame_to_buffer", pass_hdlc_send_frame_to_buffer },
+        { "encode",               pass_hdlc_encode },
+        { "char_receiver",        pass_hdlc_char_receiver },
+        { "receive",              pass_hdlc_receive },
+    };
+
+    size_t m;
+    size_t b;
+
+    for (m = 0; m < mix_count; m++)
+    {
+        struct hdlc_pass pass;
+        const uint8_t *payload = mixes[m].data;
+        uint32_t i;
+
+        memset(&pass, 0, sizeof(pass));
+        pass.mix = &mixes[m];
+
+        /* Every byte escaped, plus flags and the FCS */
+        hdlc.wire_cap = 2u * mixes[m].bytes + (uint64_t) mixes[m].frames * 8u;
+        hdlc.wire_len = 0;
+        hdlc.wire     = malloc(hdlc.wire_cap);
+
+        if (hdlc.wire == NULL)
+        {
+            continue;
+        }
+
+        minihdlc_context_init(&hdlc.link, hdlc_sendchar, hdlc_frame_handler, NULL);
+
+        for (i = 0; i < mixes[m].frames; i++)
+        {
+            minihdlc_context_send_frame(&hdlc.link, payload, mixes[m].lengths[i]);
+            payload += mixes[m].lengths[i];
+        }
+
+        pass.stream     = hdlc.wire;
+        pass.stream_len = hdlc.wire_len;
+        hdlc.wire       = NULL;
+
+        for (b = 0; b < sizeof(benches) / sizeof(benches[0]); b++)
+        {
+            const struct bench_case bench_case = { "minihdlc", benches[b].name, "-", &mixes[m], pass.stream_len };
+
+            if (!bench_selected(&bench_case))
+            {
+                continue;
+            }
+
+            minihdlc_context_init(&hdlc.link, hdlc_sendchar, hdlc_frame_handler, NULL);
+            hdlc.frames_received = 0;
+            hdlc.bytes_received  = 0;
+            hdlc.wire_len        = 0;
+            pass.ok = true;
+
+            bench_measure(&bench_case, benches[b].pass, &pass, &pass.ok);
+        }
+
+        free((void *) pass.stream);
+    }
+}
+
+//
+// Checksum kernels
+//
+
+struct checksum_pass
+{
+    const struct bench_mix *mix;
+    uint32_t (*kernel)(const uint8_t *data, size_t len);
+    volatile uint32_t sink;
+    bool ok;
+};
+
+static uint32_t kernel_xor(const uint8_t *data, size_t len)
+{
+    return checksum_xor(0, data, len);
+}
+
+static uint32_t kernel_crc8(const uint8_t *data, size_t len)
+{
+    return checksum_crc8(0, data, len);
+}
+
+static uint32_t kernel_crc16(const uint8_t *data, size_t len)
+{
+    return checksum_crc16(0, data, len);
+}
+
+static uint32_t kernel_crc_ccitt(const uint8_t *data, size_t len)
+{
+    return checksum_crc_ccitt(0xFFFF, data, len);
+}
+
+static uint32_t kernel_crc32(const uint8_t *data, size_t len)
+{
+    return checksum_crc32(0xFFFFFFFFu, data, len);
+}
+
+static uint64_t pass_checksum(void *context)
+{
+    struct checksum_pass *pass = context;
+    const uint8_t *payload = pass->mix->data;
+    const uint64_t start = bench_now_ns();
+    uint32_t acc = 0;
+    uint32_t i;
+
+    for (i = 0; i < pass->mix->frames; i++)
+    {
+        acc ^= pass->kernel(payload, pass->mix->lengths[i]);
+        payload += pass->mix->lengths[i];
+    }
+
+    pass->sink = acc;
+
+    return bench_now_ns() - start;
+}
+
+static void checksum_bench(const struct bench_mix *mixes, size_t mix_count)
+{
+    const struct
+    {
+        const char *name;
+        const char *variant;
+        uint32_t (*kernel)(const uint8_t *data, size_t len);
+    } kernels[] = {
+        { "xor",       "-",                     kernel_xor },
+        { "crc8",      "slice8",                kernel_crc8 },
+        { "crc16",     "slice8",                kernel_crc16 },
+        { "crc_ccitt", "slice8",                kernel_crc_ccitt },
+        { "crc32",     checksum_crc32_kernel(), kernel_crc32 },
+    };
+
+    size_t m;
+    size_t k;
+
+    for (m = 0; m < mix_count; m++)
+    {
+        for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+        {
+            const struct bench_case bench_case = { "checksum", kernels[k].name, kernels[k].variant, &mixes[m], mixes[m].bytes };
+            struct checksum_pass pass;
+
+            if (!bench_selected(&bench_case))
+            {
+                continue;
+            }
+
+            pass.mix    = &mixes[m];
+            pass.kernel = kernels[k].kernel;
+            pass.ok     = true;
+
+            bench_measure(&bench_case, pass_checksum, &pass, &pass.ok);
+        }
+    }
+}
+
+//
+// Main
+//
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--json] [--min-time-ms N] [--filter TEXT]\n"
+            "  --json         one JSON object per line\n"
+            "  --min-time-ms  time spent on each case, default 100\n"
+            "  --filter       only cases whose group/bench/variant/mix contains TEXT\n",
+            name);
+}
+
+#define MICROBENCH_TF_ENTRY(variant) tf_bench_##variant,
+
+int main(int argc, char **argv)
+{
+    /* A transfer is mostly full chunks with the odd control frame in between */
+    static const uint16_t session_pattern[] = { 512, 512, 512, 512, 512, 512, 512, 8, 64, 4 };
+    static const uint16_t command_pattern[] = { 8 };
+    static const uint16_t chunk_pattern[]   = { 512 };
+    static const uint16_t max_pattern[]     = { 1024 };
+    static const uint16_t block64[]   = { 64 };
+    static const uint16_t block512[]  = { 512 };
+    static const uint16_t block4096[] = { 4096 };
+
+    static void (*const tf_benches[])(const struct bench_mix *mixes, size_t mix_count) = {
+        MICROBENCH_TF_VARIANTS(MICROBENCH_TF_ENTRY)
+    };
+
+    struct bench_mix tf_mixes[4];
+    struct bench_mix hdlc_mixes[8];
+    struct bench_mix checksum_mixes[3];
+    bool built = true;
+    size_t i;
+    int arg;
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--json") == 0)
+        {
+            options.json = true;
+        }
+        else if ((strcmp(argv[arg], "--min-time-ms") == 0) && (arg + 1 < argc))
+        {
+            options.min_time_ns = strtoull(argv[++arg], NULL, 10) * 1000000u;
+        }
+        else if ((strcmp(argv[arg], "--filter") == 0) && (arg + 1 < argc))
+        {
+            options.filter = argv[++arg];
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    checksum_init();
+    minihdlc_encode_init();
+
+    /* TinyFrame does not look at the payload bytes, so uniform data only */
+    built = built && mix_build(&tf_mixes[0], "command8",  command_pattern, 1, -1.0);
+    built = built && mix_build(&tf_mixes[1], "chunk512",  chunk_pattern,   1, -1.0);
+    built = built && mix_build(&tf_mixes[2], "max1024",   max_pattern,     1, -1.0);
+    built = built && mix_build(&tf_mixes[3], "session",   session_pattern, sizeof(session_pattern) / sizeof(session_pattern[0]), -1.0);
+
+    /* The HDLC cost grows with the escapes */
+    built = built && mix_build(&hdlc_mixes[0], "command8/esc0",    command_pattern, 1, 0.0);
+    built = built && mix_build(&hdlc_mixes[1], "command8/uniform", command_pattern, 1, -1.0);
+    built = built && mix_build(&hdlc_mixes[2], "chunk512/esc0",    chunk_pattern,   1, 0.0);
+    built = built && mix_build(&hdlc_mixes[3], "chunk512/uniform", chunk_pattern,   1, -1.0);
+    built = built && mix_build(&hdlc_mixes[4], "chunk512/esc10",   chunk_pattern,   1, 0.10);
+    built = built && mix_build(&hdlc_mixes[5], "chunk512/esc50",   chunk_pattern,   1, 0.50);
+    built = built && mix_build(&hdlc_mixes[6], "chunk512/esc100",  chunk_pattern,   1, 1.00);
+    built = built && mix_build(&hdlc_mixes[7], "session/uniform",  session_pattern, sizeof(session_pattern) / sizeof(session_pattern[0]), -1.0);
+
+    built = built && mix_build(&checksum_mixes[0], "block64",   block64,   1, -1.0);
+    built = built && mix_build(&checksum_mixes[1], "block512",  block512,  1, -1.0);
+    built = built && mix_build(&checksum_mixes[2], "block4096", block4096, 1, -1.0);
+
+    if (!built)
+    {
+        fprintf(stderr, "microbench: out of memory\n");
+        return 1;
+    }
+
+    if (options.json)
+    {
+        printf("{\"event\":\"meta\",\"timestamp\":%lld,\"min_time_ms\":%llu,\"crc32_kernel\":\"%s\"}\n",
+               (long long) time(NULL), (unsigned long long) (options.min_time_ns / 1000000u),
+               checksum_crc32_kernel());
+    }
+
+    for (i = 0; i < sizeof(tf_benches) / sizeof(tf_benches[0]); i++)
+    {
+        tf_benches[i](tf_mixes, sizeof(tf_mixes) / sizeof(tf_mixes[0]));
+    }
+
+    tf_template_bench(tf_mixes, sizeof(tf_mixes) / sizeof(tf_mixes[0]));
+
+    hdlc_bench(hdlc_mixes, sizeof(hdlc_mixes) / sizeof(hdlc_mixes[0]));
+    checksum_bench(checksum_mixes, sizeof(checksum_mixes) / sizeof(checksum_mixes[0]));
+
+    for (i = 0; i < sizeof(tf_mixes) / sizeof(tf_mixes[0]); i++)
+    {
+        mix_free(&tf_mixes[i]);
+    }
+
+    for (i = 0; i < sizeof(hdlc_mixes) / sizeof(hdlc_mixes[0]); i++)
+    {
+        mix_free(&hdlc_mixes[i]);
+    }
+
+    for (i = 0; i < sizeof(checksum_mixes) / sizeof(checksum_mixes[0]); i++)
+    {
+        mix_free(&checksum_mixes[i]);
+    }
+
+    return 0;
+}
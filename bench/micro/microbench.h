@@ -0,0 +1,87 @@
+/**
+ * @file microbench.h
+ *
+ * Micro-benchmarks of the per-byte paths: TinyFrame composition and
+ * parsing for every checksum type, minihdlc framing and the checksum
+ * kernels.
+ */
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** TinyFrame checksum types, each one is a separate build of TinyFrame.c */
+#define MICROBENCH_TF_VARIANTS(X) \
+    X(none)                       \
+    X(xor)                        \
+    X(crc8)                       \
+    X(crc16)                      \
+    X(crc32)                      \
+    X(custom8)                    \
+    X(custom16)                   \
+    X(custom32)
+
+/** Payloads of one traffic pattern, laid out back to back */
+struct bench_mix
+{
+    const char *name;
+    double escape_density;   /* share of 0x7E and 0x7D bytes in the payloads */
+    uint8_t *data;
+    uint16_t *lengths;
+    uint32_t frames;
+    uint64_t bytes;          /* payload bytes of all frames */
+};
+
+struct bench_case
+{
+    const char *group;       /* tinyframe, tinyframe_cpp, minihdlc or checksum */
+    const char *bench;
+    const char *variant;     /* checksum type, "-" when there is none */
+    const struct bench_mix *mix;
+    uint64_t wire_bytes;     /* bytes on the wire for one pass */
+};
+
+/**
+ * One pass over the mix. Returns the nanoseconds spent in the code under
+ * test, so setup between batches is left out.
+ */
+typedef uint64_t (*bench_pass)(void *context);
+
+uint64_t bench_now_ns(void);
+
+/** Whether the case passes the --filter option */
+bool bench_selected(const struct bench_case *bench_case);
+
+/**
+ * Runs passes until the minimum time is reached and reports the case.
+ * Passes clear *ok when the output does not check out.
+ */
+void bench_measure(const struct bench_case *bench_case, bench_pass pass, void *context, const bool *ok);
+
+/**
+ * Per payload mix runners, each one a separate TinyFrame build. The stream
+ * functions frame a whole mix and return the malloc'd bytes, they are the
+ * reference the C++ engine has to match.
+ */
+#define MICROBENCH_TF_DECLARE(variant) \
+    void tf_bench_##variant(const struct bench_mix *mixes, size_t mix_count); \
+    uint8_t *tf_stream_##variant(const struct bench_mix *mix, uint64_t *len);
+
+MICROBENCH_TF_VARIANTS(MICROBENCH_TF_DECLARE)
+
+/** The header-only C++ engine in the same formats, see tf_template.cpp */
+void tf_template_bench(const struct bench_mix *mixes, size_t mix_count);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MICROBENCH_H
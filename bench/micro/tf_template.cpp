@@ -0,0 +1,387 @@
+/**
+ * @file tf_template.cpp
+ *
+ * The header-only C++ TinyFrame on the same mixes and in the same formats
+ * as the C builds. Before a mix is measured, its framed stream is compared
+ * byte for byte with the C build's, and the C stream is parsed back, so the
+ * cases of a mix only report ok when both directions are wire compatible.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "microbench.h"
+#include "tinyframe/TinyFrame.hpp"
+
+namespace
+{
+
+const uint8_t  bench_type = 0x22;
+const uint32_t bench_read = 256;  // bytes per accept() call, like a serial port read
+
+// The custom checksums of tf_variant.c
+
+/** Additive checksum */
+struct cksum_additive : tinyframe::cksum_bytewise<cksum_additive, uint8_t>
+{
+    static uint8_t start() { return 0; }
+    static uint8_t add(uint8_t cksum, uint8_t byte) { return static_cast<uint8_t>(cksum + byte); }
+    static uint8_t end(uint8_t cksum) { return static_cast<uint8_t>(~cksum); }
+};
+
+/** Fletcher-16 */
+struct cksum_fletcher16 : tinyframe::cksum_bytewise<cksum_fletcher16, uint16_t>
+{
+    static uint16_t start() { return 0; }
+
+    static uint16_t add(uint16_t cksum, uint8_t byte)
+    {
+        const uint16_t sum1 = static_cast<uint16_t>(((cksum & 0xFF) + byte) % 255);
+        const uint16_t sum2 = static_cast<uint16_t>(((cksum >> 8) + sum1) % 255);
+        return static_cast<uint16_t>((sum2 << 8) | sum1);
+    }
+
+    static uint16_t end(uint16_t cksum) { return cksum; }
+};
+
+/** Adler-32 */
+struct cksum_adler32 : tinyframe::cksum_bytewise<cksum_adler32, uint32_t>
+{
+    static uint32_t start() { return 1; }
+
+    static uint32_t add(uint32_t cksum, uint8_t byte)
+    {
+        const uint32_t a = ((cksum & 0xFFFF) + byte) % 65521u;
+        const uint32_t b = ((cksum >> 16) + a) % 65521u;
+        return (b << 16) | a;
+    }
+
+    static uint32_t end(uint32_t cksum) { return cksum; }
+};
+
+template <typename Engine>
+struct template_pass
+{
+    Engine *tf;
+    const struct bench_mix *mix;
+    const uint8_t *stream;   // framed mix, for the parser passes
+    uint64_t stream_len;
+    uint8_t *wire;           // capture buffer, nullptr counts the bytes only
+    uint64_t wire_len;
+    uint64_t wire_cap;
+    uint32_t frames_received;
+    uint64_t bytes_received;
+    bool ok;
+};
+
+//
+// Application side of the engine
+//
+
+template <typename Engine>
+void bench_write(Engine &tf, const uint8_t *buff, uint32_t len)
+{
+    template_pass<Engine> *pass = static_cast<template_pass<Engine> *>(tf.userdata);
+
+    if ((pass->wire != nullptr) && (pass->wire_len + len <= pass->wire_cap))
+    {
+        std::memcpy(pass->wire + pass->wire_len, buff, len);
+    }
+
+    pass->wire_len += len;
+}
+
+template <typename Engine>
+uint32_t bench_time(Engine &tf)
+{
+    (void) tf;
+    return static_cast<uint32_t>(bench_now_ns() / 1000000u);
+}
+
+template <typename Engine>
+tinyframe::listener_result bench_generic_listener(Engine &tf, typename Engine::message &msg)
+{
+    template_pass<Engine> *pass = static_cast<template_pass<Engine> *>(tf.userdata);
+
+    ++pass->frames_received;
+    pass->bytes_received += msg.len;
+
+    return tinyframe::listener_result::stay;
+}
+
+template <typename Engine>
+tinyframe::listener_result bench_query_listener(Engine &tf, typename Engine::message &msg)
+{
+    (void) tf;
+    (void) msg;
+
+    return tinyframe::listener_result::close;
+}
+
+template <typename Engine>
+void bench_tf_reset(template_pass<Engine> &pass)
+{
+    pass.tf->reset();
+    pass.tf->add_generic_listener(bench_generic_listener<Engine>);
+}
+
+template <typename Engine>
+bool pass_received_all(template_pass<Engine> &pass)
+{
+    const bool complete = (pass.frames_received == pass.mix->frames)
+            && (pass.bytes_received == pass.mix->bytes);
+
+    pass.frames_received = 0;
+    pass.bytes_received  = 0;
+
+    return complete;
+}
+
+//
+// Passes, the same as the C builds run
+//
+
+template <typename Engine>
+uint64_t pass_send(void *context)
+{
+    template_pass<Engine> &pass = *static_cast<template_pass<Engine> *>(context);
+    const uint8_t *payload = pass.mix->data;
+    const uint64_t start = bench_now_ns();
+
+    for (uint32_t i = 0; i < pass.mix->frames; i++)
+    {
+        if (!pass.tf->send_simple(bench_type, payload, pass.mix->lengths[i]))
+        {
+            pass.ok = false;
+        }
+
+        payload += pass.mix->lengths[i];
+    }
+
+    return bench_now_ns() - start;
+}
+
+/** Batches of 16 queries, one per ID listener slot, with a reset in between */
+template <typename Engine>
+uint64_t pass_query_simple(void *context)
+{
+    template_pass<Engine> &pass = *static_cast<template_pass<Engine> *>(context);
+    const uint8_t *payload = pass.mix->data;
+    uint64_t elapsed = 0;
+    uint32_t i = 0;
+
+    while (i < pass.mix->frames)
+    {
+        const uint32_t batch_end = std::min<uint32_t>(i + 16, pass.mix->frames);
+        const uint64_t start = bench_now_ns();
+
+        for (; i < batch_end; i++)
+        {
+            if (!pass.tf->query_simple(bench_type, payload, pass.mix->lengths[i], bench_query_listener<Engine>, 1000))
+            {
+                pass.ok = false;
+            }
+
+            payload += pass.mix->lengths[i];
+        }
+
+        elapsed += bench_now_ns() - start;
+
+        bench_tf_reset(pass);
+    }
+
+    return elapsed;
+}
+
+template <typename Engine>
+void stream_accept(template_pass<Engine> &pass, const uint8_t *stream, uint64_t stream_len)
+{
+    for (uint64_t pos = 0; pos < stream_len; pos += bench_read)
+    {
+        pass.tf->accept(stream + pos, static_cast<uint32_t>(std::min<uint64_t>(bench_read, stream_len - pos)));
+    }
+}
+
+template <typename Engine>
+uint64_t pass_accept(void *context)
+{
+    template_pass<Engine> &pass = *static_cast<template_pass<Engine> *>(context);
+    const uint64_t start = bench_now_ns();
+
+    stream_accept(pass, pass.stream, pass.stream_len);
+
+    const uint64_t elapsed = bench_now_ns() - start;
+
+    if (!pass_received_all(pass))
+    {
+        pass.ok = false;
+    }
+
+    return elapsed;
+}
+
+template <typename Engine>
+uint64_t pass_accept_char(void *context)
+{
+    template_pass<Engine> &pass = *static_cast<template_pass<Engine> *>(context);
+    const uint64_t start = bench_now_ns();
+
+    for (uint64_t pos = 0; pos < pass.stream_len; pos++)
+    {
+        pass.tf->accept_char(pass.stream[pos]);
+    }
+
+    const uint64_t elapsed = bench_now_ns() - start;
+
+    if (!pass_received_all(pass))
+    {
+        pass.ok = false;
+    }
+
+    return elapsed;
+}
+
+/** Frames the whole mix once, the parser passes replay it */
+template <typename Engine>
+bool stream_build(template_pass<Engine> &pass)
+{
+    const uint8_t *payload = pass.mix->data;
+
+    // Header and checksums are well below 16 bytes a frame
+    pass.wire_cap = pass.mix->bytes + static_cast<uint64_t>(pass.mix->frames) * 16u;
+    pass.wire_len = 0;
+    pass.wire     = static_cast<uint8_t *>(std::malloc(pass.wire_cap));
+
+    if (pass.wire == nullptr)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < pass.mix->frames; i++)
+    {
+        pass.tf->send_simple(bench_type, payload, pass.mix->lengths[i]);
+        payload += pass.mix->lengths[i];
+    }
+
+    pass.stream     = pass.wire;
+    pass.stream_len = pass.wire_len;
+    pass.wire       = nullptr;
+
+    return pass.stream_len <= pass.wire_cap;
+}
+
+/** Same frames as the C build, and the C build's frames parse */
+template <typename Engine>
+bool wire_compatible(template_pass<Engine> &pass, uint8_t *(*reference)(const struct bench_mix *, uint64_t *))
+{
+    uint64_t reference_len = 0;
+    uint8_t *reference_stream = reference(pass.mix, &reference_len);
+    bool compatible = (reference_stream != nullptr)
+            && (reference_len == pass.stream_len)
+            && (std::memcmp(reference_stream, pass.stream, reference_len) == 0);
+
+    if (reference_stream != nullptr)
+    {
+        bench_tf_reset(pass);
+        stream_accept(pass, reference_stream, reference_len);
+        compatible = pass_received_all(pass) && compatible;
+    }
+
+    std::free(reference_stream);
+
+    return compatible;
+}
+
+/** Format of TF_Config.h with the checksum under test */
+template <typename Checksum>
+void variant_bench(const char *variant, uint8_t *(*reference)(const struct bench_mix *, uint64_t *),
+                   const struct bench_mix *mixes, size_t mix_count)
+{
+    typedef tinyframe::engine<tinyframe::format<1, 2, 1, Checksum>, 1024, 512, 16> engine;
+
+    static const struct
+    {
+        const char *name;
+        bench_pass pass;
+    } benches[] = {
+        { "send",         pass_send<engine> },
+        { "query_simple", pass_query_simple<engine> },
+        { "accept",       pass_accept<engine> },
+        { "accept_char",  pass_accept_char<engine> },
+    };
+
+    engine tf(tinyframe::peer::master, bench_write<engine>, bench_time<engine>);
+
+    for (size_t m = 0; m < mix_count; m++)
+    {
+        template_pass<engine> pass;
+        bool selected = false;
+
+        std::memset(&pass, 0, sizeof(pass));
+        pass.tf  = &tf;
+        pass.mix = &mixes[m];
+        tf.userdata = &pass;
+
+        for (const auto &bench : benches)
+        {
+            const struct bench_case bench_case = { "tinyframe_cpp", bench.name, variant, &mixes[m], 0 };
+            selected = selected || bench_selected(&bench_case);
+        }
+
+        if (!selected)
+        {
+            continue;
+        }
+
+        bench_tf_reset(pass);
+
+        if (!stream_build(pass))
+        {
+            std::fprintf(stderr, "microbench: mix %s does not fit the capture buffer\n", mixes[m].name);
+            std::free(const_cast<uint8_t *>(pass.stream));
+            continue;
+        }
+
+        const bool compatible = wire_compatible(pass, reference);
+
+        if (!compatible)
+        {
+            std::fprintf(stderr, "microbench: C++ frames of %s/%s differ from the C build\n", variant, mixes[m].name);
+        }
+
+        for (const auto &bench : benches)
+        {
+            const struct bench_case bench_case = { "tinyframe_cpp", bench.name, variant, &mixes[m], pass.stream_len };
+
+            if (!bench_selected(&bench_case))
+            {
+                continue;
+            }
+
+            bench_tf_reset(pass);
+            pass.frames_received = 0;
+            pass.bytes_received  = 0;
+            pass.ok = compatible;
+
+            bench_measure(&bench_case, bench.pass, &pass, &pass.ok);
+        }
+
+        std::free(const_cast<uint8_t *>(pass.stream));
+    }
+}
+
+} // namespace
+
+void tf_template_bench(const struct bench_mix *mixes, size_t mix_count)
+{
+    variant_bench<tinyframe::cksum_none>("none", tf_stream_none, mixes, mix_count);
+    variant_bench<tinyframe::cksum_xor>("xor", tf_stream_xor, mixes, mix_count);
+    variant_bench<tinyframe::cksum_crc8>("crc8", tf_stream_crc8, mixes, mix_count);
+    variant_bench<tinyframe::cksum_crc16>("crc16", tf_stream_crc16, mixes, mix_count);
+    variant_bench<tinyframe::cksum_crc32>("crc32", tf_stream_crc32, mixes, mix_count);
+    variant_bench<cksum_additive>("custom8", tf_stream_custom8, mixes, mix_count);
+    variant_bench<cksum_fletcher16>("custom16", tf_stream_custom16, mixes, mix_count);
+    variant_bench<cksum_adler32>("custom32", tf_stream_custom32, mixes, mix_count);
+}
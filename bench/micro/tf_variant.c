@@ -0,0 +1,509 @@
+/**
+ * @file tf_variant.c
+ *
+ * TinyFrame benchmarks for one checksum type. Not built on its own: the
+ * generated tf_<variant>.c files set TF_CKSUM_TYPE and TF_BENCH_VARIANT and
+ * include it, so every TinyFrame symbol gets the variant as a suffix and
+ * all builds link into one executable.
+ */
+
+#ifndef TF_BENCH_VARIANT
+#error TF_BENCH_VARIANT must name the checksum variant
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "microbench.h"
+
+#define TF_BENCH_CAT_(a, b) a##_##b
+#define TF_BENCH_CAT(a, b)  TF_BENCH_CAT_(a, b)
+#define TF_BENCH_SYM(name)  TF_BENCH_CAT(name, TF_BENCH_VARIANT)
+#define TF_BENCH_STR_(a)    #a
+#define TF_BENCH_STR(a)     TF_BENCH_STR_(a)
+
+#define TF_Init                  TF_BENCH_SYM(TF_Init)
+#define TF_InitStatic            TF_BENCH_SYM(TF_InitStatic)
+#define TF_DeInit                TF_BENCH_SYM(TF_DeInit)
+#define TF_ResizeBuffers         TF_BENCH_SYM(TF_ResizeBuffers)
+#define TF_ResizeIdListeners     TF_BENCH_SYM(TF_ResizeIdListeners)
+#define TF_Accept                TF_BENCH_SYM(TF_Accept)
+#define TF_AcceptChar            TF_BENCH_SYM(TF_AcceptChar)
+#define TF_Tick                  TF_BENCH_SYM(TF_Tick)
+#define TF_NextDeadline          TF_BENCH_SYM(TF_NextDeadline)
+#define TF_ResetParser           TF_BENCH_SYM(TF_ResetParser)
+#define TF_AddIdListener         TF_BENCH_SYM(TF_AddIdListener)
+#define TF_RemoveIdListener      TF_BENCH_SYM(TF_RemoveIdListener)
+#define TF_AddTypeListener       TF_BENCH_SYM(TF_AddTypeListener)
+#define TF_RemoveTypeListener    TF_BENCH_SYM(TF_RemoveTypeListener)
+#define TF_AddGenericListener    TF_BENCH_SYM(TF_AddGenericListener)
+#define TF_RemoveGenericListener TF_BENCH_SYM(TF_RemoveGenericListener)
+#define TF_RenewIdListener       TF_BENCH_SYM(TF_RenewIdListener)
+#define TF_Send                  TF_BENCH_SYM(TF_Send)
+#define TF_SendSimple            TF_BENCH_SYM(TF_SendSimple)
+#define TF_Query                 TF_BENCH_SYM(TF_Query)
+#define TF_QuerySimple           TF_BENCH_SYM(TF_QuerySimple)
+#define TF_Respond               TF_BENCH_SYM(TF_Respond)
+#define TF_Send_Multipart        TF_BENCH_SYM(TF_Send_Multipart)
+#define TF_SendSimple_Multipart  TF_BENCH_SYM(TF_SendSimple_Multipart)
+#define TF_QuerySimple_Multipart TF_BENCH_SYM(TF_QuerySimple_Multipart)
+#define TF_Query_Multipart       TF_BENCH_SYM(TF_Query_Multipart)
+#define TF_Respond_Multipart     TF_BENCH_SYM(TF_Respond_Multipart)
+#define TF_Multipart_Payload     TF_BENCH_SYM(TF_Multipart_Payload)
+#define TF_Multipart_Close       TF_BENCH_SYM(TF_Multipart_Close)
+#define TF_WriteImpl             TF_BENCH_SYM(TF_WriteImpl)
+#define TF_GetTime               TF_BENCH_SYM(TF_GetTime)
+#define TF_FrameEndImpl          TF_BENCH_SYM(TF_FrameEndImpl)
+#define TF_ErrorImpl             TF_BENCH_SYM(TF_ErrorImpl)
+#define TF_CksumStart            TF_BENCH_SYM(TF_CksumStart)
+#define TF_CksumAdd              TF_BENCH_SYM(TF_CksumAdd)
+#define TF_CksumEnd              TF_BENCH_SYM(TF_CksumEnd)
+
+#include "tinyframe/TinyFrame.c"
+
+#define TF_BENCH_TYPE  0x22
+#define TF_BENCH_READ  256  /* bytes per TF_Accept() call, like a serial port read */
+#define TF_BENCH_WINDOW 64  /* queries in flight, the transfer window of comhdlc */
+
+static struct
+{
+    TinyFrame tf;
+    uint8_t *wire;           /* capture buffer, NULL counts the bytes only */
+    uint64_t wire_len;
+    uint64_t wire_cap;
+    uint32_t frames_received;
+    uint64_t bytes_received;
+} bench;
+
+//
+// Application side of TinyFrame
+//
+
+void TF_WriteImpl(TinyFrame *tf, const uint8_t *buff, uint32_t len)
+{
+    (void) tf;
+
+    if (bench.wire != NULL)
+    {
+        if (bench.wire_len + len <= bench.wire_cap)
+        {
+            memcpy(bench.wire + bench.wire_len, buff, len);
+        }
+    }
+
+    bench.wire_len += len;
+}
+
+/* Raw framing, the frames are already complete on the wire */
+void TF_FrameEndImpl(TinyFrame *tf)
+{
+    (void) tf;
+}
+
+TF_TIME TF_GetTime(TinyFrame *tf)
+{
+    (void) tf;
+    return (TF_TIME) (bench_now_ns() / 1000000u);
+}
+
+/* Rejected frames already fail the check of the benchmark that sent them */
+void TF_ErrorImpl(const char *format, ...)
+{
+    (void) format;
+}
+
+#if TF_CKSUM_TYPE == TF_CKSUM_CUSTOM8
+
+    /* Additive checksum */
+    TF_CKSUM TF_CksumStart(void)
+      { return 0; }
+
+    TF_CKSUM TF_CksumAdd(TF_CKSUM cksum, uint8_t byte)
+      { return (TF_CKSUM) (cksum + byte); }
+
+    TF_CKSUM TF_CksumEnd(TF_CKSUM cksum)
+      { return (TF_CKSUM) ~cksum; }
+
+#elif TF_CKSUM_TYPE == TF_CKSUM_CUSTOM16
+
+    /* Fletcher-16 */
+    TF_CKSUM TF_CksumStart(void)
+      { return 0; }
+
+    TF_CKSUM TF_CksumAdd(TF_CKSUM cksum, uint8_t byte)
+    {
+        const uint16_t sum1 = (uint16_t) (((cksum & 0xFF) + byte) % 255);
+        const uint16_t sum2 = (uint16_t) (((cksum >> 8) + sum1) % 255);
+        return (TF_CKSUM) ((sum2 << 8) | sum1);
+    }
+
+    TF_CKSUM TF_CksumEnd(TF_CKSUM cksum)
+      { return cksum; }
+
+#elif TF_CKSUM_TYPE == TF_CKSUM_CUSTOM32
+
+    /* Adler-32 */
+    TF_CKSUM TF_CksumStart(void)
+      { return 1; }
+
+    TF_CKSUM TF_CksumAdd(TF_CKSUM cksum, uint8_t byte)
+    {
+        const uint32_t a = ((cksum & 0xFFFF) + byte) % 65521u;
+        const uint32_t b = ((cksum >> 16) + a) % 65521u;
+        return (b << 16) | a;
+    }
+
+    TF_CKSUM TF_CksumEnd(TF_CKSUM cksum)
+      { return cksum; }
+
+#endif
+
+static TF_Result bench_generic_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    (void) tf;
+
+    ++bench.frames_received;
+    bench.bytes_received += msg->len;
+
+    return TF_STAY;
+}
+
+static TF_Result bench_query_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    (void) tf;
+    (void) msg;
+
+    return TF_CLOSE;
+}
+
+static TF_Result bench_window_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    (void) tf;
+
+    ++bench.frames_received;
+    bench.bytes_received += msg->len;
+
+    return TF_CLOSE;
+}
+
+static void bench_tf_reset(void)
+{
+    TF_InitStatic(&bench.tf, TF_MASTER);
+    TF_AddGenericListener(&bench.tf, bench_generic_listener);
+}
+
+//
+// Passes
+//
+
+struct tf_pass
+{
+    const struct bench_mix *mix;
+    const uint8_t *stream;   /* framed mix, for the parser passes */
+    uint64_t stream_len;
+    bool ok;
+};
+
+static uint64_t pass_send(void *context)
+{
+    struct tf_pass *pass = context;
+    const uint8_t *payload = pass->mix->data;
+    const uint64_t start = bench_now_ns();
+    uint32_t i;
+
+    for (i = 0; i < pass->mix->frames; i++)
+    {
+        if (!TF_SendSimple(&bench.tf, TF_BENCH_TYPE, payload, pass->mix->lengths[i]))
+        {
+            pass->ok = false;
+        }
+
+        payload += pass->mix->lengths[i];
+    }
+
+    return bench_now_ns() - start;
+}
+
+/*
+ * Every query holds an ID listener until it is answered, so the queries go
+ * out in batches of TF_MAX_ID_LST and the instance is reset between them.
+ */
+static uint64_t pass_query_simple(void *context)
+{
+    struct tf_pass *pass = context;
+    const uint8_t *payload = pass->mix->data;
+    uint64_t elapsed = 0;
+    uint32_t i = 0;
+
+    while (i < pass->mix->frames)
+    {
+        const uint32_t batch_end = TF_MIN(i + TF_MAX_ID_LST, pass->mix->frames);
+        const uint64_t start = bench_now_ns();
+
+        for (; i < batch_end; i++)
+        {
+            if (!TF_QuerySimple(&bench.tf, TF_BENCH_TYPE, payload, pass->mix->lengths[i],
+                                bench_query_listener, 1000))
+            {
+                pass->ok = false;
+            }
+
+            payload += pass->mix->lengths[i];
+        }
+
+        elapsed += bench_now_ns() - start;
+
+        bench_tf_reset();
+    }
+
+    return elapsed;
+}
+
+static bool pass_received_all(struct tf_pass *pass)
+{
+    const bool complete = (bench.frames_received == pass->mix->frames)
+            && (bench.bytes_received == pass->mix->bytes);
+
+    bench.frames_received = 0;
+    bench.bytes_received  = 0;
+
+    return complete;
+}
+
+/*
+ * A full transfer window of queries goes out, then the captured frames come
+ * back as their own answers, so every answer is dispatched to one of
+ * TF_BENCH_WINDOW live ID listeners.
+ */
+static uint64_t pass_query_window(void *context)
+{
+    struct tf_pass *pass = context;
+    const uint8_t *payload = pass->mix->data;
+    uint64_t elapsed = 0;
+    uint64_t pos;
+    uint32_t i = 0;
+
+    if (!TF_ResizeIdListeners(&bench.tf, TF_BENCH_WINDOW))
+    {
+        pass->ok = false;
+        return 0;
+    }
+
+    /* Header and checksums are well below 16 bytes a frame */
+    bench.wire_cap = pass->mix->bytes + (uint64_t) pass->mix->frames * 16u;
+    bench.wire     = malloc(bench.wire_cap);
+
+    if (bench.wire == NULL)
+    {
+        pass->ok = false;
+        return 0;
+    }
+
+    while (i < pass->mix->frames)
+    {
+        const uint32_t batch_end = TF_MIN(i + TF_BENCH_WINDOW, pass->mix->frames);
+        const uint64_t start = bench_now_ns();
+
+        bench.wire_len = 0;
+
+        for (; i < batch_end; i++)
+        {
+            if (!TF_QuerySimple(&bench.tf, TF_BENCH_TYPE, payload, pass->mix->lengths[i],
+                                bench_window_listener, 1000))
+            {
+                pass->ok = false;
+            }
+
+            payload += pass->mix->lengths[i];
+        }
+
+        for (pos = 0; pos < bench.wire_len; pos += TF_BENCH_READ)
+        {
+            TF_Accept(&bench.tf, bench.wire + pos, (uint32_t) TF_MIN(TF_BENCH_READ, bench.wire_len - pos));
+        }
+
+        elapsed += bench_now_ns() - start;
+
+        if (bench.tf.count_id_lst != 0)
+        {
+            pass->ok = false;
+        }
+    }
+
+    free(bench.wire);
+    bench.wire = NULL;
+
+    /* Back to the built-in slots, the other passes reset the instance */
+    if (!pass_received_all(pass) || !TF_ResizeIdListeners(&bench.tf, 0))
+    {
+        pass->ok = false;
+    }
+
+    return elapsed;
+}
+
+static uint64_t pass_accept(void *context)
+{
+    struct tf_pass *pass = context;
+    const uint64_t start = bench_now_ns();
+    uint64_t pos;
+    uint64_t elapsed;
+
+    for (pos = 0; pos < pass->stream_len; pos += TF_BENCH_READ)
+    {
+        TF_Accept(&bench.tf, pass->stream + pos, (uint32_t) TF_MIN(TF_BENCH_READ, pass->stream_len - pos));
+    }
+
+    elapsed = bench_now_ns() - start;
+
+    if (!pass_received_all(pass))
+    {
+        pass->ok = false;
+    }
+
+    return elapsed;
+}
+
+static uint64_t pass_accept_char(void *context)
+{
+    struct tf_pass *pass = context;
+    const uint64_t start = bench_now_ns();
+    uint64_t pos;
+    uint64_t elapsed;
+
+    for (pos = 0; pos < pass->stream_len; pos++)
+    {
+        TF_AcceptChar(&bench.tf, pass->stream[pos]);
+    }
+
+    elapsed = bench_now_ns() - start;
+
+    if (!pass_received_all(pass))
+    {
+        pass->ok = false;
+    }
+
+    return elapsed;
+}
+
+/** Frames the whole mix once, the parser passes replay it */
+static bool stream_build(struct tf_pass *pass)
+{
+    const uint8_t *payload = pass->mix->data;
+    uint8_t *stream;
+    uint32_t i;
+
+    /* Header and checksums are well below 16 bytes a frame */
+    bench.wire_cap = pass->mix->bytes + (uint64_t) pass->mix->frames * 16u;
+    bench.wire_len = 0;
+    bench.wire     = malloc(bench.wire_cap);
+
+    if (bench.wire == NULL)
+    {
+        return false;
+    }
+
+    for (i = 0; i < pass->mix->frames; i++)
+    {
+        TF_SendSimple(&bench.tf, TF_BENCH_TYPE, payload, pass->mix->lengths[i]);
+        payload += pass->mix->lengths[i];
+    }
+
+    stream = bench.wire;
+
+    pass->stream     = stream;
+    pass->stream_len = bench.wire_len;
+
+    bench.wire = NULL;
+
+    return pass->stream_len <= bench.wire_cap;
+}
+
+uint8_t *TF_BENCH_CAT(tf_stream, TF_BENCH_VARIANT)(const struct bench_mix *mix, uint64_t *len)
+{
+    struct tf_pass pass;
+
+    memset(&pass, 0, sizeof(pass));
+    pass.mix = mix;
+
+    bench_tf_reset();
+
+    if (!stream_build(&pass))
+    {
+        free((void *) pass.stream);
+        return NULL;
+    }
+
+    *len = pass.stream_len;
+
+    return (uint8_t *) pass.stream;
+}
+
+void TF_BENCH_CAT(tf_bench, TF_BENCH_VARIANT)(const struct bench_mix *mixes, size_t mix_count)
+{
+    static const struct
+    {
+        const char *name;
+        bench_pass pass;
+    } benches[] = {
+        { "send",         pass_send },
+        { "query_simple", pass_query_simple },
+        { "query_window", pass_query_window },
+        { "accept",       pass_accept },
+        { "accept_char",  pass_accept_char },
+    };
+
+    size_t m;
+    size_t b;
+
+    for (m = 0; m < mix_count; m++)
+    {
+        struct tf_pass pass;
+        bool selected = false;
+
+        memset(&pass, 0, sizeof(pass));
+        pass.mix = &mixes[m];
+
+        for (b = 0; b < sizeof(benches) / sizeof(benches[0]); b++)
+        {
+            const struct bench_case bench_case = { "tinyframe", benches[b].name, TF_BENCH_STR(TF_BENCH_VARIANT), &mixes[m], 0 };
+            selected = selected || bench_selected(&bench_case);
+        }
+
+        if (!selected)
+        {
+            continue;
+        }
+
+        bench_tf_reset();
+
+        if (!stream_build(&pass))
+        {
+            fprintf(stderr, "microbench: mix %s does not fit the capture buffer\n", mixes[m].name);
+            free((void *) pass.stream);
+            continue;
+        }
+
+        for (b = 0; b < sizeof(benches) / sizeof(benches[0]); b++)
+        {
+            const struct bench_case bench_case = {
+                "tinyframe", benches[b].name, TF_BENCH_STR(TF_BENCH_VARIANT), &mixes[m], pass.stream_len
+            };
+
+            if (!bench_selected(&bench_case))
+            {
+                continue;
+            }
+
+            bench_tf_reset();
+            bench.frames_received = 0;
+            bench.bytes_received  = 0;
+            pass.ok = true;
+
+            bench_measure(&bench_case, benches[b].pass, &pass, &pass.ok);
+        }
+
+        free((void *) pass.stream);
+    }
+}
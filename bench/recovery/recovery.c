@@ -0,0 +1,532 @@
+/**
+ * @file recovery.c
+ *
+ * Recovery after line corruption, raw TinyFrame against TinyFrame inside
+ * HDLC frames. A sender and a receiver run on a simulated serial line with
+ * a clock of its own, one frame of every trial is damaged on the wire and
+ * the time until the receiver takes the next frame is measured.
+ *
+ * Two traffic patterns: stream sends frames back to back like a transfer
+ * with a full window, query sends one frame at a time and repeats it when it
+ * is not received within the retry time, like the handshake and the
+ * baud rate commands.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tinyframe/TinyFrame.h"
+#include "checksum/checksum.h"
+#include "transport/transport.h"
+
+#define RECOVERY_TYPE         0x22
+#define RECOVERY_FRAME_BAD    4       /* frames before the damaged one */
+#define RECOVERY_FRAMES       16      /* frames of a stream trial */
+#define RECOVERY_BURST        16      /* bytes dropped or inserted */
+#define RECOVERY_GIVE_UP_US   (120ull * 1000000ull)
+
+enum corruption
+{
+    CORRUPT_NONE,
+    CORRUPT_BITFLIP,    /* one bit anywhere in the frame */
+    CORRUPT_LENGTH,     /* one bit of the TinyFrame length field */
+    CORRUPT_DROP,       /* a burst of bytes lost */
+    CORRUPT_TRUNCATE,   /* the rest of the frame never arrives */
+    CORRUPT_NOISE,      /* a burst of random bytes inserted */
+    CORRUPT_COUNT
+};
+
+static const char *const corruption_names[CORRUPT_COUNT] =
+{
+    "none", "bitflip", "length", "drop", "truncate", "noise"
+};
+
+enum traffic
+{
+    TRAFFIC_STREAM,
+    TRAFFIC_QUERY,
+    TRAFFIC_COUNT
+};
+
+static const char *const traffic_names[TRAFFIC_COUNT] = { "stream", "query" };
+
+struct endpoint
+{
+    TinyFrame *tf;
+    transport link;
+};
+
+static struct
+{
+    /* Settings */
+    uint32_t baud;
+    uint16_t payload;
+    uint32_t trials;
+    uint64_t retry_us;
+    bool json;
+
+    /* Simulated line, sender to receiver */
+    struct endpoint sender;
+    struct endpoint receiver;
+    uint8_t *line;
+    size_t line_len;
+    size_t line_cap;
+    uint64_t now_us;
+    double byte_us;              /* 8N1, ten bits per byte */
+
+    /* Receiver side of one trial */
+    uint32_t frames_delivered;
+    uint64_t recovered_us;       /* first frame taken from the damaged one on, 0 if none yet */
+    bool delivered_seq;
+    uint32_t waiting_seq;
+
+    uint32_t rng;
+} sim;
+
+static uint32_t rng_next(void)
+{
+    sim.rng ^= sim.rng << 13;
+    sim.rng ^= sim.rng >> 17;
+    sim.rng ^= sim.rng << 5;
+    return sim.rng;
+}
+
+//
+// TinyFrame glue
+//
+
+void TF_WriteImpl(TinyFrame *tf, const uint8_t *buff, uint32_t len)
+{
+    struct endpoint *ep = (struct endpoint *) tf->userdata;
+    transport_write(&ep->link, buff, len);
+}
+
+void TF_FrameEndImpl(TinyFrame *tf)
+{
+    struct endpoint *ep = (struct endpoint *) tf->userdata;
+    transport_frame_end(&ep->link);
+}
+
+TF_TIME TF_GetTime(TinyFrame *tf)
+{
+    (void) tf;
+    return (TF_TIME) (sim.now_us / 1000u);
+}
+
+/* Every damaged frame is rejected on purpose, the results count them instead */
+void TF_ErrorImpl(const char *format, ...)
+{
+    (void) format;
+}
+
+static void line_output(transport *t, const uint8_t *data, uint32_t len)
+{
+    (void) t;
+
+    if (sim.line_len + len > sim.line_cap)
+    {
+        sim.line_cap = (sim.line_len + len) * 2;
+        sim.line = realloc(sim.line, sim.line_cap);
+    }
+
+    memcpy(sim.line + sim.line_len, data, len);
+    sim.line_len += len;
+}
+
+static TF_Result frame_listener(TinyFrame *tf, TF_Msg *msg)
+{
+    uint32_t seq;
+
+    (void) tf;
+
+    if (msg->len < 4)
+    {
+        return TF_STAY;
+    }
+
+    seq = (uint32_t) msg->data[0] | ((uint32_t) msg->data[1] << 8)
+        | ((uint32_t) msg->data[2] << 16) | ((uint32_t) msg->data[3] << 24);
+
+    sim.frames_delivered++;
+
+    if ((seq >= RECOVERY_FRAME_BAD) && (sim.recovered_us == 0))
+    {
+        sim.recovered_us = sim.now_us;
+    }
+
+    if (seq == sim.waiting_seq)
+    {
+        sim.delivered_seq = true;
+    }
+
+    return TF_STAY;
+}
+
+//
+// Line
+//
+
+/** Wire offset of a byte of the TinyFrame frame that was sent from start on */
+static size_t wire_offset(transport_framing framing, size_t start, size_t index)
+{
+    size_t at = start;
+
+    if (framing == TRANSPORT_RAW)
+    {
+        return start + index;
+    }
+
+    at++;  /* opening flag */
+    while (index-- > 0)
+    {
+        at += (sim.line[at] == 0x7D) ? 2 : 1;
+    }
+
+    return at;
+}
+
+static void line_remove(size_t at, size_t count)
+{
+    memmove(sim.line + at, sim.line + at + count, sim.line_len - at - count);
+    sim.line_len -= count;
+}
+
+static void line_insert(size_t at, size_t count)
+{
+    size_t i;
+
+    if (sim.line_len + count > sim.line_cap)
+    {
+        sim.line_cap = (sim.line_len + count) * 2;
+        sim.line = realloc(sim.line, sim.line_cap);
+    }
+
+    memmove(sim.line + at + count, sim.line + at, sim.line_len - at);
+    for (i = 0; i < count; i++)
+    {
+        sim.line[at + i] = (uint8_t) rng_next();
+    }
+    sim.line_len += count;
+}
+
+/** Damage the frame on the line from start on */
+static void line_corrupt(enum corruption kind, transport_framing framing, size_t start)
+{
+    const size_t frame_len = sim.line_len - start;
+    const size_t at = start + rng_next() % frame_len;
+
+    switch (kind)
+    {
+    case CORRUPT_NONE:
+    case CORRUPT_COUNT:
+        break;
+
+    case CORRUPT_BITFLIP:
+        sim.line[at] ^= (uint8_t) (1u << (rng_next() % 8));
+        break;
+
+    case CORRUPT_LENGTH:
+        /* SOF and ID come first, then the length, most significant byte first */
+        sim.line[wire_offset(framing, start, TF_USE_SOF_BYTE + TF_ID_BYTES + rng_next() % TF_LEN_BYTES)]
+            ^= (uint8_t) (1u << (rng_next() % 8));
+        break;
+
+    case CORRUPT_DROP:
+        line_remove(at, (frame_len - (at - start) < RECOVERY_BURST) ? frame_len - (at - start) : RECOVERY_BURST);
+        break;
+
+    case CORRUPT_TRUNCATE:
+        sim.line_len = at;
+        break;
+
+    case CORRUPT_NOISE:
+        line_insert(at, RECOVERY_BURST);
+        break;
+    }
+}
+
+/** Send bytes from the line to the receiver at the line rate */
+static void line_transmit(size_t from, size_t to, uint64_t start_us)
+{
+    size_t i;
+
+    for (i = from; i < to; i++)
+    {
+        sim.now_us = start_us + (uint64_t) ((double) (i - from + 1) * sim.byte_us);
+        transport_receive(&sim.receiver.link, sim.line + i, 1);
+    }
+}
+
+static void frame_send(uint32_t seq)
+{
+    static uint8_t data[UINT16_MAX];
+    uint16_t i;
+
+    data[0] = (uint8_t) seq;
+    data[1] = (uint8_t) (seq >> 8);
+    data[2] = (uint8_t) (seq >> 16);
+    data[3] = (uint8_t) (seq >> 24);
+    for (i = 4; i < sim.payload; i++)
+    {
+        data[i] = (uint8_t) rng_next();
+    }
+
+    TF_SendSimple(sim.sender.tf, RECOVERY_TYPE, data, sim.payload);
+}
+
+//
+// Trials
+//
+
+struct trial_result
+{
+    uint32_t lost;           /* frames sent but not received */
+    uint64_t recovery_us;    /* end of the damaged frame on the line to the next received frame */
+    bool recovered;
+};
+
+static void endpoint_open(struct endpoint *ep, TF_Peer peer, transport_framing framing)
+{
+    ep->tf = TF_Init(peer);
+    ep->tf->userdata = ep;
+    TF_ResizeBuffers(ep->tf, sim.payload, sim.payload + 16);
+    transport_init(&ep->link, ep->tf, framing, line_output, NULL);
+}
+
+static struct trial_result trial_run(transport_framing framing, enum traffic traffic, enum corruption kind)
+{
+    struct trial_result result = { 0, 0, false };
+    uint64_t bad_end_us = 0;
+    uint32_t frames_sent = 0;
+
+    endpoint_open(&sim.sender, TF_MASTER, framing);
+    endpoint_open(&sim.receiver, TF_SLAVE, framing);
+    TF_AddGenericListener(sim.receiver.tf, frame_listener);
+
+    sim.line_len = 0;
+    sim.now_us = 0;
+    sim.frames_delivered = 0;
+    sim.recovered_us = 0;
+
+    if (traffic == TRAFFIC_STREAM)
+    {
+        size_t bad_end = 0;
+        uint32_t seq;
+
+        for (seq = 0; seq < RECOVERY_FRAMES; seq++)
+        {
+            const size_t start = sim.line_len;
+
+            frame_send(seq);
+            if (seq == RECOVERY_FRAME_BAD)
+            {
+                line_corrupt(kind, framing, start);
+                bad_end = sim.line_len;
+            }
+        }
+
+        frames_sent = RECOVERY_FRAMES;
+        sim.waiting_seq = UINT32_MAX;
+        line_transmit(0, sim.line_len, 0);
+        bad_end_us = (uint64_t) ((double) bad_end * sim.byte_us);
+    }
+    else
+    {
+        uint32_t seq = 0;
+        uint32_t sends = 0;
+
+        /* One frame on the line at a time, repeated until it is received */
+        while ((seq <= RECOVERY_FRAME_BAD + 2) && (sim.now_us < RECOVERY_GIVE_UP_US))
+        {
+            const size_t start = sim.line_len;
+            const uint64_t sent_us = sim.now_us;
+
+            frame_send(seq);
+            frames_sent++;
+
+            if ((seq == RECOVERY_FRAME_BAD) && (sends == 0))
+            {
+                line_corrupt(kind, framing, start);
+            }
+
+            sim.waiting_seq = seq;
+            sim.delivered_seq = false;
+            line_transmit(start, sim.line_len, sent_us);
+
+            if ((seq == RECOVERY_FRAME_BAD) && (sends == 0))
+            {
+                bad_end_us = sim.now_us;
+            }
+
+            if (sim.delivered_seq)
+            {
+                seq++;
+                sends = 0;
+            }
+            else
+            {
+                sim.now_us = sent_us + sim.retry_us;
+                sends++;
+            }
+        }
+    }
+
+    result.lost = frames_sent - sim.frames_delivered;
+    result.recovered = (sim.recovered_us != 0);
+    result.recovery_us = result.recovered ? sim.recovered_us - bad_end_us : 0;
+
+    TF_DeInit(sim.sender.tf);
+    TF_DeInit(sim.receiver.tf);
+
+    return result;
+}
+
+static void case_run(transport_framing framing, enum traffic traffic, enum corruption kind)
+{
+    uint64_t recovery_sum = 0;
+    uint64_t recovery_max = 0;
+    uint64_t lost_sum = 0;
+    uint32_t stalled = 0;
+    uint32_t i;
+    double recovery_mean;
+    double lost_mean;
+
+    sim.rng = 0x2545F491u;
+
+    for (i = 0; i < sim.trials; i++)
+    {
+        const struct trial_result result = trial_run(framing, traffic, kind);
+
+        lost_sum += result.lost;
+        if (!result.recovered)
+        {
+            stalled++;
+            continue;
+        }
+
+        recovery_sum += result.recovery_us;
+        if (result.recovery_us > recovery_max)
+        {
+            recovery_max = result.recovery_us;
+        }
+    }
+
+    recovery_mean = (stalled < sim.trials) ? (double) recovery_sum / (sim.trials - stalled) / 1000.0 : 0.0;
+    lost_mean = (double) lost_sum / sim.trials;
+
+    if (sim.json)
+    {
+        printf("{\"event\":\"result\",\"framing\":\"%s\",\"traffic\":\"%s\",\"corruption\":\"%s\","
+                "\"trials\":%u,\"lost_mean\":%.3f,\"recovery_ms_mean\":%.3f,\"recovery_ms_max\":%.3f,"
+                "\"stalled\":%u}\n",
+                transport_framing_name(framing), traffic_names[traffic], corruption_names[kind],
+                sim.trials, lost_mean, recovery_mean, (double) recovery_max / 1000.0, stalled);
+    }
+    else
+    {
+        printf("%-5s %-7s %-9s %8.2f frames lost %10.3f ms mean %10.3f ms max%s\n",
+                transport_framing_name(framing), traffic_names[traffic], corruption_names[kind],
+                lost_mean, recovery_mean, (double) recovery_max / 1000.0,
+                stalled > 0 ? "  STALLED" : "");
+    }
+
+    fflush(stdout);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--json] [--baud N] [--payload N] [--trials N] [--retry-ms N]\n"
+            "  --json      one JSON object per line\n"
+            "  --baud      line rate, 8N1, default 115200\n"
+            "  --payload   TinyFrame payload of every frame, 4 to the HDLC limit, default 256\n"
+            "  --trials    damaged frames per case, default 200\n"
+            "  --retry-ms  query repeat time, default 200\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    static transport hdlc_probe;
+    int i;
+    int framing;
+    int traffic;
+    int kind;
+
+    sim.baud = 115200;
+    sim.payload = 256;
+    sim.trials = 200;
+    sim.retry_us = 200000;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+        {
+            sim.json = true;
+        }
+        else if ((strcmp(argv[i], "--baud") == 0) && (i + 1 < argc))
+        {
+            sim.baud = (uint32_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if ((strcmp(argv[i], "--payload") == 0) && (i + 1 < argc))
+        {
+            sim.payload = (uint16_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if ((strcmp(argv[i], "--trials") == 0) && (i + 1 < argc))
+        {
+            sim.trials = (uint32_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if ((strcmp(argv[i], "--retry-ms") == 0) && (i + 1 < argc))
+        {
+            sim.retry_us = strtoull(argv[++i], NULL, 10) * 1000u;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    /* Both framings run the same frames, so they have to fit HDLC */
+    transport_init(&hdlc_probe, NULL, TRANSPORT_HDLC, line_output, NULL);
+
+    if ((sim.baud == 0) || (sim.payload < 4) || (sim.payload > transport_max_payload(&hdlc_probe)) || (sim.trials == 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    checksum_init();
+    minihdlc_encode_init();
+
+    sim.byte_us = 10.0 * 1e6 / sim.baud;
+
+    if (sim.json)
+    {
+        printf("{\"event\":\"meta\",\"timestamp\":%lld,\"baud\":%u,\"payload\":%u,\"trials\":%u,"
+                "\"retry_ms\":%llu,\"hdlc_max_payload\":%u}\n",
+                (long long) time(NULL), sim.baud, sim.payload, sim.trials,
+                (unsigned long long) (sim.retry_us / 1000u), (unsigned) transport_max_payload(&hdlc_probe));
+    }
+
+    for (traffic = 0; traffic < TRAFFIC_COUNT; traffic++)
+    {
+        for (kind = 0; kind < CORRUPT_COUNT; kind++)
+        {
+            for (framing = TRANSPORT_RAW; framing <= TRANSPORT_HDLC; framing++)
+            {
+                case_run((transport_framing) framing, (enum traffic) traffic, (enum corruption) kind);
+            }
+        }
+    }
+
+    free(sim.line);
+    return 0;
+}
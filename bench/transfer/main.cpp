@@ -0,0 +1,355 @@
+/**
+ * @file main.cpp
+ *
+ * End to end transfer benchmark. Starts the device emulator on a pseudo
+ * terminal, flashes a generated image through the comhdlc engine and prints
+ * one JSON line per run with throughput, chunk round trip and CPU per byte.
+ * With lost chunk frames or ACKs it doubles as the end to end test of the
+ * resends, with a hung up terminal as the test of a lost port and with an
+ * unusable rate as the test of the rate fallback.
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QTemporaryFile>
+#include <QTimer>
+#include <cstdio>
+
+#include <sys/resource.h>
+
+#include "comhdlc.h"
+#include "checksum/checksum.h"
+#include "minihdlc.h"
+
+enum eBenchExitCode
+{
+    eBenchOk            = 0,
+    eBenchUsage         = 1,
+    eBenchNoEmulator    = 2,  // the emulator did not start or did not report its terminal
+    eBenchNoDevice      = 3,  // the handshake did not complete
+    eBenchTransferError = 4,
+    eBenchDisconnected  = 5,  // the port was lost during a run
+};
+
+static bool bench_quiet = true;
+
+static void bench_message_handler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+{
+    Q_UNUSED(context);
+
+    if (bench_quiet && (type == QtDebugMsg))
+    {
+        return;
+    }
+
+    std::fprintf(stderr, "%s\n", msg.toLocal8Bit().constData());
+}
+
+static void bench_emit(const QString &event, QJsonObject json)
+{
+    json.insert("event", event);
+
+    const QByteArray line = QJsonDocument(json).toJson(QJsonDocument::Compact);
+
+    std::fwrite(line.constData(), 1, static_cast<size_t>(line.size()), stdout);
+    std::fputc('\n', stdout);
+    std::fflush(stdout);
+}
+
+/** User plus system CPU time of this process */
+static qint64 bench_cpu_ns()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (static_cast<qint64>(usage.ru_utime.tv_sec) + usage.ru_stime.tv_sec) * 1000000000LL
+            + (static_cast<qint64>(usage.ru_utime.tv_usec) + usage.ru_stime.tv_usec) * 1000LL;
+}
+
+/**
+ * Writes an image that looks like firmware: code-like blocks that compress
+ * well, alternating with blocks of random data that do not.
+ */
+static bool bench_image_write(QFile &file, quint32 size)
+{
+    static const quint32 block_size = 4096;
+
+    QByteArray block(block_size, '\0');
+    quint32 state = 0x2545F491;
+    quint32 written = 0;
+
+    for (quint32 index = 0; written < size; ++index)
+    {
+        for (quint32 i = 0; i < block_size; ++i)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+
+            // Every second block is a short repeating instruction pattern with sparse changes
+            block[i] = (index & 1) ? static_cast<char>(state) : static_cast<char>(((i & 15) == 0) ? (state & 0x0F) : (i & 0x3F));
+        }
+
+        const quint32 len = qMin(block_size, size - written);
+
+        if (file.write(block.constData(), len) != static_cast<qint64>(len))
+        {
+            return false;
+        }
+
+        written += len;
+    }
+
+    return file.flush();
+}
+
+int main(int argc, char *argv[])
+{
+    checksum_init();
+    minihdlc_encode_init();
+
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("comhdlc-bench");
+
+    qInstallMessageHandler(bench_message_handler);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures transfers through the comhdlc engine against the device emulator");
+    parser.addHelpOption();
+
+    const QCommandLineOption size_option("image-size", "Image size in bytes.", "bytes", "1048576");
+    const QCommandLineOption latency_option("latency-us", "Time one flash write takes on the device.", "us", "0");
+    const QCommandLineOption bandwidth_option("bandwidth", "Link throttle in bytes/s, 0 is unthrottled.", "bytes", "0");
+    const QCommandLineOption window_option("window", "Chunks in flight.", "chunks");
+    const QCommandLineOption no_compress_option("no-compress", "Send the image uncompressed.");
+    const QCommandLineOption framing_option("framing", "Wire framing, raw or hdlc.", "framing", "raw");
+    const QCommandLineOption runs_option("runs", "Transfers to measure.", "count", "3");
+    const QCommandLineOption drop_frame_option("drop-frame", "The emulator ignores every Nth chunk frame, 0 drops none.", "n", "0");
+    const QCommandLineOption drop_ack_option("drop-ack", "The emulator does not acknowledge every Nth chunk, 0 drops none.", "n", "0");
+    const QCommandLineOption hangup_option("hangup", "The emulator closes its terminal after N chunk frames, 0 keeps it open.", "n", "0");
+    const QCommandLineOption bad_rate_option("bad-rate", "The emulator garbles everything received at this rate, 0 for none.", "baud", "0");
+    const QCommandLineOption emulator_option("emulator", "Emulator binary.", "path",
+                                             QDir(QCoreApplication::applicationDirPath()).filePath("comhdlc-emulator"));
+    const QCommandLineOption verbose_option(QStringList() << "v" << "verbose", "Engine diagnostics on stderr.");
+
+    parser.addOption(size_option);
+    parser.addOption(latency_option);
+    parser.addOption(bandwidth_option);
+    parser.addOption(window_option);
+    parser.addOption(no_compress_option);
+    parser.addOption(framing_option);
+    parser.addOption(runs_option);
+    parser.addOption(drop_frame_option);
+    parser.addOption(drop_ack_option);
+    parser.addOption(hangup_option);
+    parser.addOption(bad_rate_option);
+    parser.addOption(emulator_option);
+    parser.addOption(verbose_option);
+
+    if (!parser.parse(QCoreApplication::arguments()))
+    {
+        std::fprintf(stderr, "%s\n", parser.errorText().toLocal8Bit().constData());
+        return eBenchUsage;
+    }
+
+    if (parser.isSet("help"))
+    {
+        parser.showHelp(eBenchOk);
+    }
+
+    bench_quiet = !parser.isSet(verbose_option);
+
+    bool size_ok   = true;
+    bool window_ok = true;
+    bool runs_ok   = true;
+    bool drop_ok   = true;
+    const uint image_size = parser.value(size_option).toUInt(&size_ok);
+    const uint window     = parser.isSet(window_option) ? parser.value(window_option).toUInt(&window_ok) : 0;
+    const int runs        = parser.value(runs_option).toInt(&runs_ok);
+    const uint drop_frame = parser.value(drop_frame_option).toUInt(&drop_ok);
+    const uint drop_ack   = drop_ok ? parser.value(drop_ack_option).toUInt(&drop_ok) : 0;
+    const uint hangup     = drop_ok ? parser.value(hangup_option).toUInt(&drop_ok) : 0;
+    const uint bad_rate   = drop_ok ? parser.value(bad_rate_option).toUInt(&drop_ok) : 0;
+    transport_framing framing = TRANSPORT_RAW;
+    const bool framing_ok = transport_framing_parse(parser.value(framing_option).toLatin1().constData(), &framing);
+
+    if (!size_ok || (image_size == 0) || !window_ok || (window > 255) || !runs_ok || (runs <= 0) || !drop_ok || !framing_ok)
+    {
+        std::fprintf(stderr, "%s\n", parser.helpText().toLocal8Bit().constData());
+        return eBenchUsage;
+    }
+
+    QTemporaryFile image;
+
+    if (!image.open() || !bench_image_write(image, image_size))
+    {
+        std::fprintf(stderr, "Image %s cannot be written\n", image.fileName().toLocal8Bit().constData());
+        return eBenchUsage;
+    }
+
+    // The emulator prints its terminal on the first line
+    QStringList emulator_args;
+    emulator_args << "--latency-us" << parser.value(latency_option)
+                  << "--bandwidth"  << parser.value(bandwidth_option)
+                  << "--framing"    << transport_framing_name(framing)
+                  << "--drop-frame" << QString::number(drop_frame)
+                  << "--drop-ack"   << QString::number(drop_ack)
+                  << "--hangup"     << QString::number(hangup)
+                  << "--bad-rate"   << QString::number(bad_rate);
+
+    if (parser.isSet(no_compress_option))
+    {
+        emulator_args << "--no-compress";
+    }
+
+    QProcess emulator;
+    emulator.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    emulator.start(parser.value(emulator_option), emulator_args);
+
+    if (!emulator.waitForStarted() || !emulator.waitForReadyRead(5000))
+    {
+        std::fprintf(stderr, "Emulator %s did not start\n", parser.value(emulator_option).toLocal8Bit().constData());
+        return eBenchNoEmulator;
+    }
+
+    const QString port_name = QString::fromLocal8Bit(emulator.readLine()).trimmed();
+
+    comhdlc engine(port_name);
+
+    if (window > 0)
+    {
+        engine.set_transfer_window(static_cast<quint8>(window));
+    }
+    engine.set_compression(!parser.isSet(no_compress_option));
+    engine.set_framing(framing);
+
+    int run_index = 0;
+    int failed    = 0;
+    QElapsedTimer run_timer;
+    qint64 run_cpu_ns = 0;
+    double rate_sum   = 0.0;
+    QJsonObject run_json;
+
+    auto run_start = [&]()
+    {
+        run_json   = QJsonObject();
+        run_cpu_ns = bench_cpu_ns();
+        run_timer.start();
+        engine.transfer_file(image.fileName());
+    };
+
+    QObject::connect(&engine, &comhdlc::comport_opened, [&](bool opened)
+    {
+        if (!opened)
+        {
+            std::fprintf(stderr, "Terminal %s cannot be opened\n", port_name.toLocal8Bit().constData());
+            app.exit(eBenchNoEmulator);
+        }
+    });
+
+    quint32 baud = 0;
+
+    QObject::connect(&engine, &comhdlc::baud_rate_changed, [&](quint32 rate)
+    {
+        baud = rate;
+    });
+
+    // The rate is settled once the device is reported, the first run starts then
+    QObject::connect(&engine, &comhdlc::device_connected, [&](bool connected)
+    {
+        if (!connected)
+        {
+            QJsonObject json;
+            json.insert("port", port_name);
+            bench_emit("disconnected", json);
+
+            app.exit(eBenchDisconnected);
+        }
+        else if (!run_timer.isValid())
+        {
+            QJsonObject json;
+            json.insert("port", port_name);
+            json.insert("baud", static_cast<double>(baud));
+            bench_emit("connected", json);
+
+            run_start();
+        }
+    });
+
+    QObject::connect(&engine, &comhdlc::chunk_rtt_measured, [&](quint64 min_us, quint64 avg_us, quint64 max_us)
+    {
+        run_json.insert("rtt_min_us", static_cast<double>(min_us));
+        run_json.insert("rtt_avg_us", static_cast<double>(avg_us));
+        run_json.insert("rtt_max_us", static_cast<double>(max_us));
+    });
+
+    QObject::connect(&engine, &comhdlc::compression_measured, [&](double ratio, double speedup)
+    {
+        Q_UNUSED(speedup);
+        run_json.insert("compression_ratio", ratio);
+    });
+
+    QObject::connect(&engine, &comhdlc::file_transfer_finished, [&](eComHdlcTransferResult result, quint32 crc32)
+    {
+        Q_UNUSED(crc32);
+
+        const qint64 elapsed_ns = run_timer.nsecsElapsed();
+        const qint64 cpu_ns     = bench_cpu_ns() - run_cpu_ns;
+        const double rate       = static_cast<double>(image_size) / (static_cast<double>(elapsed_ns) / 1e9) / 1e6;
+
+        run_json.insert("run",             run_index);
+        run_json.insert("ok",              result == eTransferOk);
+        run_json.insert("bytes",           static_cast<double>(image_size));
+        run_json.insert("seconds",         static_cast<double>(elapsed_ns) / 1e9);
+        run_json.insert("mb_per_s",        rate);
+        run_json.insert("cpu_ns_per_byte", static_cast<double>(cpu_ns) / image_size);
+        bench_emit("run", run_json);
+
+        if (result == eTransferOk)
+        {
+            rate_sum += rate;
+        }
+        else
+        {
+            ++failed;
+        }
+
+        if (++run_index < runs)
+        {
+            // Out of the signal, the engine is still inside its finish handler
+            QTimer::singleShot(0, &engine, run_start);
+            return;
+        }
+
+        QJsonObject json;
+        json.insert("runs",          runs);
+        json.insert("failed",        failed);
+        json.insert("mb_per_s_mean", (runs > failed) ? rate_sum / (runs - failed) : 0.0);
+        bench_emit("summary", json);
+
+        app.exit(failed == 0 ? eBenchOk : eBenchTransferError);
+    });
+
+    QTimer::singleShot(10000, &engine, [&]()
+    {
+        if (!run_timer.isValid())
+        {
+            std::fprintf(stderr, "No device on %s\n", port_name.toLocal8Bit().constData());
+            app.exit(eBenchNoDevice);
+        }
+    });
+
+    engine.start();
+
+    const int exit_code = app.exec();
+
+    emulator.terminate();
+    emulator.waitForFinished();
+
+    return exit_code;
+}
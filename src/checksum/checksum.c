@@ -0,0 +1,311 @@
+/**
+ * @file checksum.c
+ */
+
+#include "checksum.h"
+
+#include <stdbool.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CHECKSUM_HAVE_CLMUL 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define CHECKSUM_HAVE_CLMUL 0
+#endif
+
+/* Reflected polynomials */
+#define CRC8_POLY      0x8Cu
+#define CRC16_POLY     0xA001u
+#define CRC_CCITT_POLY 0x8408u
+#define CRC32_POLY     0xEDB88320u
+
+/*
+ * Slicing-by-8 tables. Entry [k][n] is the CRC of byte n followed by k zero
+ * bytes. Written once by checksum_init(), read only afterwards
+ */
+static uint32_t crc8_tables[8][256];
+static uint32_t crc16_tables[8][256];
+static uint32_t crc_ccitt_tables[8][256];
+static uint32_t crc32_tables[8][256];
+
+static bool checksum_ready = false;
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *data, size_t len);
+static uint32_t (*crc32_kernel)(uint32_t crc, const uint8_t *data, size_t len) = crc32_slice8;
+static const char *crc32_kernel_name = "slice8";
+
+static void crc_tables_build(uint32_t tables[8][256], uint32_t poly)
+{
+    uint32_t n;
+    uint32_t k;
+
+    for (n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+
+        for (k = 0; k < 8; k++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ poly) : (crc >> 1);
+        }
+
+        tables[0][n] = crc;
+    }
+
+    for (n = 0; n < 256; n++)
+    {
+        for (k = 1; k < 8; k++)
+        {
+            const uint32_t prev = tables[k - 1][n];
+            tables[k][n] = (prev >> 8) ^ tables[0][prev & 0xFF];
+        }
+    }
+}
+
+static inline uint32_t load_le32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/*
+ * Slicing-by-8 for any reflected CRC up to 32 bits wide. The register is
+ * kept in the low bits of crc, so narrower CRCs share the same code.
+ */
+static inline uint32_t crc_slice8(const uint32_t tables[8][256], uint32_t crc,
+        const uint8_t *data, size_t len)
+{
+    while (len >= 8)
+    {
+        const uint32_t one = load_le32(data) ^ crc;
+        const uint32_t two = load_le32(data + 4);
+
+        crc = tables[7][one & 0xFF] ^ tables[6][(one >> 8) & 0xFF]
+            ^ tables[5][(one >> 16) & 0xFF] ^ tables[4][one >> 24]
+            ^ tables[3][two & 0xFF] ^ tables[2][(two >> 8) & 0xFF]
+            ^ tables[1][(two >> 16) & 0xFF] ^ tables[0][two >> 24];
+
+        data += 8;
+        len -= 8;
+    }
+
+    while (len--)
+    {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *data++) & 0xFF];
+    }
+
+    return crc;
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *data, size_t len)
+{
+    return crc_slice8(crc32_tables, crc, data, len);
+}
+
+#if CHECKSUM_HAVE_CLMUL
+
+/*
+ * CRC32 folding with carry-less multiplication, after Intel's "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+ * Takes at least 64 bytes and a multiple of 16.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_clmul_fold(uint32_t crc, const uint8_t *data, size_t len)
+{
+    /* Bit-reflected folding constants and Barrett polynomials for 0xEDB88320 */
+    static const uint64_t k1k2[] __attribute__((aligned(16))) = { 0x0154442bd4, 0x01c6e41596 };
+    static const uint64_t k3k4[] __attribute__((aligned(16))) = { 0x01751997d0, 0x00ccaa009e };
+    static const uint64_t k5k0[] __attribute__((aligned(16))) = { 0x0163cd6124, 0x0000000000 };
+    static const uint64_t poly[] __attribute__((aligned(16))) = { 0x01db710641, 0x01f7011641 };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *) (data + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *) (data + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *) (data + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *) (data + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+    x0 = _mm_load_si128((const __m128i *) k1k2);
+
+    data += 64;
+    len -= 64;
+
+    /* Fold four lanes of 64 bytes in parallel */
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *) (data + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *) (data + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *) (data + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *) (data + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        data += 64;
+        len -= 64;
+    }
+
+    /* Fold the four lanes into one */
+    x0 = _mm_load_si128((const __m128i *) k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* Fold the remaining 16 byte blocks */
+    while (len >= 16)
+    {
+        x2 = _mm_loadu_si128((const __m128i *) data);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        data += 16;
+        len -= 16;
+    }
+
+    /* 128 to 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i *) k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x0 = _mm_load_si128((const __m128i *) poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_clmul(uint32_t crc, const uint8_t *data, size_t len)
+{
+    /* Short blocks are faster through the tables */
+    if (len >= 64)
+    {
+        const size_t fold_len = len & ~(size_t) 15;
+
+        crc = crc32_clmul_fold(crc, data, fold_len);
+        data += fold_len;
+        len -= fold_len;
+    }
+
+    return crc32_slice8(crc, data, len);
+}
+
+static bool cpu_has_clmul(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return false;
+    }
+
+    return (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+}
+
+#endif // CHECKSUM_HAVE_CLMUL
+
+void checksum_init(void)
+{
+    if (checksum_ready)
+    {
+        return;
+    }
+
+    crc_tables_build(crc8_tables, CRC8_POLY);
+    crc_tables_build(crc16_tables, CRC16_POLY);
+    crc_tables_build(crc_ccitt_tables, CRC_CCITT_POLY);
+    crc_tables_build(crc32_tables, CRC32_POLY);
+
+#if CHECKSUM_HAVE_CLMUL
+    if (cpu_has_clmul())
+    {
+        crc32_kernel = crc32_clmul;
+        crc32_kernel_name = "pclmulqdq";
+    }
+#endif
+
+    checksum_ready = true;
+}
+
+const char *checksum_crc32_kernel(void)
+{
+    return crc32_kernel_name;
+}
+
+uint8_t checksum_xor(uint8_t acc, const uint8_t *data, size_t len)
+{
+    uint32_t wide = 0;
+
+    while (len >= 4)
+    {
+        wide ^= load_le32(data);
+        data += 4;
+        len -= 4;
+    }
+
+    wide ^= wide >> 16;
+    wide ^= wide >> 8;
+    acc ^= (uint8_t) wide;
+
+    while (len--)
+    {
+        acc ^= *data++;
+    }
+
+    return acc;
+}
+
+uint8_t checksum_crc8(uint8_t crc, const uint8_t *data, size_t len)
+{
+    return (uint8_t) crc_slice8(crc8_tables, crc, data, len);
+}
+
+uint16_t checksum_crc16(uint16_t crc, const uint8_t *data, size_t len)
+{
+    return (uint16_t) crc_slice8(crc16_tables, crc, data, len);
+}
+
+uint16_t checksum_crc_ccitt(uint16_t crc, const uint8_t *data, size_t len)
+{
+    return (uint16_t) crc_slice8(crc_ccitt_tables, crc, data, len);
+}
+
+uint32_t checksum_crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+    return crc32_kernel(crc, data, len);
+}
@@ -0,0 +1,59 @@
+/**
+ * @file checksum.h
+ *
+ * Block checksum kernels shared by TinyFrame and minihdlc.
+ *
+ * Every function continues a running checksum over a block of bytes and
+ * gives the same result as feeding the block byte by byte to the per-byte
+ * update of the matching algorithm. Initial values and final inversions
+ * are left to the caller.
+ *
+ * The CRCs are computed with slicing-by-8 tables. On x86-64 CPUs with
+ * PCLMULQDQ and SSE4.1, CRC32 uses carry-less multiplication folding
+ * instead. The tables are built and the kernels selected by checksum_init().
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Build the tables and select the kernels for the running CPU.
+ * Call it once at startup, from the main thread before any other thread
+ * starts. It is not thread safe, and the other functions expect it to
+ * have run.
+ */
+void checksum_init(void);
+
+/**
+ * Name of the selected CRC32 kernel, for logs and benchmarks
+ */
+const char *checksum_crc32_kernel(void);
+
+/** XOR of all bytes */
+uint8_t checksum_xor(uint8_t acc, const uint8_t *data, size_t len);
+
+/** Dallas/Maxim CRC8 (1-wire), reflected polynomial 0x8C */
+uint8_t checksum_crc8(uint8_t crc, const uint8_t *data, size_t len);
+
+/** CRC16 with the polynomial 0x8005, reflected 0xA001 */
+uint16_t checksum_crc16(uint16_t crc, const uint8_t *data, size_t len);
+
+/** CRC16-CCITT as used by PPP and HDLC, reflected polynomial 0x8408 */
+uint16_t checksum_crc_ccitt(uint16_t crc, const uint8_t *data, size_t len);
+
+/** CRC32 with the polynomial 0xEDB88320 */
+uint32_t checksum_crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // CHECKSUM_H
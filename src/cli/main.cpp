@@ -0,0 +1,246 @@
+/**
+ * @file main.cpp
+ *
+ * Headless flasher. Progress and results are printed to stdout as JSON
+ * lines, diagnostics go to stderr.
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <cstdio>
+
+#include "comhdlc.h"
+#include "comhdlcfleet.h"
+#include "checksum/checksum.h"
+#include "minihdlc.h"
+
+enum eCliExitCode
+{
+    eExitOk            = 0,
+    eExitUsage         = 1,
+    eExitPortError     = 2,  // a port could not be opened
+    eExitNoDevice      = 3,  // a device did not answer the handshake in time
+    eExitTransferError = 4,  // the image did not make it to every device
+};
+
+static bool cli_quiet = false;
+
+static void cli_message_handler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+{
+    Q_UNUSED(context);
+
+    if (cli_quiet && (type == QtDebugMsg))
+    {
+        return;
+    }
+
+    std::fprintf(stderr, "%s\n", msg.toLocal8Bit().constData());
+}
+
+/** One event per line, flushed right away so a supervising script sees it live */
+static void cli_emit(const QString &event, QJsonObject json)
+{
+    json.insert("event", event);
+
+    const QByteArray line = QJsonDocument(json).toJson(QJsonDocument::Compact);
+
+    std::fwrite(line.constData(), 1, static_cast<size_t>(line.size()), stdout);
+    std::fputc('\n', stdout);
+    std::fflush(stdout);
+}
+
+static QString cli_result_name(eComHdlcTransferResult result)
+{
+    switch (result)
+    {
+    case eTransferOk:             return "ok";
+    case eTransferReadError:      return "read_error";
+    case eTransferNoAck:          return "no_ack";
+    case eTransferFinishTimeout:  return "finish_timeout";
+    case eTransferDigestMismatch: return "digest_mismatch";
+    case eTransferDeviceError:    return "device_error";
+    case eTransferNoDevice:       return "no_device";
+    case eTransferPortError:      return "port_error";
+    }
+
+    return "unknown";
+}
+
+int main(int argc, char *argv[])
+{
+    checksum_init();
+    minihdlc_encode_init();
+
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("comhdlc-cli");
+
+    qInstallMessageHandler(cli_message_handler);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Flashes a firmware image over one or more serial ports");
+    parser.addHelpOption();
+
+    const QCommandLineOption port_option(QStringList() << "p" << "port", "Serial port, repeat for several devices.", "port");
+    const QCommandLineOption image_option(QStringList() << "i" << "image", "Firmware image.", "file");
+    const QCommandLineOption window_option("window", "Chunks in flight per port.", "chunks");
+    const QCommandLineOption no_compress_option("no-compress", "Send the image uncompressed.");
+    const QCommandLineOption framing_option("framing", "Wire framing, raw or hdlc. Once for all ports or once per port, in --port order.", "framing", "raw");
+    const QCommandLineOption connect_timeout_option("connect-timeout", "Milliseconds to wait for every device.", "ms", "10000");
+    const QCommandLineOption quiet_option(QStringList() << "q" << "quiet", "No diagnostics on stderr.");
+
+    parser.addOption(port_option);
+    parser.addOption(image_option);
+    parser.addOption(window_option);
+    parser.addOption(no_compress_option);
+    parser.addOption(framing_option);
+    parser.addOption(connect_timeout_option);
+    parser.addOption(quiet_option);
+
+    if (!parser.parse(QCoreApplication::arguments()))
+    {
+        std::fprintf(stderr, "%s\n", parser.errorText().toLocal8Bit().constData());
+        return eExitUsage;
+    }
+
+    if (parser.isSet("help"))
+    {
+        parser.showHelp(eExitOk);
+    }
+
+    cli_quiet = parser.isSet(quiet_option);
+
+    const QStringList port_names = parser.values(port_option);
+    const QString image          = parser.value(image_option);
+    bool window_ok  = true;
+    bool timeout_ok = true;
+    const uint window          = parser.isSet(window_option) ? parser.value(window_option).toUInt(&window_ok) : 0;
+    const int connect_timeout  = parser.value(connect_timeout_option).toInt(&timeout_ok);
+
+    // One framing for every port, or one per port
+    const QStringList framing_names = parser.values(framing_option);
+    QList<transport_framing> framings;
+    bool framing_ok = (framing_names.size() == 1) || (framing_names.size() == port_names.size());
+
+    for (const QString &framing_name : framing_names)
+    {
+        transport_framing framing = TRANSPORT_RAW;
+        framing_ok = framing_ok && transport_framing_parse(framing_name.toLatin1().constData(), &framing);
+        framings.append(framing);
+    }
+
+    if (port_names.isEmpty() || image.isEmpty() || !window_ok || (window > 255) || !timeout_ok || (connect_timeout <= 0) || !framing_ok)
+    {
+        std::fprintf(stderr, "%s\n", parser.helpText().toLocal8Bit().constData());
+        return eExitUsage;
+    }
+
+    if (!QFileInfo(image).isReadable())
+    {
+        std::fprintf(stderr, "Image %s cannot be read\n", image.toLocal8Bit().constData());
+        return eExitUsage;
+    }
+
+    comhdlc_fleet fleet;
+    QHash<QString, quint32> port_bytes;
+    int ports_no_device  = 0;
+    int ports_port_error = 0;
+
+    fleet.set_transfer_window(static_cast<quint8>(window));
+    fleet.set_compression(!parser.isSet(no_compress_option));
+    fleet.set_connect_timeout(connect_timeout);
+
+    QObject::connect(&fleet, &comhdlc_fleet::port_opened, [&](const QString &port_name, bool opened)
+    {
+        if (!opened)
+        {
+            QJsonObject json;
+            json.insert("port", port_name);
+            cli_emit("port_error", json);
+        }
+    });
+
+    QObject::connect(&fleet, &comhdlc_fleet::port_device_connected, [&](const QString &port_name, bool connected)
+    {
+        QJsonObject json;
+        json.insert("port", port_name);
+        cli_emit(connected ? "connected" : "disconnected", json);
+    });
+
+    QObject::connect(&fleet, &comhdlc_fleet::port_progress, [&](const QString &port_name, quint32 bytes_sent, quint32 bytes_total)
+    {
+        Q_UNUSED(bytes_total);
+        port_bytes.insert(port_name, bytes_sent);
+    });
+
+    // Per-port progress rides on the throttled fleet report, not on every chunk
+    QObject::connect(&fleet, &comhdlc_fleet::fleet_progress, [&](quint64 bytes_sent, quint64 bytes_total, quint64 bytes_per_second)
+    {
+        QJsonObject ports;
+        for (auto it = port_bytes.constBegin(); it != port_bytes.constEnd(); ++it)
+        {
+            ports.insert(it.key(), static_cast<double>(it.value()));
+        }
+
+        QJsonObject json;
+        json.insert("bytes",            static_cast<double>(bytes_sent));
+        json.insert("total",            static_cast<double>(bytes_total));
+        json.insert("bytes_per_second", static_cast<double>(bytes_per_second));
+        json.insert("ports",            ports);
+        cli_emit("progress", json);
+    });
+
+    QObject::connect(&fleet, &comhdlc_fleet::port_transfer_finished,
+                     [&](const QString &port_name, eComHdlcTransferResult result, quint32 crc32)
+    {
+        QJsonObject json;
+        json.insert("port",   port_name);
+        json.insert("result", cli_result_name(result));
+        json.insert("crc32",  QString::number(crc32, 16));
+        cli_emit("finished", json);
+
+        if (result == eTransferNoDevice)
+        {
+            ++ports_no_device;
+        }
+        else if (result == eTransferPortError)
+        {
+            ++ports_port_error;
+        }
+    });
+
+    QObject::connect(&fleet, &comhdlc_fleet::fleet_finished, [&](int succeeded, int failed)
+    {
+        QJsonObject json;
+        json.insert("succeeded", succeeded);
+        json.insert("failed",    failed);
+        cli_emit("done", json);
+
+        if (failed == 0)
+        {
+            app.exit(eExitOk);
+        }
+        else if (ports_port_error > 0)
+        {
+            app.exit(eExitPortError);
+        }
+        else
+        {
+            app.exit((ports_no_device > 0) ? eExitNoDevice : eExitTransferError);
+        }
+    });
+
+    for (int i = 0; i < port_names.size(); ++i)
+    {
+        fleet.set_framing(framings.value(i, framings.first()));
+        fleet.add_port(port_names.at(i));
+    }
+
+    // Engines that are still negotiating start as soon as their link is up
+    fleet.flash(image);
+
+    return app.exec();
+}
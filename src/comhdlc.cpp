@@ -6,38 +6,78 @@
 
 #include <QSerialPort>
 #include <QDebug>
-#include <QDataStream>
 #include <QByteArray>
-#include <QByteArrayList>
+#include <QElapsedTimer>
+#include <QtEndian>
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
 #include <tinyframe/TinyFrame.h>
+#include <compress/lz.h>
+#include <checksum/checksum.h>
 
-comhdlc* comhdlc::comhdlc_ptr = nullptr;
+const quint32 comhdlc::baud_rate_base;
+const quint16 comhdlc::frame_payload_max;
+
+/** Rates offered to the device on top of the base rate */
+static const quint32 baud_rate_candidates[] =
+{
+    57600, 115200, 230400, 460800, 921600, 1000000, 2000000, 3000000, 4000000
+};
+
+/** Bytes TinyFrame adds around every payload */
+static const quint32 tf_frame_overhead = TF_USE_SOF_BYTE + TF_ID_BYTES + TF_LEN_BYTES + TF_TYPE_BYTES + 2 * sizeof(TF_CKSUM);
+
+/** Probe tags, passed to the probe callback in userdata2 */
+static const quintptr probe_tag_confirm   = 0;
+static const quintptr probe_tag_benchmark = 1;
+
+/** Bytes leaving through the transport */
+static void comhdlc_transport_output(transport *t, const uint8_t *data, uint32_t length);
 
 /** Callbacks for TinyFrame */
 static TF_Result tf_write_file_clbk(TinyFrame *tf, TF_Msg *msg);
 static TF_Result tf_write_file_size_clbk(TinyFrame *tf, TF_Msg *msg);
+static TF_Result tf_write_file_resume_clbk(TinyFrame *tf, TF_Msg *msg);
+static TF_Result tf_write_file_finish_clbk(TinyFrame *tf, TF_Msg *msg);
 static TF_Result tf_handshake_clbk(TinyFrame *tf, TF_Msg *msg);
+static TF_Result tf_baud_list_clbk(TinyFrame *tf, TF_Msg *msg);
+static TF_Result tf_baud_switch_clbk(TinyFrame *tf, TF_Msg *msg);
+static TF_Result tf_baud_probe_clbk(TinyFrame *tf, TF_Msg *msg);
 
 comhdlc::comhdlc(QString comName)
     : com_port_name{comName},
       serial_port{new QSerialPort(this)}
 {
-    if (com_port_name.isEmpty())
+    Q_ASSERT(!com_port_name.isEmpty());
+
+    // Needed to queue the result to the GUI thread
+    qRegisterMetaType<eComHdlcTransferResult>("eComHdlcTransferResult");
+}
+
+/**
+ * Opens the port and starts the handshake. The engine lives in its own thread,
+ * so this is run from that thread's event loop rather than from the constructor.
+ */
+void comhdlc::start()
+{
+    if (com_port_name.isEmpty() || (serial_port == nullptr))
     {
-        Q_ASSERT(0);
+        emit comport_opened(false);
         return;
     }
 
     if (serial_port->isOpen())
     {
         qDebug() << "[ERROR] Serial port " << serial_port->portName() << " is already opened";
-        delete serial_port;
-        serial_port = nullptr;
+        emit comport_opened(false);
         return;
     }
 
     serial_port->setPortName(com_port_name);
-    serial_port->setBaudRate(QSerialPort::Baud38400);
+    serial_port->setBaudRate(static_cast<qint32>(baud_rate_base));
     serial_port->setDataBits(QSerialPort::Data8);
     serial_port->setParity(QSerialPort::NoParity);
     serial_port->setStopBits(QSerialPort::OneStop);
@@ -48,16 +88,29 @@ comhdlc::comhdlc(QString comName)
         serial_port->clear(QSerialPort::AllDirections);
         connect(serial_port, &QSerialPort::readyRead, this, &comhdlc::comport_data_available);
         connect(serial_port, &QSerialPort::errorOccurred, this, &comhdlc::comport_error_handler);
-        connect(serial_port, &QSerialPort::bytesWritten, this, &comhdlc::comport_bytes_written);
 
         tiny_frame = TF_Init(TF_MASTER);
 
+        // TinyFrame callbacks find their engine through the instance, any number of engines can coexist
+        tiny_frame->userdata = this;
+
+        transport_init(&link_transport, tiny_frame, framing, comhdlc_transport_output, this);
+        qDebug() << "[INFO] " << com_port_name << " uses " << transport_framing_name(framing) << " framing";
+
+        // Room for a full transfer window, the built-in listener slots only cover a few chunks
+        if (!TF_ResizeIdListeners(tiny_frame, transfer_id_listeners))
+        {
+            qDebug() << "[WARNING] TinyFrame keeps " << tiny_frame->max_id_lst << " ID listeners";
+        }
+
         timer_handshake = new QTimer(this);
         timer_tf        = new QTimer(this);
         connect(timer_tf,        &QTimer::timeout, this, &comhdlc::tf_handle_tick);
         connect(timer_handshake, &QTimer::timeout, this, &comhdlc::send_handshake);
 
-        timer_tf->start(1);
+        // TinyFrame timeouts are deadlines, the timer is only armed for the next one
+        timer_tf->setSingleShot(true);
+        timer_tf->setTimerType(Qt::PreciseTimer);
 
         const quint16 timeout_ms = 100;
         timer_handshake->start(timeout_ms);
@@ -65,16 +118,17 @@ comhdlc::comhdlc(QString comName)
 
         // Register Tiny Frame callbacks
         TF_AddTypeListener(tiny_frame, eComHdlcAnswer_HandShake, tf_handshake_clbk);
-        TF_AddTypeListener(tiny_frame, eCmdWriteFile           , tf_write_file_clbk);
-        TF_AddTypeListener(tiny_frame, eCmdWriteFileSize       , tf_write_file_size_clbk);
 
-        comhdlc_ptr = this;
+        baud_rates.clear();
+        baud_rates.append(baud_rate_base);
+        baud_index = 0;
+
+        emit comport_opened(true);
     }
     else
     {
         qDebug() << "[ERROR] " << com_port_name << " cannot be opened. Error: " << serial_port->error();
-        delete serial_port;
-        serial_port = nullptr;
+        emit comport_opened(false);
     }
 }
 
@@ -96,10 +150,17 @@ comhdlc::~comhdlc()
 
     if (tiny_frame)
     {
+        transfer_abort();
         TF_DeInit(tiny_frame);
         tiny_frame = nullptr;
     }
 
+    if (file_send)
+    {
+        delete file_send;
+        file_send = nullptr;
+    }
+
     if (serial_port)
     {
         if (serial_port->isOpen())
@@ -112,223 +173,1703 @@ comhdlc::~comhdlc()
         delete serial_port;
         serial_port = nullptr;
     }
-
-    comhdlc_ptr = nullptr;
 }
 
-bool comhdlc::is_comport_connected(void) const
+void comhdlc::handshake_routine_stop()
 {
-    if (serial_port != nullptr)
+    if (timer_handshake)
     {
-        return serial_port->isOpen();
+        timer_handshake->stop();
     }
-
-    return false;
 }
 
-void comhdlc::handshake_routine_stop()
+void comhdlc::handshake_done(const quint8 *data, TF_LEN len)
 {
-    if (timer_handshake)
+    // Answers to earlier handshake queries may still arrive
+    if ((timer_handshake == nullptr) || !timer_handshake->isActive())
     {
-        timer_handshake->stop();
+        return;
     }
+
+    handshake_routine_stop();
+
+    // Older devices only echo 0xBE 0xEF and have no capabilities
+    device_caps = (len > 2) ? data[2] : 0;
+
+    const quint16 device_payload = (len > 4) ? qFromLittleEndian<quint16>(data + 3) : 0;
+
+    qDebug() << "[INFO] Handshake done, device capabilities " << device_caps << ", negotiating the link rate";
+
+    // The answer still sits in the TinyFrame receive buffer, it is swapped once the listener returned
+    QTimer::singleShot(0, this, [this, device_payload]()
+    {
+        frame_negotiate(device_payload);
+        link_negotiate();
+    });
 }
 
-void comhdlc::transfer_file(const QByteArray &file, QString file_name)
+/**
+ * Sizes the TinyFrame buffers and the chunks for the largest payload both
+ * sides take. Devices that do not tell, or take less than the old fixed
+ * chunks, get those.
+ */
+void comhdlc::frame_negotiate(quint16 device_payload)
 {
-    file_chunks.clear();
-    file_send.clear();
-    file_send          = file;
-    file_chunk_current = 0;
-
-    QDataStream to_send(&file_send, QIODevice::ReadOnly);
-    to_send.setByteOrder(QDataStream::LittleEndian);
+    frame_payload   = TF_MAX_PAYLOAD_RX;
+    file_chunk_size = TF_SENDBUF_LEN;
 
-    // Split file to chunks
-    while (!to_send.atEnd())
+    if (device_payload > TF_SENDBUF_LEN + file_chunk_header)
     {
-        QByteArray buffer;
+        const quint16 payload = qMin(device_payload, frame_payload_limit());
 
-        for (quint16 i = 0; i < TF_SENDBUF_LEN; ++i)
+        // Whole frames go out in one write
+        if (TF_ResizeBuffers(tiny_frame, payload, payload + tf_frame_overhead))
         {
-            char byte = 0;
-            const qint16 bytes_read = to_send.readRawData(&byte, 1);
-            if (bytes_read <= 0)
-            {
-                break;
-            }
-
-            buffer.insert(i, byte);
+            frame_payload   = payload;
+            file_chunk_size = ((payload - file_chunk_header) / file_chunk_align) * file_chunk_align;
+        }
+        else
+        {
+            qDebug() << "[WARNING] No memory for " << payload << " byte frames, keeping " << file_chunk_size << " byte chunks";
+            TF_ResizeBuffers(tiny_frame, 0, 0);
         }
+    }
+    else
+    {
+        TF_ResizeBuffers(tiny_frame, 0, 0);
+    }
 
-        file_chunks.append(buffer);
+    // Benchmark probes are as long as a chunk, so the benchmark sees the frames the transfer uses.
+    // A rate switch is confirmed with the first baud_probe_size bytes only, a whole chunk would not
+    // make it through the probe timeout and the device's revert window at the slow rates.
+    // Bytes 0x00..0xFF in turn, so a chunk-sized probe carries every value the framing has to handle
+    baud_probe_payload.resize(file_chunk_size);
+    for (int i = 0; i < baud_probe_payload.size(); ++i)
+    {
+        baud_probe_payload[i] = static_cast<char>(i);
     }
 
-    const uint32_t file_size = static_cast<uint32_t>(file_send.size());
+    qDebug() << "[INFO] Frame payload " << frame_payload << " bytes, chunks of " << file_chunk_size << " bytes";
+}
 
-    // Wait for 10 seconds for the response
-    TF_QuerySimple(tiny_frame,
-                   eCmdWriteFileSize,
-                   (const uint8_t*)&file_size,
-                   sizeof(uint32_t),
-                   tf_write_file_size_clbk,
-                   10000);
+void comhdlc::set_compression(bool enabled)
+{
+    // Takes effect with the next file
+    compression_enabled = enabled;
 }
 
-void comhdlc::transfer_file_chunk()
+void comhdlc::set_framing(transport_framing wire_framing)
 {
-    // The file was transferred
-    if (file_chunk_current >= file_chunks.size())
+    // Takes effect when the port is opened, the device must use the same framing
+    framing = wire_framing;
+}
+
+void comhdlc::set_transfer_window(quint8 window)
+{
+    // One ID listener slot is held by the chunk being acknowledged while the next one
+    // is sent, and one is kept for the handshake
+    if (window == 0)
+    {
+        window = 1;
+    }
+    else if (window > transfer_window_max)
+    {
+        window = transfer_window_max;
+    }
+
+    transfer_window = window;
+}
+
+void comhdlc::transfer_file(const QString &file_name)
+{
+    if (!link_ready || (baud_state != baud_idle))
     {
-        emit file_was_transferred(true);
+        // Started by link_up() once the rate is settled
+        transfer_pending = file_name;
         return;
     }
 
-    QByteArray chunk        = file_chunks.at(file_chunk_current);
-    const quint16 data_size = static_cast<quint16>(chunk.size());
+    transfer_abort();
 
-    emit file_chunk_transferred(data_size);
+    if (file_send)
+    {
+        delete file_send;
+        file_send = nullptr;
+    }
 
-    send_buffer = chunk;
+    // The image is streamed from the file, chunks are pulled from it when they are sent
+    file_send = new firmware_source(file_name);
 
-    TF_QuerySimple(tiny_frame,
-                   eCmdWriteFile,
-                   reinterpret_cast<const uint8_t*>(chunk.constData()),
-                   data_size,
-                   tf_write_file_clbk,
-                   2000);
+    if (!file_send->open())
+    {
+        delete file_send;
+        file_send = nullptr;
+        emit file_transfer_finished(eTransferReadError, 0);
+        return;
+    }
 
-    ++file_chunk_current;
-}
+    file_chunks_count     = (file_send->size() + file_chunk_size - 1) / file_chunk_size;
+    file_chunk_current    = 0;
+    file_chunks_acked     = 0;
+    file_chunks_committed = 0;
+    file_crc              = 0xFFFFFFFF;
+    rx_bytes_total        = 0;
+    rx_process_ns         = 0;
+    link_chunks_sent      = 0;
+    link_chunks_lost      = 0;
+    rtt_samples           = 0;
+    rtt_sum_ns            = 0;
+    rtt_min_ns            = 0;
+    rtt_max_ns            = 0;
+
+    if (!rtt_clock.isValid())
+    {
+        rtt_clock.start();
+    }
 
-void comhdlc::comport_data_available()
-{
-    quint32 bytes_received = 0;
-    char byte              = 0;
+    transfer_compressed = compression_enabled && (device_caps & eComHdlcCap_CompressLz);
+    compress_next       = 0;
+    compress_raw_bytes  = 0;
+    compress_wire_bytes = 0;
+
+    if (transfer_compressed)
+    {
+        qDebug() << "[INFO] " << file_send->file_name() << " is sent compressed";
+    }
 
-    while(serial_port->read(&byte, 1) > 0)
+    checkpoint = new transfer_checkpoint(com_port_name, file_name);
+
+    if (checkpoint->load() && (checkpoint->offset() > 0) && (checkpoint->offset() <= file_send->size()))
     {
-        TF_AcceptChar(tiny_frame, (quint8)byte);
+        quint8 raw[3 * sizeof(quint32)];
+        qToLittleEndian<quint32>(file_send->size(),   raw);
+        qToLittleEndian<quint32>(checkpoint->offset(), raw + 4);
+        qToLittleEndian<quint32>(checkpoint->crc(),    raw + 8);
+
+        qDebug() << "[INFO] Checkpoint at " << checkpoint->offset() << " bytes, asking the device to resume";
 
-        ++bytes_received;
+        // transfer_resume_answered() continues or starts over
+        resume_pending = link_query(eCmdWriteFileResume, raw, sizeof(raw), tf_write_file_resume_clbk, resume_timeout_ticks, 0);
+
+        if (resume_pending)
+        {
+            return;
+        }
     }
 
-    qDebug() << "[INFO] " << bytes_received << " bytes were received";
+    transfer_start();
 }
 
-void comhdlc::comport_bytes_written(quint64 bytes)
+/**
+ * Starts the transfer from the first chunk
+ */
+void comhdlc::transfer_start()
 {
-    qDebug() << "[INFO] " << bytes << " Bytes were written";
-}
+    file_chunk_current    = 0;
+    file_chunks_acked     = 0;
+    file_chunks_committed = 0;
+    file_crc              = 0xFFFFFFFF;
+    digest_crc            = 0xFFFFFFFF;
+    digest_chunk_next     = 0;
 
-void comhdlc::comport_error_handler(QSerialPort::SerialPortError serialPortError)
-{
-    qDebug() << "[ERROR] Serial port " << com_port_name << " error occured " << serialPortError;
+    checkpoint_save();
+
+    size_retries = 0;
+    transfer_send_size();
+
+    // The first chunks are encoded while the device prepares for the image
+    compress_schedule();
 }
 
-void comhdlc::comport_send_buff(const quint8 *data, quint16 data_len)
+/**
+ * Tells the device the image size, transfer_size_answered() starts the chunks
+ */
+void comhdlc::transfer_send_size()
 {
-    Q_ASSERT(data);
-    Q_ASSERT(data_len > 0);
+    quint8 raw[sizeof(quint32)];
+    qToLittleEndian<quint32>(file_send->size(), raw);
 
-    if (serial_port)
+    size_pending = true;
+
+    if (!link_query(eCmdWriteFileSize, raw, sizeof(raw), tf_write_file_size_clbk, size_timeout_ticks, 0))
     {
-        serial_port->write((const char*)data, data_len);
+        transfer_size_answered(false);
     }
 }
 
-void comhdlc::send_handshake()
+void comhdlc::transfer_size_answered(bool answered)
 {
-    Q_ASSERT(timer_handshake != nullptr);
+    if (!size_pending)
+    {
+        return;
+    }
 
-    const quint8 raw[] = { 0xBE, 0xEF };
-    TF_QuerySimple(tiny_frame,
-                   eComHdlcAnswer_HandShake,
-                   raw,
-                   sizeof (raw),
-                   tf_handshake_clbk,
-                   100
-                   );
-}
+    size_pending = false;
 
-void comhdlc::tf_handle_tick()
-{
-    Q_ASSERT(tiny_frame);
-    TF_Tick(tiny_frame);
+    if (answered)
+    {
+        transfer_pump();
+        return;
+    }
+
+    if (size_retries < transfer_retries_max)
+    {
+        size_retries++;
+        qDebug() << "[WARNING] Image size is not acknowledged, retry " << size_retries;
+        transfer_send_size();
+        return;
+    }
+
+    qDebug() << "[ERROR] Image size is not acknowledged after " << size_retries << " retries";
+    transfer_abort();
+    emit file_transfer_finished(eTransferNoAck, 0);
 }
 
-comhdlc *comhdlc_get_instance()
+void comhdlc::transfer_resume_answered(const quint8 *data, TF_LEN len)
 {
-    return comhdlc::comhdlc_ptr;
+    if (!resume_pending)
+    {
+        return;
+    }
+
+    resume_pending = false;
+
+    if ((data == nullptr) || (len < 2 * sizeof(quint32)))
+    {
+        qDebug() << "[INFO] Device cannot resume, starting over";
+        transfer_start();
+        return;
+    }
+
+    const quint32 file_size     = file_send->size();
+    const quint32 device_offset = qFromLittleEndian<quint32>(data);
+    const quint32 device_crc    = qFromLittleEndian<quint32>(data + sizeof(quint32));
+
+    if ((device_offset == 0) || (device_offset > file_size)
+            || ((device_offset % file_chunk_size != 0) && (device_offset != file_size)))
+    {
+        qDebug() << "[INFO] Device has nothing to resume at " << device_offset << ", starting over";
+        transfer_start();
+        return;
+    }
+
+    // The checkpoint CRC covers the image up to its offset, only the rest is read
+    quint32 crc  = 0xFFFFFFFF;
+    quint32 from = 0;
+
+    if (device_offset >= checkpoint->offset())
+    {
+        crc  = ~checkpoint->crc();
+        from = checkpoint->offset();
+    }
+
+    if (!image_crc(crc, from, device_offset) || (~crc != device_crc))
+    {
+        qDebug() << "[WARNING] Device holds a different image up to " << device_offset << ", starting over";
+        transfer_start();
+        return;
+    }
+
+    file_chunks_committed = (device_offset == file_size) ? file_chunks_count : device_offset / file_chunk_size;
+    file_chunk_current    = file_chunks_committed;
+    file_chunks_acked     = file_chunks_committed;
+    file_crc              = crc;
+    digest_crc            = crc;
+    digest_chunk_next     = file_chunks_committed;
+
+    checkpoint_save();
+
+    qDebug() << "[INFO] Transfer resumed at " << device_offset << " bytes";
+    emit transfer_resumed(device_offset);
+
+    transfer_pump();
 }
 
-//
-// TF callbacks
-//
+/**
+ * Continues a CRC32 register over the image range [from, to)
+ */
+bool comhdlc::image_crc(quint32 &crc, quint32 from, quint32 to)
+{
+    const quint32 step_max = 32 * 1024;
 
-static TF_Result tf_write_file_size_clbk(TinyFrame *tf, TF_Msg *msg)
-{   
-    if (msg->type == eCmdWriteFileSize)
+    while (from < to)
     {
-        if (comhdlc_get_instance())
+        const quint32 step = (to - from < step_max) ? to - from : step_max;
+        const file_chunk_view view = file_send->read(from, static_cast<quint16>(step));
+
+        if (view.data == nullptr)
         {
-            comhdlc_get_instance()->transfer_file_chunk();
+            return false;
         }
 
-        return TF_CLOSE;
+        crc   = checksum_crc32(crc, view.data, view.size);
+        from += view.size;
     }
 
-    return TF_NEXT;
+    return true;
 }
 
-static TF_Result tf_write_file_clbk(TinyFrame *tf, TF_Msg *msg)
+void comhdlc::transfer_commit(quint32 chunk)
 {
-    Q_UNUSED(tf);
-    Q_ASSERT(msg != nullptr);
+    chunks_acked_ahead.insert(chunk);
 
-    if (msg->type == eCmdWriteFile)
+    while (chunks_acked_ahead.remove(file_chunks_committed))
     {
-        if (comhdlc_get_instance())
+        // The digest got there when the chunk was sent, the image is not read again
+        if (chunks_digest.contains(file_chunks_committed))
+        {
+            file_crc = chunks_digest.take(file_chunks_committed);
+        }
+        else
         {
-            comhdlc_get_instance()->transfer_file_chunk();
+            const quint32 offset = file_chunks_committed * file_chunk_size;
+            image_crc(file_crc, offset, offset + file_chunk_length(file_chunks_committed));
         }
 
-        qDebug() << "[INFO] File write callback TinyFrame";
+        ++file_chunks_committed;
 
-        return TF_STAY;
+        if (file_chunks_committed % checkpoint_interval_chunks == 0)
+        {
+            checkpoint_save();
+        }
     }
+}
 
-    return TF_NEXT;
+/**
+ * Continues the image CRC32 with a chunk that is read for the first time.
+ * Chunks come in order, resends and chunks that were already encoded are skipped.
+ */
+void comhdlc::transfer_digest(quint32 chunk, const file_chunk_view &view)
+{
+    if (chunk != digest_chunk_next)
+    {
+        return;
+    }
+
+    digest_crc = checksum_crc32(digest_crc, view.data, view.size);
+    chunks_digest.insert(chunk, digest_crc);
+
+    ++digest_chunk_next;
 }
 
-static TF_Result tf_handshake_clbk(TinyFrame *tf, TF_Msg *msg)
+/**
+ * Every chunk is acknowledged, the device gets the size and the CRC32 of the
+ * whole image to check what it has written
+ */
+void comhdlc::transfer_finish()
 {
-    Q_UNUSED(tf);
-    Q_ASSERT(msg != nullptr);
+    const quint32 crc = ~file_crc;
 
-    if (msg->type == eComHdlcAnswer_HandShake)
+    quint8 raw[2 * sizeof(quint32)];
+    qToLittleEndian<quint32>(file_send->size(), raw);
+    qToLittleEndian<quint32>(crc,               raw + 4);
+
+    qDebug() << "[INFO] Image sent, CRC32 " << QString::number(crc, 16);
+
+    finish_pending = true;
+
+    if (!link_query(eCmdWriteFileFinish, raw, sizeof(raw), tf_write_file_finish_clbk, finish_timeout_ticks, 0))
+    {
+        transfer_finish_answered(nullptr, 0);
+    }
+}
+
+void comhdlc::transfer_finish_answered(const quint8 *data, TF_LEN len)
+{
+    if (!finish_pending)
+    {
+        return;
+    }
+
+    const quint32 crc = ~file_crc;
+    eComHdlcTransferResult result = eTransferOk;
+
+    finish_pending = false;
+
+    if (data == nullptr)
+    {
+        // Everything is committed, resuming sends the finish frame again
+        result = eTransferFinishTimeout;
+        checkpoint_save();
+    }
+    else
     {
-        if (comhdlc_get_instance())
+        const quint8 status = (len > 0) ? data[0] : static_cast<quint8>(eFinishOk);
+
+        if (status == eFinishOk)
+        {
+            result = eTransferOk;
+        }
+        else if (status == eFinishDigestMismatch)
+        {
+            result = eTransferDigestMismatch;
+        }
+        else
         {
-            comhdlc_get_instance()->handshake_routine_stop();
-            emit comhdlc_get_instance()->device_connected(true);
+            result = eTransferDeviceError;
         }
 
-       return TF_CLOSE;
+        // Nothing is left to resume
+        if (checkpoint)
+        {
+            checkpoint->remove();
+        }
     }
 
-    return TF_NEXT;
+    if (checkpoint)
+    {
+        delete checkpoint;
+        checkpoint = nullptr;
+    }
+
+    emit file_transfer_finished(result, crc);
 }
 
-extern "C" void TF_WriteImpl(TinyFrame *tf, const uint8_t *buff, uint32_t len);
+void comhdlc::checkpoint_save()
+{
+    if (checkpoint == nullptr)
+    {
+        return;
+    }
 
-void TF_WriteImpl(TinyFrame *tf, const uint8_t *buff, uint32_t len)
+    const quint32 offset = file_chunks_committed * file_chunk_size;
+
+    checkpoint->set_progress((offset < file_send->size()) ? offset : file_send->size(), ~file_crc);
+    checkpoint->save();
+}
+
+void comhdlc::transfer_pump()
 {
-    Q_UNUSED(tf);
-    Q_ASSERT(buff != nullptr);
+    if (finish_pending)
+    {
+        return;
+    }
+
+    transfer_active = true;
+
+    if (baud_state == baud_fallback)
+    {
+        // The window drains before the rate is lowered, link_up() resumes the transfer
+        if ((baud_target < 0) && chunks_in_flight.isEmpty())
+        {
+            baud_switch(baud_index - 1);
+        }
+        return;
+    }
 
-    if (comhdlc_get_instance())
+    while (chunks_in_flight.size() < transfer_window)
     {
-        comhdlc_get_instance()->comport_send_buff(buff, len);
+        // Timed out chunks go first, the commit point and the checkpoint wait for them
+        if (!chunks_resend.isEmpty())
+        {
+            if (!transfer_send_chunk(chunks_resend.first()))
+            {
+                break;
+            }
+
+            chunks_resend.removeFirst();
+        }
+        else if (file_chunk_current < file_chunks_count)
+        {
+            if (!transfer_send_chunk(file_chunk_current))
+            {
+                break;
+            }
+
+            ++file_chunk_current;
+        }
+        else
+        {
+            break;
+        }
     }
+
+    // The file was transferred
+    if (file_chunks_acked >= file_chunks_count)
+    {
+        transfer_active = false;
+        emit rx_ceiling_measured(rx_throughput_ceiling());
+
+        if (transfer_compressed && (compress_wire_bytes > 0))
+        {
+            // The link is the bottleneck, so the speedup is the ratio of bytes on the wire
+            const double frames  = static_cast<double>(file_chunks_count) * tf_frame_overhead;
+            const double ratio   = static_cast<double>(compress_raw_bytes) / static_cast<double>(compress_wire_bytes);
+            const double speedup = (static_cast<double>(compress_raw_bytes) + frames)
+                    / (static_cast<double>(compress_wire_bytes) + frames);
+
+            emit compression_measured(ratio, speedup);
+        }
+
+        if (rtt_samples > 0)
+        {
+            emit chunk_rtt_measured(static_cast<quint64>(rtt_min_ns / 1000),
+                                    static_cast<quint64>(rtt_sum_ns / static_cast<qint64>(rtt_samples) / 1000),
+                                    static_cast<quint64>(rtt_max_ns / 1000));
+        }
+
+        transfer_finish();
+    }
+}
+
+file_chunk_view comhdlc::file_chunk_at(quint32 chunk)
+{
+    Q_ASSERT(file_send != nullptr);
+    Q_ASSERT(chunk < file_chunks_count);
+
+    return file_send->read(chunk * file_chunk_size, file_chunk_length(chunk));
+}
+
+quint16 comhdlc::file_chunk_length(quint32 chunk) const
+{
+    Q_ASSERT(file_send != nullptr);
+
+    const quint32 remain = file_send->size() - chunk * file_chunk_size;
+
+    return static_cast<quint16>(qMin<quint32>(remain, file_chunk_size));
+}
+
+bool comhdlc::transfer_send_chunk(quint32 chunk)
+{
+    TF_Msg msg;
+    TF_ClearMsg(&msg);
+
+    const uint8_t *body = nullptr;
+    TF_LEN body_len     = 0;
+
+    if (transfer_compressed)
+    {
+        // Normally compress_ahead() got here first
+        if (!chunks_encoded.contains(chunk) && !compress_chunk(chunk))
+        {
+            qDebug() << "[ERROR] Chunk " << chunk << " cannot be read from " << file_send->file_name();
+            transfer_abort();
+            emit file_transfer_finished(eTransferReadError, 0);
+            return false;
+        }
+
+        const QByteArray &encoded = chunks_encoded[chunk];
+
+        msg.type = eCmdWriteFileCompressed;
+        body     = reinterpret_cast<const uint8_t*>(encoded.constData());
+        body_len = static_cast<TF_LEN>(encoded.size());
+    }
+    else
+    {
+        const file_chunk_view view = file_chunk_at(chunk);
+
+        if (view.data == nullptr)
+        {
+            qDebug() << "[ERROR] Chunk " << chunk << " cannot be read from " << file_send->file_name();
+            transfer_abort();
+            emit file_transfer_finished(eTransferReadError, 0);
+            return false;
+        }
+
+        transfer_digest(chunk, view);
+
+        msg.type = eCmdWriteFile;
+        body     = view.data;
+        body_len = static_cast<TF_LEN>(view.size);
+    }
+
+    // Resends and chunks behind a lost one arrive out of order, the offset puts them in place
+    quint8 offset[sizeof(quint32)];
+    qToLittleEndian<quint32>(chunk * file_chunk_size, offset);
+
+    msg.len       = static_cast<TF_LEN>(sizeof(offset) + body_len);
+    msg.userdata  = this;
+    msg.userdata2 = reinterpret_cast<void*>(static_cast<quintptr>(chunk));
+
+    if (!TF_Query_Multipart(tiny_frame, &msg, tf_write_file_clbk, transfer_chunk_timeout_ticks))
+    {
+        return false;
+    }
+
+    TF_Multipart_Payload(tiny_frame, offset, sizeof(offset));
+    TF_Multipart_Payload(tiny_frame, body, body_len);
+    TF_Multipart_Close(tiny_frame);
+
+    chunks_in_flight.insert(chunk, msg.frame_id);
+
+    // Some callers run with the deadline timer disarmed, e.g. link_up() after a rate switch
+    tf_schedule();
+
+    if (!chunks_retries.contains(chunk))
+    {
+        chunks_sent_ns.insert(chunk, rtt_clock.nsecsElapsed());
+    }
+
+    compress_schedule();
+
+    return true;
+}
+
+/**
+ * Encodes a chunk for eCmdWriteFileCompressed. Chunks that do not shrink
+ * are stored, so the payload is at most one byte longer than the chunk.
+ */
+bool comhdlc::compress_chunk(quint32 chunk)
+{
+    const file_chunk_view view = file_chunk_at(chunk);
+
+    if (view.data == nullptr)
+    {
+        return false;
+    }
+
+    transfer_digest(chunk, view);
+
+    QByteArray encoded;
+    encoded.resize(static_cast<int>(1 + LZ_BLOCK_BOUND(view.size)));
+
+    const size_t packed = lz_block_compress(view.data,
+                                            view.size,
+                                            reinterpret_cast<uint8_t*>(encoded.data()) + 1,
+                                            static_cast<size_t>(encoded.size() - 1));
+
+    if ((packed > 0) && (packed < view.size))
+    {
+        encoded[0] = static_cast<char>(eChunkLz);
+        encoded.resize(static_cast<int>(1 + packed));
+    }
+    else
+    {
+        encoded[0] = static_cast<char>(eChunkStored);
+        std::memcpy(encoded.data() + 1, view.data, view.size);
+        encoded.resize(1 + view.size);
+    }
+
+    compress_raw_bytes  += view.size;
+    compress_wire_bytes += static_cast<quint64>(encoded.size());
+
+    chunks_encoded.insert(chunk, encoded);
+
+    return true;
+}
+
+void comhdlc::compress_schedule()
+{
+    if (!transfer_compressed || compress_scheduled)
+    {
+        return;
+    }
+
+    // Runs from the event loop, so pending ACKs are always handled first
+    compress_scheduled = true;
+    QTimer::singleShot(0, this, &comhdlc::compress_ahead);
+}
+
+/**
+ * Keeps up to compress_ahead_chunks encoded chunks ready in front of the sender,
+ * a few at a time so the event loop is never held for long.
+ */
+void comhdlc::compress_ahead()
+{
+    compress_scheduled = false;
+
+    if (!transfer_compressed || (file_send == nullptr))
+    {
+        return;
+    }
+
+    const quint32 ahead = file_chunk_current + compress_ahead_chunks;
+    const quint32 limit = (ahead < file_chunks_count) ? ahead : file_chunks_count;
+
+    if (compress_next < file_chunk_current)
+    {
+        compress_next = file_chunk_current;
+    }
+
+    for (quint32 n = 0; (n < compress_batch_chunks) && (compress_next < limit); ++n, ++compress_next)
+    {
+        // A read error is reported by the sender when it gets to the chunk
+        if (!chunks_encoded.contains(compress_next) && !compress_chunk(compress_next))
+        {
+            return;
+        }
+    }
+
+    if (compress_next < limit)
+    {
+        compress_schedule();
+    }
+}
+
+void comhdlc::transfer_chunk_ack(quint32 chunk)
+{
+    if (!transfer_active || !chunks_in_flight.remove(chunk))
+    {
+        return;
+    }
+
+    if (chunks_sent_ns.contains(chunk))
+    {
+        const qint64 rtt_ns = rtt_clock.nsecsElapsed() - chunks_sent_ns.take(chunk);
+
+        rtt_min_ns  = (rtt_samples == 0) ? rtt_ns : qMin(rtt_min_ns, rtt_ns);
+        rtt_max_ns  = qMax(rtt_max_ns, rtt_ns);
+        rtt_sum_ns += rtt_ns;
+        ++rtt_samples;
+    }
+
+    ++file_chunks_acked;
+    chunks_retries.remove(chunk);
+    chunks_encoded.remove(chunk);
+    transfer_commit(chunk);
+    link_account(false);
+
+    emit file_chunk_transferred(file_chunk_length(chunk));
+
+    transfer_pump();
+}
+
+void comhdlc::transfer_chunk_timeout(quint32 chunk)
+{
+    if (!transfer_active || !chunks_in_flight.remove(chunk))
+    {
+        return;
+    }
+
+    chunks_sent_ns.remove(chunk);
+
+    const quint8 retries = chunks_retries.value(chunk, 0) + 1;
+
+    if (retries > transfer_retries_max)
+    {
+        qDebug() << "[ERROR] Chunk " << chunk << " was not acknowledged after " << retries - 1 << " retries";
+        transfer_abort();
+        emit file_transfer_finished(eTransferNoAck, 0);
+        return;
+    }
+
+    qDebug() << "[WARNING] Chunk " << chunk << " timed out, resending";
+
+    link_account(true);
+
+    chunks_retries.insert(chunk, retries);
+    chunks_resend.append(chunk);
+
+    transfer_pump();
+}
+
+void comhdlc::transfer_abort()
+{
+    // Listener callbacks below see an inactive transfer and do nothing
+    transfer_active = false;
+
+    for (const TF_ID id : chunks_in_flight)
+    {
+        TF_RemoveIdListener(tiny_frame, id);
+    }
+
+    chunks_in_flight.clear();
+    chunks_retries.clear();
+    chunks_sent_ns.clear();
+    chunks_resend.clear();
+    chunks_encoded.clear();
+    chunks_acked_ahead.clear();
+    chunks_digest.clear();
+
+    // The progress survives the engine, the next transfer of the image resumes from it.
+    // While the device is asked to resume nothing is known yet and the checkpoint is kept
+    if (checkpoint)
+    {
+        if (!resume_pending)
+        {
+            checkpoint_save();
+        }
+
+        delete checkpoint;
+        checkpoint = nullptr;
+    }
+
+    size_pending   = false;
+    resume_pending = false;
+    finish_pending = false;
+}
+
+bool comhdlc::link_query(TF_TYPE type, const quint8 *data, TF_LEN len, TF_Listener listener, TF_TICKS timeout, quintptr tag)
+{
+    TF_Msg msg;
+    TF_ClearMsg(&msg);
+    msg.type      = type;
+    msg.data      = data;
+    msg.len       = len;
+    msg.userdata  = this;
+    msg.userdata2 = reinterpret_cast<void*>(tag);
+
+    const bool sent = TF_Query(tiny_frame, &msg, listener, timeout);
+
+    tf_schedule();
+
+    return sent;
+}
+
+void comhdlc::link_negotiate()
+{
+    const int count = static_cast<int>(std::end(baud_rate_candidates) - std::begin(baud_rate_candidates));
+    quint8 raw[sizeof(baud_rate_candidates)];
+
+    for (int i = 0; i < count; ++i)
+    {
+        qToLittleEndian<quint32>(baud_rate_candidates[i], raw + i * sizeof(quint32));
+    }
+
+    baud_state = baud_negotiate;
+
+    if (!link_query(eCmdBaudRateList, raw, sizeof(raw), tf_baud_list_clbk, baud_query_timeout_ticks, 0))
+    {
+        link_up();
+    }
+}
+
+void comhdlc::baud_list_received(const quint8 *data, TF_LEN len)
+{
+    if (baud_state != baud_negotiate)
+    {
+        return;
+    }
+
+    baud_rates.clear();
+    baud_rates.append(baud_rate_base);
+    baud_index = 0;
+
+    // No answer means the device does not negotiate and the base rate is kept
+    if (data != nullptr)
+    {
+        for (TF_LEN i = 0; i + sizeof(quint32) <= len; i += sizeof(quint32))
+        {
+            const quint32 rate = qFromLittleEndian<quint32>(data + i);
+
+            // Only rates the host offered are taken
+            if ((std::find(std::begin(baud_rate_candidates), std::end(baud_rate_candidates), rate) != std::end(baud_rate_candidates))
+                    && !baud_rates.contains(rate))
+            {
+                baud_rates.append(rate);
+            }
+        }
+
+        std::sort(baud_rates.begin() + 1, baud_rates.end());
+    }
+
+    qDebug() << "[INFO] Common link rates: " << baud_rates;
+
+    if (baud_rates.size() > 1)
+    {
+        // From the fastest rate down, baud_switch_done() moves on to the next one
+        baud_switch(baud_rates.size() - 1);
+    }
+    else
+    {
+        link_up();
+    }
+}
+
+void comhdlc::baud_switch(int index)
+{
+    Q_ASSERT((index >= 0) && (index < baud_rates.size()));
+
+    baud_target = index;
+    baud_probes = 0;
+
+    quint8 raw[sizeof(quint32)];
+    qToLittleEndian<quint32>(baud_rates.at(index), raw);
+
+    qDebug() << "[INFO] Switching the link from " << baud_rates.at(baud_index) << " to " << baud_rates.at(index) << " baud";
+
+    if (!link_query(eCmdBaudRateSwitch, raw, sizeof(raw), tf_baud_switch_clbk, baud_query_timeout_ticks, 0))
+    {
+        baud_switch_done(false);
+    }
+}
+
+void comhdlc::baud_switch_acked(bool acked)
+{
+    if (baud_target < 0)
+    {
+        return;
+    }
+
+    if (!acked)
+    {
+        qDebug() << "[WARNING] Switch to " << baud_rates.at(baud_target) << " baud was not acknowledged";
+        baud_switch_done(false);
+        return;
+    }
+
+    // The device changes its rate once the acknowledgement is out, so does the host
+    serial_port->flush();
+    baud_switch_timer.start();
+
+    if (!serial_port->setBaudRate(static_cast<qint32>(baud_rates.at(baud_target))))
+    {
+        qDebug() << "[ERROR] " << com_port_name << " does not support " << baud_rates.at(baud_target) << " baud";
+        baud_revert();
+        return;
+    }
+
+    serial_port->clear(QSerialPort::Input);
+    TF_ResetParser(tiny_frame);
+
+    baud_send_probe();
+}
+
+void comhdlc::baud_send_probe()
+{
+    ++baud_probes;
+
+    if (!link_query(eCmdBaudRateProbe,
+                    reinterpret_cast<const quint8*>(baud_probe_payload.constData()),
+                    baud_probe_size,
+                    tf_baud_probe_clbk,
+                    baud_probe_timeout_ticks,
+                    probe_tag_confirm))
+    {
+        baud_revert();
+    }
+}
+
+void comhdlc::baud_probe_answered(const quint8 *data, TF_LEN len)
+{
+    if (baud_target < 0)
+    {
+        return;
+    }
+
+    const bool echoed = (data != nullptr)
+            && (len == baud_probe_size)
+            && (std::memcmp(data, baud_probe_payload.constData(), baud_probe_size) == 0);
+
+    if (echoed)
+    {
+        baud_index = baud_target;
+
+        qDebug() << "[INFO] Link runs at " << baud_rates.at(baud_index) << " baud";
+        emit baud_rate_changed(baud_rates.at(baud_index));
+
+        baud_switch_done(true);
+    }
+    else if (baud_probes < baud_probe_attempts)
+    {
+        // A lost echo does not mean the device went back, it is still inside its revert window
+        baud_send_probe();
+    }
+    else
+    {
+        baud_revert();
+    }
+}
+
+void comhdlc::baud_revert()
+{
+    qDebug() << "[WARNING] Probe at " << baud_rates.at(baud_target) << " baud was not echoed, going back to "
+             << baud_rates.at(baud_index) << " baud";
+
+    serial_port->setBaudRate(static_cast<qint32>(baud_rates.at(baud_index)));
+    serial_port->clear(QSerialPort::Input);
+    TF_ResetParser(tiny_frame);
+
+    // Nothing is sent at the old rate before the device has given up on the new one
+    const qint64 wait_ms = baud_revert_ms + baud_revert_margin_ms - baud_switch_timer.elapsed();
+
+    QTimer::singleShot(wait_ms > 0 ? static_cast<int>(wait_ms) : 0, this, [this]()
+    {
+        baud_switch_done(false);
+    });
+}
+
+void comhdlc::baud_switch_done(bool switched)
+{
+    const int target = baud_target;
+
+    baud_target      = -1;
+    link_chunks_sent = 0;
+    link_chunks_lost = 0;
+
+    if (baud_state == baud_benchmark)
+    {
+        if (switched)
+        {
+            benchmark_measure();
+        }
+        else
+        {
+            emit baud_benchmark_result(baud_rates.at(target), 0);
+            ++benchmark_index;
+            benchmark_next();
+        }
+        return;
+    }
+
+    // Negotiation and fallback go on with the next slower rate
+    const int next = target - 1;
+
+    if (!switched && (next >= 0) && (next != baud_index))
+    {
+        baud_switch(next);
+        return;
+    }
+
+    link_up();
+}
+
+/**
+ * Counts chunk results at the current rate. If too many of them were lost the
+ * link falls back one rate once the chunks in flight are settled.
+ */
+void comhdlc::link_account(bool lost)
+{
+    ++link_chunks_sent;
+
+    if (lost)
+    {
+        ++link_chunks_lost;
+    }
+
+    if (link_chunks_sent < link_loss_window)
+    {
+        return;
+    }
+
+    const bool lossy = link_chunks_lost * 100 > link_chunks_sent * link_loss_percent_max;
+
+    if (lossy && (baud_index > 0) && (baud_state == baud_idle))
+    {
+        qDebug() << "[WARNING] " << link_chunks_lost << " of " << link_chunks_sent << " chunks lost at "
+                 << baud_rates.at(baud_index) << " baud, falling back";
+        baud_state = baud_fallback;
+    }
+
+    link_chunks_sent = 0;
+    link_chunks_lost = 0;
+}
+
+void comhdlc::link_up()
+{
+    // A rate switch still settling when the port was lost
+    if (!serial_port->isOpen())
+    {
+        return;
+    }
+
+    baud_state = baud_idle;
+
+    if (!link_ready)
+    {
+        link_ready = true;
+        emit device_connected(true);
+    }
+
+    if (!transfer_pending.isEmpty())
+    {
+        const QString file_name = transfer_pending;
+        transfer_pending.clear();
+        transfer_file(file_name);
+    }
+    else if (transfer_active)
+    {
+        transfer_pump();
+    }
+}
+
+/**
+ * Measures the payload throughput at every common rate, then settles on the
+ * fastest one. Results are reported with baud_benchmark_result().
+ */
+void comhdlc::benchmark_baud_rates()
+{
+    if (!link_ready || (baud_state != baud_idle) || transfer_active)
+    {
+        qDebug() << "[ERROR] Benchmark needs an idle link";
+        emit baud_benchmark_finished(baud_rates.at(baud_index));
+        return;
+    }
+
+    baud_state           = baud_benchmark;
+    benchmark_index      = 0;
+    benchmark_best_index = baud_index;
+    benchmark_best_rate  = 0;
+
+    benchmark_next();
+}
+
+void comhdlc::benchmark_next()
+{
+    if (benchmark_index >= baud_rates.size())
+    {
+        emit baud_benchmark_finished(baud_rates.at(benchmark_best_index));
+
+        baud_state = baud_negotiate;
+
+        if (benchmark_best_index != baud_index)
+        {
+            baud_switch(benchmark_best_index);
+        }
+        else
+        {
+            link_up();
+        }
+        return;
+    }
+
+    if (benchmark_index == baud_index)
+    {
+        benchmark_measure();
+    }
+    else
+    {
+        baud_switch(benchmark_index);
+    }
+}
+
+void comhdlc::benchmark_measure()
+{
+    benchmark_bytes     = 0;
+    benchmark_in_flight = 0;
+    benchmark_timer.start();
+
+    // Probes are pipelined like file chunks, so the result compares with a transfer
+    while (benchmark_in_flight < transfer_window)
+    {
+        const quint32 in_flight = benchmark_in_flight;
+
+        benchmark_send_probe();
+
+        if (benchmark_in_flight == in_flight)
+        {
+            break;
+        }
+    }
+
+    if (benchmark_in_flight == 0)
+    {
+        benchmark_probe_answered(0);
+    }
+}
+
+void comhdlc::benchmark_send_probe()
+{
+    if (link_query(eCmdBaudRateProbe,
+                   reinterpret_cast<const quint8*>(baud_probe_payload.constData()),
+                   static_cast<TF_LEN>(baud_probe_payload.size()),
+                   tf_baud_probe_clbk,
+                   transfer_chunk_timeout_ticks,
+                   probe_tag_benchmark))
+    {
+        ++benchmark_in_flight;
+    }
+}
+
+void comhdlc::benchmark_probe_answered(TF_LEN len)
+{
+    if ((baud_state != baud_benchmark) || (baud_target >= 0))
+    {
+        return;
+    }
+
+    if (benchmark_in_flight > 0)
+    {
+        --benchmark_in_flight;
+    }
+
+    benchmark_bytes += len;
+
+    const qint64 elapsed_ms = benchmark_timer.elapsed();
+
+    if (elapsed_ms < benchmark_duration_ms)
+    {
+        benchmark_send_probe();
+    }
+
+    if (benchmark_in_flight > 0)
+    {
+        return;
+    }
+
+    const quint64 bytes_per_second = (elapsed_ms > 0) ? benchmark_bytes * 1000 / static_cast<quint64>(elapsed_ms) : 0;
+    const quint32 baud             = baud_rates.at(benchmark_index);
+
+    qDebug() << "[INFO] " << baud << " baud: " << bytes_per_second << " bytes/s";
+    emit baud_benchmark_result(baud, bytes_per_second);
+
+    if (bytes_per_second > benchmark_best_rate)
+    {
+        benchmark_best_rate  = bytes_per_second;
+        benchmark_best_index = benchmark_index;
+    }
+
+    ++benchmark_index;
+    benchmark_next();
+}
+
+void comhdlc::comport_data_available()
+{
+    const qint64 bytes_available = serial_port->bytesAvailable();
+
+    if (bytes_available <= 0)
+    {
+        return;
+    }
+
+    QElapsedTimer process_timer;
+    process_timer.start();
+
+    if (rx_buffer.size() < bytes_available)
+    {
+        rx_buffer.resize(static_cast<int>(bytes_available));
+    }
+
+    // Drain everything in one call and let TinyFrame parse it as a block
+    const qint64 bytes_received = serial_port->read(rx_buffer.data(), bytes_available);
+
+    if (bytes_received > 0)
+    {
+        transport_receive(&link_transport,
+                          reinterpret_cast<const uint8_t*>(rx_buffer.constData()),
+                          static_cast<size_t>(bytes_received));
+
+        rx_bytes_total += static_cast<quint64>(bytes_received);
+    }
+
+    rx_process_ns += process_timer.nsecsElapsed();
+
+    tf_schedule();
+}
+
+/**
+ * Highest rate the receive path could sustain, in bytes per second.
+ * Measured as the received bytes over the time spent reading and parsing them.
+ */
+quint64 comhdlc::rx_throughput_ceiling() const
+{
+    if (rx_process_ns <= 0)
+    {
+        return 0;
+    }
+
+    return static_cast<quint64>(static_cast<double>(rx_bytes_total) * 1e9 / static_cast<double>(rx_process_ns));
+}
+
+void comhdlc::comport_error_handler(QSerialPort::SerialPortError serialPortError)
+{
+    if (serialPortError == QSerialPort::NoError)
+    {
+        return;
+    }
+
+    qDebug() << "[ERROR] Serial port " << com_port_name << " error occured " << serialPortError;
+
+    // An unplugged adapter or a hung up terminal, the port does not come back. A hangup
+    // reads as end of file, which is a ReadError. The port is closed from the event loop,
+    // it reports the error from inside its read notification
+    if ((serialPortError == QSerialPort::ResourceError)
+            || (serialPortError == QSerialPort::ReadError)
+            || (serialPortError == QSerialPort::WriteError))
+    {
+        QTimer::singleShot(0, this, &comhdlc::link_lost);
+    }
+}
+
+/**
+ * The port is closed and a running or requested transfer fails with
+ * eTransferPortError. Its checkpoint is kept, so the transfer resumes on a
+ * new engine. A connected device is reported as disconnected after that.
+ */
+void comhdlc::link_lost()
+{
+    if ((serial_port == nullptr) || !serial_port->isOpen())
+    {
+        return;
+    }
+
+    const bool transfer_running = (checkpoint != nullptr) || !transfer_pending.isEmpty();
+    const bool was_ready        = link_ready;
+
+    handshake_routine_stop();
+    transfer_abort();
+    transfer_pending.clear();
+
+    if (timer_tf)
+    {
+        timer_tf->stop();
+    }
+
+    serial_port->close();
+
+    link_ready = false;
+    baud_state = baud_idle;
+
+    qDebug() << "[ERROR] " << com_port_name << " is lost";
+
+    if (transfer_running)
+    {
+        emit file_transfer_finished(eTransferPortError, 0);
+    }
+
+    if (was_ready)
+    {
+        emit device_connected(false);
+    }
+}
+
+void comhdlc::comport_send_buff(const quint8 *data, quint16 data_len)
+{
+    Q_ASSERT(data);
+    Q_ASSERT(data_len > 0);
+
+    // Queries still retried after the port was lost go nowhere
+    if (serial_port && serial_port->isOpen())
+    {
+        serial_port->write((const char*)data, data_len);
+    }
+}
+
+void comhdlc::tf_write(const quint8 *data, quint32 len)
+{
+    transport_write(&link_transport, data, len);
+}
+
+void comhdlc::tf_frame_end()
+{
+    transport_frame_end(&link_transport);
+}
+
+/** Largest payload offered in the handshake, a whole frame has to fit the framing */
+quint16 comhdlc::frame_payload_limit() const
+{
+    return static_cast<quint16>(qMin<quint32>(frame_payload_max, transport_max_payload(&link_transport)));
+}
+
+void comhdlc::send_handshake()
+{
+    Q_ASSERT(timer_handshake != nullptr);
+
+    const quint16 payload_max = frame_payload_limit();
+    const quint8 raw[] = { 0xBE, 0xEF, static_cast<quint8>(payload_max & 0xFF), static_cast<quint8>(payload_max >> 8) };
+    TF_QuerySimple(tiny_frame,
+                   eComHdlcAnswer_HandShake,
+                   raw,
+                   sizeof (raw),
+                   tf_handshake_clbk,
+                   100
+                   );
+
+    tf_schedule();
+}
+
+void comhdlc::tf_handle_tick()
+{
+    Q_ASSERT(tiny_frame);
+    TF_Tick(tiny_frame);
+
+    tf_schedule();
+}
+
+/**
+ * Arms the TinyFrame timer for the earliest listener deadline, or stops it
+ * if nothing is waiting. There are no wakeups while the link is idle.
+ */
+void comhdlc::tf_schedule()
+{
+    TF_TIME deadline = 0;
+
+    if ((timer_tf == nullptr) || !TF_NextDeadline(tiny_frame, &deadline))
+    {
+        if (timer_tf)
+        {
+            timer_tf->stop();
+        }
+        return;
+    }
+
+    if (timer_tf->isActive() && (deadline == timer_tf_deadline))
+    {
+        return;
+    }
+
+    const qint32 remaining = static_cast<qint32>(deadline - TF_GetTime(tiny_frame));
+
+    timer_tf_deadline = deadline;
+    timer_tf->start(remaining > 0 ? remaining : 0);
+}
+
+//
+// TF callbacks
+//
+
+/** Engine that owns a TinyFrame instance */
+static comhdlc *tf_owner(TinyFrame *tf)
+{
+    return static_cast<comhdlc*>(tf->userdata);
+}
+
+static TF_Result tf_write_file_size_clbk(TinyFrame *tf, TF_Msg *msg)
+{
+    Q_UNUSED(tf);
+    Q_ASSERT(msg != nullptr);
+
+    comhdlc *hdlc = static_cast<comhdlc*>(msg->userdata);
+
+    if (hdlc == nullptr)
+    {
+        return TF_CLOSE;
+    }
+
+    if (msg->data == nullptr)
+    {
+        hdlc->transfer_size_answered(false);
+        return TF_CLOSE;
+    }
+
+    if (msg->type == eCmdWriteFileSize)
+    {
+        hdlc->transfer_size_answered(true);
+        return TF_CLOSE;
+    }
+
+    return TF_NEXT;
+}
+
+static TF_Result tf_write_file_resume_clbk(TinyFrame *tf, TF_Msg *msg)
+{
+    Q_UNUSED(tf);
+    Q_ASSERT(msg != nullptr);
+
+    comhdlc *hdlc = static_cast<comhdlc*>(msg->userdata);
+
+    if (hdlc == nullptr)
+    {
+        return TF_CLOSE;
+    }
+
+    // The listener has expired, the device does not know the command
+    if (msg->data == nullptr)
+    {
+        hdlc->transfer_resume_answered(nullptr, 0);
+        return TF_CLOSE;
+    }
+
+    if (msg->type == eCmdWriteFileResume)
+    {
+        hdlc->transfer_resume_answered(msg->data, msg->len);
+        return TF_CLOSE;
+    }
+
+    return TF_NEXT;
+}
+
+static TF_Result tf_write_file_finish_clbk(TinyFrame *tf, TF_Msg *msg)
+{
+    Q_UNUSED(tf);
+    Q_ASSERT(msg != nullptr);
+
+    comhdlc *hdlc = static_cast<comhdlc*>(msg->userdata);
+
+    if (hdlc == nullptr)
+    {
+        return TF_CLOSE;
+    }
+
+    if (msg->data == nullptr)
+    {
+        hdlc->transfer_finish_answered(nullptr, 0);
+        return TF_CLOSE;
+    }
+
+    if (msg->type == eCmdWriteFileFinish)
+    {
+        hdlc->transfer_finish_answered(msg->data, msg->len);
+        return TF_CLOSE;
+    }
+
+    return TF_NEXT;
+}
+
+static TF_Result tf_write_file_clbk(TinyFrame *tf, TF_Msg *msg)
+{
+    Q_UNUSED(tf);
+    Q_ASSERT(msg != nullptr);
+
+    comhdlc *hdlc       = static_cast<comhdlc*>(msg->userdata);
+    const quint32 chunk = static_cast<quint32>(reinterpret_cast<quintptr>(msg->userdata2));
+
+    if (hdlc == nullptr)
+    {
+        return TF_CLOSE;
+    }
+
+    // The listener has expired, the chunk was not acknowledged in time
+    if (msg->data == nullptr)
+    {
+        hdlc->transfer_chunk_timeout(chunk);
+        return TF_CLOSE;
+    }
+
+    // The device answers with the type of the chunk frame
+    if ((msg->type == eCmdWriteFile) || (msg->type == eCmdWriteFileCompressed))
+    {
+        hdlc->transfer_chunk_ack(chunk);
+        return TF_CLOSE;
+    }
+
+    return TF_NEXT;
+}
+
+static TF_Result tf_handshake_clbk(TinyFrame *tf, TF_Msg *msg)
+{
+    Q_ASSERT(msg != nullptr);
+
+    if (msg->type == eComHdlcAnswer_HandShake)
+    {
+        if (tf_owner(tf))
+        {
+            tf_owner(tf)->handshake_done(msg->data, msg->len);
+        }
+
+       return TF_CLOSE;
+    }
+
+    return TF_NEXT;
+}
+
+static TF_Result tf_baud_list_clbk(TinyFrame *tf, TF_Msg *msg)
+{
+    Q_UNUSED(tf);
+    Q_ASSERT(msg != nullptr);
+
+    comhdlc *hdlc = static_cast<comhdlc*>(msg->userdata);
+
+    if (hdlc == nullptr)
+    {
+        return TF_CLOSE;
+    }
+
+    // The listener has expired, the device does not know the command
+    if (msg->data == nullptr)
+    {
+        hdlc->baud_list_received(nullptr, 0);
+        return TF_CLOSE;
+    }
+
+    if (msg->type == eCmdBaudRateList)
+    {
+        hdlc->baud_list_received(msg->data, msg->len);
+        return TF_CLOSE;
+    }
+
+    return TF_NEXT;
+}
+
+static TF_Result tf_baud_switch_clbk(TinyFrame *tf, TF_Msg *msg)
+{
+    Q_UNUSED(tf);
+    Q_ASSERT(msg != nullptr);
+
+    comhdlc *hdlc = static_cast<comhdlc*>(msg->userdata);
+
+    if (hdlc == nullptr)
+    {
+        return TF_CLOSE;
+    }
+
+    if (msg->data == nullptr)
+    {
+        hdlc->baud_switch_acked(false);
+        return TF_CLOSE;
+    }
+
+    if (msg->type == eCmdBaudRateSwitch)
+    {
+        hdlc->baud_switch_acked(true);
+        return TF_CLOSE;
+    }
+
+    return TF_NEXT;
+}
+
+static TF_Result tf_baud_probe_clbk(TinyFrame *tf, TF_Msg *msg)
+{
+    Q_UNUSED(tf);
+    Q_ASSERT(msg != nullptr);
+
+    comhdlc *hdlc        = static_cast<comhdlc*>(msg->userdata);
+    const quintptr tag   = reinterpret_cast<quintptr>(msg->userdata2);
+
+    if (hdlc == nullptr)
+    {
+        return TF_CLOSE;
+    }
+
+    if ((msg->data != nullptr) && (msg->type != eCmdBaudRateProbe))
+    {
+        return TF_NEXT;
+    }
+
+    // A timed out probe is reported without data
+    if (tag == probe_tag_benchmark)
+    {
+        hdlc->benchmark_probe_answered(msg->data != nullptr ? msg->len : 0);
+    }
+    else
+    {
+        hdlc->baud_probe_answered(msg->data, msg->data != nullptr ? msg->len : 0);
+    }
+
+    return TF_CLOSE;
+}
+
+extern "C" void TF_WriteImpl(TinyFrame *tf, const uint8_t *buff, uint32_t len);
+extern "C" void TF_FrameEndImpl(TinyFrame *tf);
+extern "C" TF_TIME TF_GetTime(TinyFrame *tf);
+extern "C" void TF_ErrorImpl(const char *format, ...);
+
+void TF_WriteImpl(TinyFrame *tf, const uint8_t *buff, uint32_t len)
+{
+    Q_ASSERT(buff != nullptr);
+
+    if (tf_owner(tf))
+    {
+        tf_owner(tf)->tf_write(buff, len);
+    }
+}
+
+void TF_FrameEndImpl(TinyFrame *tf)
+{
+    if (tf_owner(tf))
+    {
+        tf_owner(tf)->tf_frame_end();
+    }
+}
+
+/** TinyFrame diagnostics go to the Qt log, stdout stays free for the CLI's JSON */
+void TF_ErrorImpl(const char *format, ...)
+{
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    qDebug() << "[WARNING] " << message;
+}
+
+static void comhdlc_transport_output(transport *t, const uint8_t *data, uint32_t length)
+{
+    static_cast<comhdlc*>(t->userdata)->comport_send_buff(data, static_cast<quint16>(length));
+}
+
+TF_TIME TF_GetTime(TinyFrame *tf)
+{
+    Q_UNUSED(tf);
+
+    // Monotonic milliseconds, shared by all instances
+    static const QElapsedTimer clock = []()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        return timer;
+    }();
+
+    return static_cast<TF_TIME>(clock.elapsed());
 }
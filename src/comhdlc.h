@@ -9,8 +9,16 @@
 #include <QSerialPort>
 #include <QObject>
 #include <QTimer>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QElapsedTimer>
 
 #include <tinyframe/TinyFrame.h>
+#include <transport/transport.h>
+
+#include "firmwaresource.h"
+#include "transfercheckpoint.h"
 
 enum eComHdlcFrameTypes
 {
@@ -22,50 +30,283 @@ enum eComHdlcFrameTypes
 
 enum eComHdlcCommands
 {
-    eCmdWriteFile            = 1,
+    eCmdWriteFile            = 1,  // Image offset of the chunk as LE32, then the chunk. The device writes it there
+                                   // and acknowledges a chunk it already has without writing it again
     eCmdWriteFileSize        = 2,
     eCmdWriteFileFinish      = 3,
     eComHdlcAnswer_HandShake = 4,
+    eCmdBaudRateList         = 5,  // Host sends its candidate rates, the device answers with the ones it supports
+    eCmdBaudRateSwitch       = 6,  // Device acknowledges at the current rate, then both sides switch
+    eCmdBaudRateProbe        = 7,  // Device echoes the payload, confirms a switch and drives the benchmark
+    eCmdWriteFileCompressed  = 8,  // Like eCmdWriteFile, the chunk starts with an eComHdlcChunkEncoding byte
+    eCmdWriteFileResume      = 9,  // Host sends size, offset and CRC32 from its checkpoint, the device answers
+                                   // with the offset and CRC32 of what it has committed and continues from there
 };
 
+/** Outcome of a file transfer */
+enum eComHdlcTransferResult
+{
+    eTransferOk = 0,
+    eTransferReadError,       // the image could not be read
+    eTransferNoAck,           // a chunk or the image size was not acknowledged after all retries
+    eTransferFinishTimeout,   // the device did not answer eCmdWriteFileFinish, the transfer can be resumed
+    eTransferDigestMismatch,  // the device got an image with another CRC32
+    eTransferDeviceError,     // the device rejected the image for another reason
+    eTransferNoDevice,        // the device did not answer the handshake in time, reported by comhdlc_fleet
+    eTransferPortError,       // the serial port could not be opened or was lost
+};
+Q_DECLARE_METATYPE(eComHdlcTransferResult)
+
+/** Status byte of the device answer to eCmdWriteFileFinish */
+enum eComHdlcFinishStatus
+{
+    eFinishOk             = 0,
+    eFinishDigestMismatch = 1,
+};
+
+/** Capability bits a device appends after 0xBE 0xEF in its handshake answer */
+enum eComHdlcCapabilities
+{
+    eComHdlcCap_CompressLz = 0x01,
+};
+
+/** First byte after the offset of an eCmdWriteFileCompressed payload */
+enum eComHdlcChunkEncoding
+{
+    eChunkStored = 0,  // the chunk follows as is
+    eChunkLz     = 1,  // an LZ4 block follows, it expands to the whole chunk
+};
+
+/**
+ * Transfer engine. It owns the serial port and the TinyFrame instance and is
+ * meant to be moved to a worker thread, the GUI talks to it through queued
+ * signals only.
+ *
+ * After the handshake the link rate is negotiated. Rates are little endian
+ * uint32 values. A switch is acknowledged at the old rate and confirmed with
+ * a probe echo at the new one. The device goes back to the old rate if no probe
+ * arrives within baud_revert_ms of its acknowledgement, the host does the same
+ * when the probe is not echoed.
+ *
+ * The handshake query is 0xBE 0xEF and the largest payload the host takes as a
+ * little endian uint16. The answer is 0xBE 0xEF, the capability bits and the
+ * largest payload of the device. Both sides size their buffers for the smaller
+ * of the two once the handshake is done.
+ *
+ * TinyFrame frames go on the wire as they are, or each inside an HDLC frame
+ * (see transport.h) when the device is set up for that. Over HDLC both sides
+ * keep their payloads within one minihdlc frame.
+ */
 class comhdlc : public QObject
 {
     Q_OBJECT
 public:
     comhdlc(QString comName);
     ~comhdlc();
-    void transfer_file(const QByteArray &file, QString file_name);
-    void transfer_file_chunk();
-    bool is_comport_connected(void) const;
+    void transfer_pump();
+    void transfer_chunk_ack(quint32 chunk);
+    void transfer_chunk_timeout(quint32 chunk);
+    void set_transfer_window(quint8 window);
     void handshake_routine_stop(void);
+    void handshake_done(const quint8 *data, TF_LEN len);
+    void baud_list_received(const quint8 *data, TF_LEN len);
+    void baud_switch_acked(bool acked);
+    void baud_probe_answered(const quint8 *data, TF_LEN len);
+    void benchmark_probe_answered(TF_LEN len);
+    void transfer_size_answered(bool answered);
+    void transfer_resume_answered(const quint8 *data, TF_LEN len);
+    void transfer_finish_answered(const quint8 *data, TF_LEN len);
     void comport_send_buff(const quint8 *data, quint16 data_len);
-    friend comhdlc *comhdlc_get_instance();
+    void tf_write(const quint8 *data, quint32 len);
+    void tf_frame_end(void);
+    quint64 rx_throughput_ceiling(void) const;
+
+public slots:
+    void start(void);
+    void transfer_file(const QString &file_name);
+    void benchmark_baud_rates(void);
+    void set_compression(bool enabled);
+    void set_framing(transport_framing wire_framing);
 
 private:
     QString com_port_name;
     QTimer *timer_handshake = nullptr;
     QTimer *timer_tf        = nullptr;
-    QByteArray file_send;
-    QByteArray send_buffer;
-    QByteArrayList file_chunks;
+    TF_TIME timer_tf_deadline = 0;
+    firmware_source *file_send = nullptr;
     QSerialPort *serial_port;
+    quint32 file_chunks_count  = 0;
     quint32 file_chunk_current = 0;
     TinyFrame *tiny_frame      = nullptr;
 
-    static comhdlc* comhdlc_ptr;
+    // Wire framing under TinyFrame, set up with the instance in start()
+    transport_framing framing = TRANSPORT_RAW;
+    transport link_transport;
+
+    // Receive path. The buffer only grows, so steady state reception does not allocate
+    QByteArray rx_buffer;
+    quint64 rx_bytes_total = 0;
+    qint64 rx_process_ns   = 0;
+
+    // Sliding window state. Every chunk in flight owns a TinyFrame ID listener
+    quint8 transfer_window       = 4;
+    bool transfer_active         = false;
+    quint32 file_chunks_acked    = 0;
+    QHash<quint32, TF_ID> chunks_in_flight;  // chunk index -> frame ID
+    QHash<quint32, quint8> chunks_retries;   // chunk index -> resend count
+    QList<quint32> chunks_resend;            // timed out chunks waiting for a free slot
+
+    // Half the master's 128 frame IDs, so an ID is not reused while its chunk may still be answered
+    static const quint8 transfer_window_max   = 64;
+    static const TF_COUNT transfer_id_listeners = transfer_window_max + 2;
+    static const quint8 transfer_retries_max  = 5;
+    static const TF_TICKS transfer_chunk_timeout_ticks = 2000;
+
+    // Frame size. Both sides offer their largest payload in the handshake, chunks
+    // fill the smaller one. Devices that offer nothing get the old fixed chunks
+    quint16 frame_payload   = TF_MAX_PAYLOAD_RX;
+    quint16 file_chunk_size = TF_SENDBUF_LEN;
+
+    static const quint16 frame_payload_max   = 8192;
+    static const quint16 file_chunk_align    = 256;  // chunks stay whole flash pages
+    static const quint16 file_chunk_header   = 5;    // image offset and the eComHdlcChunkEncoding byte of compressed chunks
+
+    // Resume state. A chunk is committed once it and every chunk before it are acknowledged,
+    // the checkpoint holds the committed offset and the CRC32 up to it
+    transfer_checkpoint *checkpoint = nullptr;
+    bool resume_pending             = false;
+    quint32 file_chunks_committed   = 0;
+    quint32 file_crc                = 0xFFFFFFFF;  // CRC32 register over the committed chunks
+    QSet<quint32> chunks_acked_ahead;
+
+    // Image digest. The CRC32 is continued when a chunk is first read for sending,
+    // the register after each chunk is kept until the chunk is committed
+    quint32 digest_crc        = 0xFFFFFFFF;
+    quint32 digest_chunk_next = 0;
+    QHash<quint32, quint32> chunks_digest;  // chunk index -> CRC32 register up to its end
+    bool finish_pending       = false;
+
+    // The device gets the image size before the first chunk
+    bool size_pending   = false;
+    quint8 size_retries = 0;
+
+    static const TF_TICKS size_timeout_ticks   = 10000;
+    static const TF_TICKS finish_timeout_ticks = 10000;
+
+    static const quint32 checkpoint_interval_chunks = 64;
+    static const TF_TICKS resume_timeout_ticks      = 2000;
+
+    // Compressed transfer. Chunks are encoded ahead of the sender while the
+    // engine waits for ACKs and kept until they are acknowledged
+    quint8 device_caps        = 0;
+    bool compression_enabled  = true;
+    bool transfer_compressed  = false;
+    bool compress_scheduled   = false;
+    quint32 compress_next     = 0;
+    quint64 compress_raw_bytes  = 0;
+    quint64 compress_wire_bytes = 0;
+    QHash<quint32, QByteArray> chunks_encoded;  // chunk index -> eCmdWriteFileCompressed payload after the offset
+
+    // Chunk round trip, from the first send to the ACK. Resent chunks are not
+    // sampled, their ACK cannot be matched to one of the sends
+    QElapsedTimer rtt_clock;
+    QHash<quint32, qint64> chunks_sent_ns;  // chunk index -> rtt_clock time of the send
+    quint64 rtt_samples = 0;
+    qint64 rtt_sum_ns   = 0;
+    qint64 rtt_min_ns   = 0;
+    qint64 rtt_max_ns   = 0;
+
+    static const quint32 compress_ahead_chunks = 64;
+    static const quint32 compress_batch_chunks = 8;
+
+    // Link rate. The first rate is always the base one, the rest are ascending
+    enum baud_mode
+    {
+        baud_idle,
+        baud_negotiate,  // after the handshake, from the fastest common rate down
+        baud_fallback,   // the loss ratio is too high, one rate down
+        baud_benchmark,  // every common rate in turn
+    };
+
+    baud_mode baud_state = baud_idle;
+    QList<quint32> baud_rates;
+    int baud_index      = 0;   // rate in use
+    int baud_target     = -1;  // rate being switched to, -1 when no switch is running
+    quint8 baud_probes  = 0;   // probes sent at the target rate
+    QElapsedTimer baud_switch_timer;
+    QByteArray baud_probe_payload;
+    bool link_ready      = false;
+    QString transfer_pending;  // file requested while the rate was changing
+    quint32 link_chunks_sent = 0;
+    quint32 link_chunks_lost = 0;
+
+    // Benchmark mode, payload bytes echoed at every rate
+    int benchmark_index          = 0;
+    int benchmark_best_index     = 0;
+    quint64 benchmark_best_rate  = 0;
+    quint32 benchmark_in_flight  = 0;
+    quint64 benchmark_bytes      = 0;
+    QElapsedTimer benchmark_timer;
+
+    static const quint32 baud_rate_base          = 38400;
+    static const TF_TICKS baud_query_timeout_ticks = 500;
+    static const TF_TICKS baud_probe_timeout_ticks = 200;
+    static const quint8 baud_probe_attempts       = 3;
+    static const qint64 baud_revert_ms            = 1000;  // device side, counted from its acknowledgement
+    static const qint64 baud_revert_margin_ms     = 50;
+    static const quint16 baud_probe_size          = 64;   // rate confirmation probe, benchmark probes are a chunk
+    static const quint32 link_loss_window         = 64;   // chunk results per loss check
+    static const quint32 link_loss_percent_max    = 10;
+    static const qint64 benchmark_duration_ms     = 2000;
 
     void send_handshake(void);
+    quint16 frame_payload_limit(void) const;
     void tf_handle_tick(void);
+    void tf_schedule(void);
+    file_chunk_view file_chunk_at(quint32 chunk);
+    quint16 file_chunk_length(quint32 chunk) const;
+    bool transfer_send_chunk(quint32 chunk);
+    void transfer_start(void);
+    void transfer_send_size(void);
+    void transfer_commit(quint32 chunk);
+    void transfer_digest(quint32 chunk, const file_chunk_view &view);
+    void transfer_finish(void);
+    bool image_crc(quint32 &crc, quint32 from, quint32 to);
+    void checkpoint_save(void);
+    bool compress_chunk(quint32 chunk);
+    void compress_schedule(void);
+    void compress_ahead(void);
+    void transfer_abort(void);
+    bool link_query(TF_TYPE type, const quint8 *data, TF_LEN len, TF_Listener listener, TF_TICKS timeout, quintptr tag);
+    void frame_negotiate(quint16 device_payload);
+    void link_negotiate(void);
+    void link_account(bool lost);
+    void link_up(void);
+    void link_lost(void);
+    void baud_switch(int index);
+    void baud_send_probe(void);
+    void baud_revert(void);
+    void baud_switch_done(bool switched);
+    void benchmark_next(void);
+    void benchmark_measure(void);
+    void benchmark_send_probe(void);
 
 private slots:
     void comport_data_available();
     void comport_error_handler(QSerialPort::SerialPortError serialPortError);
-    void comport_bytes_written(quint64 bytes);
 
 signals:
+    void comport_opened(bool opened);
     void device_connected(bool connected);
-    void file_was_transferred(bool transferred);
+    void file_transfer_finished(eComHdlcTransferResult result, quint32 crc32);
     void file_chunk_transferred(quint16 chunk_size);
+    void rx_ceiling_measured(quint64 bytes_per_second);
+    void compression_measured(double ratio, double speedup);
+    void chunk_rtt_measured(quint64 min_us, quint64 avg_us, quint64 max_us);
+    void transfer_resumed(quint32 offset);
+    void baud_rate_changed(quint32 baud);
+    void baud_benchmark_result(quint32 baud, quint64 bytes_per_second);
+    void baud_benchmark_finished(quint32 best_baud);
 };
 
 #endif // COMHDLC_H
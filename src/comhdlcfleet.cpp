@@ -0,0 +1,280 @@
+/**
+ * @file comhdlcfleet.cpp
+ */
+
+#include "comhdlcfleet.h"
+
+#include <QDebug>
+#include <QFileInfo>
+
+comhdlc_fleet::comhdlc_fleet(QObject *parent)
+    : QObject(parent)
+{
+}
+
+comhdlc_fleet::~comhdlc_fleet()
+{
+    for (fleet_port *port : ports)
+    {
+        // Every engine is deleted in its own thread once the event loop is left
+        port->thread->quit();
+        port->thread->wait();
+
+        delete port->thread;
+        delete port;
+    }
+
+    ports.clear();
+}
+
+/**
+ * Transfer settings for the ports added after the call
+ */
+void comhdlc_fleet::set_transfer_window(quint8 window)
+{
+    transfer_window = window;
+}
+
+void comhdlc_fleet::set_compression(bool enabled)
+{
+    compression = enabled;
+}
+
+void comhdlc_fleet::set_framing(transport_framing wire_framing)
+{
+    framing = wire_framing;
+}
+
+/**
+ * How long a flash waits for a device that is not connected. The port is
+ * then finished with eTransferNoDevice
+ */
+void comhdlc_fleet::set_connect_timeout(int timeout_ms)
+{
+    connect_timeout_ms = timeout_ms;
+}
+
+/**
+ * Adds a port and opens it. The handshake and the rate negotiation run
+ * right away, a flash started later only has to wait for slow devices.
+ */
+void comhdlc_fleet::add_port(const QString &port_name)
+{
+    fleet_port *port = new fleet_port;
+    port->name   = port_name;
+    port->thread = new QThread(this);
+    port->engine = new comhdlc(port_name);
+
+    port->connect_timer = new QTimer(this);
+    port->connect_timer->setSingleShot(true);
+    connect(port->connect_timer, &QTimer::timeout, this, [this, port]()
+    {
+        port_connect_timeout(port);
+    });
+
+    // Still safe to call directly, the engine thread is not running yet
+    if (transfer_window > 0)
+    {
+        port->engine->set_transfer_window(transfer_window);
+    }
+    port->engine->set_compression(compression);
+    port->engine->set_framing(framing);
+
+    port->engine->moveToThread(port->thread);
+
+    connect(port->thread, &QThread::started,  port->engine, &comhdlc::start);
+    connect(port->thread, &QThread::finished, port->engine, &QObject::deleteLater);
+    connect(this, &comhdlc_fleet::flash_requested, port->engine, &comhdlc::transfer_file);
+
+    // Engine signals carry no port, the lambdas add it. They run in this object's thread
+    connect(port->engine, &comhdlc::comport_opened, this, [this, port](bool opened)
+    {
+        port_open_result(port, opened);
+    });
+    connect(port->engine, &comhdlc::device_connected, this, [this, port](bool connected)
+    {
+        port_connected(port, connected);
+    });
+    connect(port->engine, &comhdlc::file_chunk_transferred, this, [this, port](quint16 chunk_size)
+    {
+        port_chunk_transferred(port, chunk_size);
+    });
+    connect(port->engine, &comhdlc::transfer_resumed, this, [this, port](quint32 offset)
+    {
+        port_resumed(port, offset);
+    });
+    connect(port->engine, &comhdlc::file_transfer_finished, this, [this, port](eComHdlcTransferResult result, quint32 crc32)
+    {
+        port_finished(port, result, crc32);
+    });
+
+    ports.append(port);
+
+    port->thread->start();
+}
+
+int comhdlc_fleet::port_count() const
+{
+    return ports.size();
+}
+
+/**
+ * Sends the image to every port. Engines that are still negotiating start
+ * the transfer as soon as their link is up.
+ */
+void comhdlc_fleet::flash(const QString &file_name)
+{
+    if (ports_running > 0)
+    {
+        qDebug() << "[ERROR] Fleet is already flashing";
+        return;
+    }
+
+    const QFileInfo file_info(file_name);
+
+    if (!file_info.isFile() || !file_info.isReadable())
+    {
+        qDebug() << "[ERROR] File " << file_name << " cannot be read";
+        emit fleet_finished(0, ports.size());
+        return;
+    }
+
+    image_size           = static_cast<quint32>(file_info.size());
+    bytes_sent           = 0;
+    ports_running        = ports.size();
+    ports_succeeded      = 0;
+    progress_reported_ms = 0;
+
+    for (fleet_port *port : ports)
+    {
+        port->finished   = false;
+        port->bytes_sent = 0;
+
+        if (!port->connected && !port->port_failed)
+        {
+            port->connect_timer->start(connect_timeout_ms);
+        }
+    }
+
+    flash_timer.start();
+
+    emit flash_requested(file_name);
+
+    // Ports that could not be opened or were lost fail right away, the others carry on
+    for (fleet_port *port : ports)
+    {
+        if (port->port_failed)
+        {
+            port_finished(port, eTransferPortError, 0);
+        }
+    }
+}
+
+void comhdlc_fleet::port_open_result(fleet_port *port, bool opened)
+{
+    emit port_opened(port->name, opened);
+
+    if (!opened)
+    {
+        port_finished(port, eTransferPortError, 0);
+    }
+}
+
+void comhdlc_fleet::port_connected(fleet_port *port, bool connected)
+{
+    port->connected = connected;
+
+    if (connected)
+    {
+        port->connect_timer->stop();
+    }
+
+    emit port_device_connected(port->name, connected);
+
+    // The engine only disconnects when it has lost its port
+    if (!connected)
+    {
+        port_finished(port, eTransferPortError, 0);
+    }
+}
+
+void comhdlc_fleet::port_connect_timeout(fleet_port *port)
+{
+    if (port->connected)
+    {
+        return;
+    }
+
+    qDebug() << "[WARNING] " << port->name << " did not connect in " << connect_timeout_ms << " ms";
+
+    // A late handshake may still start the transfer in the engine, its result is ignored
+    port_finished(port, eTransferNoDevice, 0);
+}
+
+void comhdlc_fleet::port_chunk_transferred(fleet_port *port, quint16 chunk_size)
+{
+    port->bytes_sent += chunk_size;
+    bytes_sent       += chunk_size;
+
+    emit port_progress(port->name, port->bytes_sent, image_size);
+    progress_report(false);
+}
+
+void comhdlc_fleet::port_resumed(fleet_port *port, quint32 offset)
+{
+    // Resumed bytes count as sent but not into the throughput
+    port->bytes_sent = offset;
+
+    emit port_progress(port->name, port->bytes_sent, image_size);
+}
+
+void comhdlc_fleet::port_finished(fleet_port *port, eComHdlcTransferResult result, quint32 crc32)
+{
+    // A lost port does not come back, a flash started later fails it right away
+    if (result == eTransferPortError)
+    {
+        port->port_failed = true;
+    }
+
+    if (port->finished || (ports_running == 0))
+    {
+        return;
+    }
+
+    port->finished = true;
+    port->connect_timer->stop();
+    --ports_running;
+
+    if (result == eTransferOk)
+    {
+        ++ports_succeeded;
+    }
+
+    emit port_transfer_finished(port->name, result, crc32);
+
+    if (ports_running == 0)
+    {
+        progress_report(true);
+        emit fleet_finished(ports_succeeded, ports.size() - ports_succeeded);
+    }
+}
+
+/**
+ * Sums up all ports. Chunk ACKs from dozens of ports arrive thousands of
+ * times a second, so the total is reported at most every progress_interval_ms.
+ */
+void comhdlc_fleet::progress_report(bool force)
+{
+    const qint64 elapsed_ms = flash_timer.elapsed();
+
+    if (!force && (elapsed_ms - progress_reported_ms < progress_interval_ms))
+    {
+        return;
+    }
+
+    progress_reported_ms = elapsed_ms;
+
+    const quint64 bytes_per_second = (elapsed_ms > 0) ? bytes_sent * 1000 / static_cast<quint64>(elapsed_ms) : 0;
+
+    emit fleet_progress(bytes_sent, static_cast<quint64>(image_size) * ports.size(), bytes_per_second);
+}
@@ -0,0 +1,87 @@
+/**
+ * @file comhdlcfleet.h
+ */
+
+#ifndef COMHDLCFLEET_H
+#define COMHDLCFLEET_H
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include "comhdlc.h"
+
+/**
+ * Flashes one image to many ports at once.
+ *
+ * Every port gets its own engine in its own thread, so a slow or stuck
+ * fixture never holds up the others. A port that cannot be opened or is
+ * lost and a device that does not connect in time fail on their own, so
+ * the flash always finishes. Results are reported per port and the progress of all
+ * ports is summed up.
+ */
+class comhdlc_fleet : public QObject
+{
+    Q_OBJECT
+public:
+    explicit comhdlc_fleet(QObject *parent = nullptr);
+    ~comhdlc_fleet();
+    void set_transfer_window(quint8 window);
+    void set_compression(bool enabled);
+    void set_framing(transport_framing wire_framing);
+    void set_connect_timeout(int timeout_ms);
+    void add_port(const QString &port_name);
+    int port_count(void) const;
+
+public slots:
+    void flash(const QString &file_name);
+
+private:
+    struct fleet_port
+    {
+        QString name;
+        comhdlc *engine      = nullptr;
+        QThread *thread      = nullptr;
+        QTimer *connect_timer = nullptr;
+        bool connected       = false;
+        bool port_failed     = false;
+        bool finished        = false;
+        quint32 bytes_sent   = 0;
+    };
+
+    QList<fleet_port*> ports;
+    quint8 transfer_window = 0;  // 0 keeps the engine default
+    bool compression       = true;
+    transport_framing framing = TRANSPORT_RAW;
+    int connect_timeout_ms = 10000;
+    quint32 image_size    = 0;
+    quint64 bytes_sent    = 0;
+    int ports_running     = 0;
+    int ports_succeeded   = 0;
+    QElapsedTimer flash_timer;
+    qint64 progress_reported_ms = 0;
+
+    static const qint64 progress_interval_ms = 100;
+
+    void port_open_result(fleet_port *port, bool opened);
+    void port_connected(fleet_port *port, bool connected);
+    void port_connect_timeout(fleet_port *port);
+    void port_chunk_transferred(fleet_port *port, quint16 chunk_size);
+    void port_resumed(fleet_port *port, quint32 offset);
+    void port_finished(fleet_port *port, eComHdlcTransferResult result, quint32 crc32);
+    void progress_report(bool force);
+
+signals:
+    void flash_requested(const QString &file_name);
+    void port_opened(const QString &port_name, bool opened);
+    void port_device_connected(const QString &port_name, bool connected);
+    void port_progress(const QString &port_name, quint32 bytes_sent, quint32 bytes_total);
+    void port_transfer_finished(const QString &port_name, eComHdlcTransferResult result, quint32 crc32);
+    void fleet_progress(quint64 bytes_sent, quint64 bytes_total, quint64 bytes_per_second);
+    void fleet_finished(int succeeded, int failed);
+};
+
+#endif // COMHDLCFLEET_H
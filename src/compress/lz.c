@@ -0,0 +1,246 @@
+/**
+ * @file lz.c
+ */
+
+#include "lz.h"
+
+#include <string.h>
+
+#define LZ_MIN_MATCH    4u
+#define LZ_LAST_LITERALS 5u   // the block always ends with this many literals
+#define LZ_MATCH_LIMIT  12u   // the last match starts at least this far from the end
+#define LZ_MAX_OFFSET   65535u
+#define LZ_HASH_BITS    12u
+
+static inline uint32_t load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32u - LZ_HASH_BITS);
+}
+
+/** Length field continuation, 255 per byte and the remainder */
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+    while (len >= 255u)
+    {
+        *op++ = 255u;
+        len -= 255u;
+    }
+
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+/** One sequence, the literals are followed by a match unless match_len is 0 */
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *oend,
+        const uint8_t *literals, size_t literal_len, size_t offset, size_t match_len)
+{
+    const size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+    const size_t need = 1 + literal_len / 255u + 1 + literal_len + (match_len ? 2 + match_code / 255u + 1 : 0);
+    uint8_t *token;
+
+    if (need > (size_t) (oend - op))
+    {
+        return NULL;
+    }
+
+    token = op++;
+    *token = (uint8_t) ((literal_len >= 15u ? 15u : literal_len) << 4);
+
+    if (literal_len >= 15u)
+    {
+        op = put_length(op, literal_len - 15u);
+    }
+
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    if (match_len)
+    {
+        *op++ = (uint8_t) offset;
+        *op++ = (uint8_t) (offset >> 8);
+
+        *token |= (uint8_t) (match_code >= 15u ? 15u : match_code);
+
+        if (match_code >= 15u)
+        {
+            op = put_length(op, match_code - 15u);
+        }
+    }
+
+    return op;
+}
+
+size_t lz_block_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_cap)
+{
+    uint16_t table[1u << LZ_HASH_BITS];
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *const end = src + len;
+    uint8_t *op = dst;
+    const uint8_t *const oend = dst + dst_cap;
+
+    if (len > LZ_BLOCK_MAX)
+    {
+        return 0;
+    }
+
+    if (len > LZ_MATCH_LIMIT)
+    {
+        const uint8_t *const search_end = end - LZ_MATCH_LIMIT;
+        const uint8_t *const match_end  = end - LZ_LAST_LITERALS;
+
+        memset(table, 0, sizeof(table));
+
+        while (ip <= search_end)
+        {
+            const uint32_t seq = load32(ip);
+            const uint32_t h   = lz_hash(seq);
+            const uint8_t *ref = src + table[h];
+            const uint8_t *mp;
+
+            table[h] = (uint16_t) (ip - src);
+
+            if ((ref >= ip) || ((size_t) (ip - ref) > LZ_MAX_OFFSET) || (load32(ref) != seq))
+            {
+                ++ip;
+                continue;
+            }
+
+            // Matches are extended backwards over literals that repeat too
+            while ((ip > anchor) && (ref > src) && (ip[-1] == ref[-1]))
+            {
+                --ip;
+                --ref;
+            }
+
+            mp = ip + LZ_MIN_MATCH;
+
+            while ((mp < match_end) && (*mp == ref[mp - ip]))
+            {
+                ++mp;
+            }
+
+            op = put_sequence(op, oend, anchor, (size_t) (ip - anchor), (size_t) (ip - ref), (size_t) (mp - ip));
+
+            if (op == NULL)
+            {
+                return 0;
+            }
+
+            ip = anchor = mp;
+
+            // Keep the position before the next search so runs chain together
+            if (ip <= search_end)
+            {
+                table[lz_hash(load32(ip - 2))] = (uint16_t) (ip - 2 - src);
+            }
+        }
+    }
+
+    op = put_sequence(op, oend, anchor, (size_t) (end - anchor), 0, 0);
+
+    return op ? (size_t) (op - dst) : 0;
+}
+
+bool lz_block_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_cap, size_t *out_len)
+{
+    const uint8_t *ip = src;
+    const uint8_t *const iend = src + len;
+    uint8_t *op = dst;
+    uint8_t *const oend = dst + dst_cap;
+
+    while (ip < iend)
+    {
+        const uint8_t token = *ip++;
+        size_t literal_len = token >> 4;
+        size_t match_len   = token & 0x0Fu;
+        size_t offset;
+
+        if (literal_len == 15u)
+        {
+            uint8_t b;
+
+            do
+            {
+                if (ip >= iend)
+                {
+                    return false;
+                }
+
+                b = *ip++;
+                literal_len += b;
+            } while (b == 255u);
+        }
+
+        if ((literal_len > (size_t) (iend - ip)) || (literal_len > (size_t) (oend - op)))
+        {
+            return false;
+        }
+
+        memcpy(op, ip, literal_len);
+        op += literal_len;
+        ip += literal_len;
+
+        // The last sequence has no match
+        if (ip == iend)
+        {
+            break;
+        }
+
+        if ((size_t) (iend - ip) < 2)
+        {
+            return false;
+        }
+
+        offset = (size_t) ip[0] | ((size_t) ip[1] << 8);
+        ip += 2;
+
+        if ((offset == 0) || (offset > (size_t) (op - dst)))
+        {
+            return false;
+        }
+
+        if (match_len == 15u)
+        {
+            uint8_t b;
+
+            do
+            {
+                if (ip >= iend)
+                {
+                    return false;
+                }
+
+                b = *ip++;
+                match_len += b;
+            } while (b == 255u);
+        }
+
+        match_len += LZ_MIN_MATCH;
+
+        if (match_len > (size_t) (oend - op))
+        {
+            return false;
+        }
+
+        // Byte by byte, the match may overlap its own output
+        {
+            const uint8_t *ref = op - offset;
+
+            while (match_len--)
+            {
+                *op++ = *ref++;
+            }
+        }
+    }
+
+    *out_len = (size_t) (op - dst);
+    return true;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file lz.h
+ *
+ * LZ compression of independent blocks in the LZ4 block format.
+ *
+ * Decompression needs no tables and no memory besides the output buffer,
+ * so a device can expand a block straight into its flash page buffer.
+ * The compressor is greedy with a small hash table on the stack, blocks
+ * are limited to 64 KiB.
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/** Largest block lz_block_compress() accepts */
+#define LZ_BLOCK_MAX 65535u
+
+/** Worst case compressed size of a block of len bytes */
+#define LZ_BLOCK_BOUND(len) ((len) + (len) / 255u + 16u)
+
+/**
+ * Compress a block.
+ * @return compressed size, or 0 if it does not fit in dst or the block is too big
+ */
+size_t lz_block_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_cap);
+
+/**
+ * Decompress a block.
+ * @param out_len - decompressed size on success
+ * @return false if the block is malformed or does not fit in dst
+ */
+bool lz_block_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_cap, size_t *out_len);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // LZ_H
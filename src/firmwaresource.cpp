@@ -0,0 +1,126 @@
+/**
+ * @file firmwaresource.cpp
+ */
+
+#include "firmwaresource.h"
+
+#include <QDebug>
+
+firmware_source::firmware_source(const QString &file_name)
+    : file{file_name}
+{
+}
+
+firmware_source::~firmware_source()
+{
+    window_release();
+
+    if (file.isOpen())
+    {
+        file.close();
+    }
+}
+
+bool firmware_source::open()
+{
+    if (!file.open(QIODevice::ReadOnly | QIODevice::ExistingOnly))
+    {
+        qDebug() << "[ERROR] File " << file.fileName() << " cannot be opened. Error: " << file.errorString();
+        return false;
+    }
+
+    if (file.size() > static_cast<qint64>(UINT32_MAX))
+    {
+        qDebug() << "[ERROR] File " << file.fileName() << " is too large";
+        file.close();
+        return false;
+    }
+
+    file_size = static_cast<quint32>(file.size());
+
+    return true;
+}
+
+quint32 firmware_source::size() const
+{
+    return file_size;
+}
+
+QString firmware_source::file_name() const
+{
+    return file.fileName();
+}
+
+/**
+ * Returns a view of the requested range. The view is valid until the next call.
+ */
+file_chunk_view firmware_source::read(quint32 offset, quint16 size)
+{
+    file_chunk_view view = { nullptr, 0 };
+
+    if (offset >= file_size)
+    {
+        return view;
+    }
+
+    size = static_cast<quint16>(qMin<quint32>(size, file_size - offset));
+
+    if ((window_size == 0) || (offset < window_offset) || (offset + size > window_offset + window_size))
+    {
+        if (!window_load(offset))
+        {
+            return view;
+        }
+    }
+
+    const quint8 *window = window_mapped ? window_mapped
+                                         : reinterpret_cast<const quint8*>(window_buffer.constData());
+
+    view.data = window + (offset - window_offset);
+    view.size = size;
+
+    return view;
+}
+
+bool firmware_source::window_load(quint32 offset)
+{
+    window_release();
+
+    window_offset = offset - (offset % window_granularity);
+    window_size   = file_size - window_offset;
+
+    if (window_size > window_size_max)
+    {
+        window_size = window_size_max;
+    }
+
+    window_mapped = file.map(window_offset, window_size);
+    if (window_mapped)
+    {
+        return true;
+    }
+
+    // The device cannot be mapped, read the window ahead instead
+    window_buffer.resize(static_cast<int>(window_size));
+
+    if (!file.seek(window_offset)
+        || (file.read(window_buffer.data(), window_size) != static_cast<qint64>(window_size)))
+    {
+        qDebug() << "[ERROR] File " << file.fileName() << " read error: " << file.errorString();
+        window_release();
+        return false;
+    }
+
+    return true;
+}
+
+void firmware_source::window_release()
+{
+    if (window_mapped)
+    {
+        file.unmap(window_mapped);
+        window_mapped = nullptr;
+    }
+
+    window_size = 0;
+}
@@ -0,0 +1,50 @@
+/**
+ * @file firmwaresource.h
+ */
+
+#ifndef FIRMWARESOURCE_H
+#define FIRMWARESOURCE_H
+
+#include <QFile>
+#include <QByteArray>
+#include <QString>
+
+/** Read-only view of one chunk inside the image that is being transferred */
+struct file_chunk_view
+{
+    const quint8 *data;
+    quint16 size;
+};
+
+/**
+ * Firmware image that is read lazily while it is transferred.
+ *
+ * Only a window of the file is kept in memory. It is memory mapped if the
+ * file allows that, otherwise it is read ahead into a buffer.
+ */
+class firmware_source
+{
+public:
+    explicit firmware_source(const QString &file_name);
+    ~firmware_source();
+    bool open(void);
+    quint32 size(void) const;
+    QString file_name(void) const;
+    file_chunk_view read(quint32 offset, quint16 size);
+
+private:
+    QFile file;
+    quint32 file_size    = 0;
+    uchar *window_mapped = nullptr;
+    QByteArray window_buffer;
+    quint32 window_offset = 0;
+    quint32 window_size   = 0;
+
+    static const quint32 window_size_max    = 1024 * 1024;
+    static const quint32 window_granularity = 64 * 1024;
+
+    bool window_load(quint32 offset);
+    void window_release(void);
+};
+
+#endif // FIRMWARESOURCE_H
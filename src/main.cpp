@@ -2,8 +2,15 @@
 
 #include <QApplication>
 
+#include "checksum/checksum.h"
+#include "minihdlc.h"
+
 int main(int argc, char *argv[])
 {
+    // Pick the checksum and HDLC kernels for this CPU before any port is opened
+    checksum_init();
+    minihdlc_encode_init();
+
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
@@ -7,10 +7,10 @@
 #include <QByteArray>
 #include <QList>
 #include <QDebug>
-#include <QFile>
 #include <QFileInfo>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QThread>
 
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
@@ -27,6 +27,7 @@ MainWindow::MainWindow(QWidget *parent)
     ui->selected_file_name->setReadOnly(true);
 
     ui->buttonDisconnect->setEnabled(false);
+    ui->button_benchmark->setEnabled(false);
 
     const auto serialPorts = QSerialPortInfo::availablePorts();
 
@@ -53,13 +54,9 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
-    delete ui;
+    disconnect_device();
 
-    if (hdlc != nullptr)
-    {
-        delete hdlc;
-        hdlc = nullptr;
-    }
+    delete ui;
 
     if (led_indicator)
     {
@@ -72,25 +69,44 @@ void MainWindow::on_buttonConnect_clicked()
 {
     if (hdlc == nullptr)
     {
-        hdlc = new comhdlc(ui->comboBox->currentText());
+        // The engine gets its own thread and event loop, so GUI stalls never delay ACKs
+        hdlc_thread = new QThread(this);
+        hdlc        = new comhdlc(ui->comboBox->currentText());
+        hdlc->moveToThread(hdlc_thread);
+
+        connect(hdlc_thread, &QThread::started,  hdlc, &comhdlc::start);
+        connect(hdlc_thread, &QThread::finished, hdlc, &QObject::deleteLater);
+
+        connect(hdlc, &comhdlc::comport_opened,         this, &MainWindow::comhdlc_comport_opened);
+        connect(hdlc, &comhdlc::device_connected,       this, &MainWindow::comhdlc_device_connected);
+        connect(hdlc, &comhdlc::file_transfer_finished, this, &MainWindow::comhdlc_file_transferred);
+        connect(hdlc, &comhdlc::file_chunk_transferred, this, &MainWindow::comhdlc_chunk_transferred);
+        connect(hdlc, &comhdlc::rx_ceiling_measured,    this, &MainWindow::comhdlc_rx_ceiling_measured);
+        connect(hdlc, &comhdlc::compression_measured,   this, &MainWindow::comhdlc_compression_measured);
+        connect(hdlc, &comhdlc::transfer_resumed,       this, &MainWindow::comhdlc_transfer_resumed);
+        connect(hdlc, &comhdlc::baud_rate_changed,      this, &MainWindow::comhdlc_baud_rate_changed);
+        connect(hdlc, &comhdlc::baud_benchmark_result,  this, &MainWindow::comhdlc_baud_benchmark_result);
+        connect(hdlc, &comhdlc::baud_benchmark_finished, this, &MainWindow::comhdlc_baud_benchmark_finished);
+        connect(this, &MainWindow::hdlc_transfer_file,  hdlc, &comhdlc::transfer_file);
+        connect(this, &MainWindow::hdlc_benchmark_baud_rates, hdlc, &comhdlc::benchmark_baud_rates);
+
+        ui->buttonConnect->setEnabled(false);
+        ui->comboBox->setEnabled(false);
+
+        hdlc_thread->start();
+    }
+}
 
-        if (hdlc->is_comport_connected())
-        {
-            ui->buttonConnect->setEnabled(false);
-            ui->buttonDisconnect->setEnabled(true);
-            ui->comboBox->setEnabled(false);
-            connect(hdlc, &comhdlc::device_connected,     this, &MainWindow::comhdlc_device_connected);
-            connect(hdlc, &comhdlc::file_was_transferred, this, &MainWindow::comhdlc_file_transferred);
-            connect(hdlc, &comhdlc::file_chunk_transferred, this, &MainWindow::comhdlc_chunk_transferred);
-        }
-        else
-        {
-            ui->buttonConnect->setEnabled(true);
-            ui->buttonDisconnect->setEnabled(false);
-            ui->comboBox->setEnabled(true);
-            delete hdlc;
-            hdlc = nullptr;
-        }
+void MainWindow::comhdlc_comport_opened(bool opened)
+{
+    if (opened)
+    {
+        ui->buttonDisconnect->setEnabled(true);
+    }
+    else
+    {
+        log_message("[ERROR] " + ui->comboBox->currentText() + " cannot be opened");
+        disconnect_device();
     }
 }
 
@@ -110,17 +126,83 @@ void MainWindow::comhdlc_device_connected(bool connected)
     {
         disconnect_device();
     }
-    else if (led_indicator)
+    else
     {
-        led_indicator->setState(true);
+        ui->button_benchmark->setEnabled(true);
+
+        if (led_indicator)
+        {
+            led_indicator->setState(true);
+        }
     }
 }
 
-void MainWindow::comhdlc_file_transferred(bool transferred)
+void MainWindow::comhdlc_file_transferred(eComHdlcTransferResult result, quint32 crc32)
 {
-    QString res = transferred ? "transferred" : "not transferred";
-    QString str = "[INFO] File was " + res;
-    log_message(str);
+    const QString crc = QString::number(crc32, 16);
+
+    switch (result)
+    {
+    case eTransferOk:
+        log_message("[INFO] File was transferred and verified, CRC32 " + crc);
+        break;
+    case eTransferReadError:
+        log_message("[ERROR] File was not transferred, it cannot be read");
+        break;
+    case eTransferNoAck:
+        log_message("[ERROR] File was not transferred, the device stopped acknowledging");
+        break;
+    case eTransferFinishTimeout:
+        log_message("[ERROR] File was sent but not confirmed, send it again to resume");
+        break;
+    case eTransferDigestMismatch:
+        log_message("[ERROR] File was transferred but the device got another CRC32 than " + crc);
+        break;
+    case eTransferDeviceError:
+        log_message("[ERROR] File was transferred but the device rejected it");
+        break;
+    case eTransferNoDevice:
+        log_message("[ERROR] File was not transferred, the device did not connect");
+        break;
+    case eTransferPortError:
+        log_message("[ERROR] File was not transferred, the port could not be opened or was lost");
+        break;
+    }
+}
+
+void MainWindow::comhdlc_rx_ceiling_measured(quint64 bytes_per_second)
+{
+    log_message("[INFO] Receive path ceiling is " + QString::number(bytes_per_second) + " bytes/s");
+}
+
+void MainWindow::comhdlc_compression_measured(double ratio, double speedup)
+{
+    log_message("[INFO] Compression ratio " + QString::number(ratio, 'f', 2) + ", effective speedup "
+                + QString::number(speedup, 'f', 2) + "x");
+}
+
+void MainWindow::comhdlc_transfer_resumed(quint32 offset)
+{
+    log_message("[INFO] Transfer resumed at " + QString::number(offset) + " bytes");
+
+    file_size = offset;
+    ui->file_send_progress->setValue(file_size);
+}
+
+void MainWindow::comhdlc_baud_rate_changed(quint32 baud)
+{
+    log_message("[INFO] Link rate is " + QString::number(baud) + " baud");
+}
+
+void MainWindow::comhdlc_baud_benchmark_result(quint32 baud, quint64 bytes_per_second)
+{
+    log_message("[INFO] " + QString::number(baud) + " baud: " + QString::number(bytes_per_second) + " bytes/s");
+}
+
+void MainWindow::comhdlc_baud_benchmark_finished(quint32 best_baud)
+{
+    log_message("[INFO] Benchmark finished, the fastest rate is " + QString::number(best_baud) + " baud");
+    ui->button_benchmark->setEnabled(true);
 }
 
 void MainWindow::comhdlc_chunk_transferred(quint16 chunk_size)
@@ -141,10 +223,16 @@ void MainWindow::disconnect_device()
 {
     if (hdlc != nullptr)
     {
-        delete hdlc;
-        hdlc = nullptr;
+        // The engine is deleted in its own thread once the event loop is left
+        hdlc_thread->quit();
+        hdlc_thread->wait();
+
+        delete hdlc_thread;
+        hdlc_thread = nullptr;
+        hdlc        = nullptr;
 
         ui->buttonDisconnect->setEnabled(false);
+        ui->button_benchmark->setEnabled(false);
         ui->buttonConnect->setEnabled(true);
         ui->comboBox->setEnabled(true);
         ui->file_send_progress->hide();
@@ -160,14 +248,15 @@ void MainWindow::disconnect_device()
 
 void MainWindow::on_button_send_file_clicked()
 {
-    if (file_opened.isEmpty())
+    if (file_name.isEmpty())
     {
         log_message("[ERROR] File is not opened");
     }
     else if (hdlc)
     {
-        hdlc->transfer_file(file_opened, file_name);
-        file_opened.clear();
+        emit hdlc_transfer_file(file_name);
+
+        file_name.clear();
         ui->file_send_progress->show();
         ui->button_send_file->setEnabled(false);
         ui->selected_file_name->clear();
@@ -189,25 +278,33 @@ void MainWindow::on_button_file_dialog_clicked()
         return;
     }
 
-    QFile file(file_name);
+    // The file is only inspected here, its content is streamed while it is sent
+    QFileInfo fil_inf(file_name);
 
-    if (file.open(QIODevice::ReadOnly | QIODevice::ExistingOnly))
+    if (fil_inf.isFile() && fil_inf.isReadable())
     {
-        file_opened.clear();
-        file_opened = file.readAll();
-
-        QFileInfo fil_inf(file);
-
-        const QString log_msg = "[INFO] File " + fil_inf.fileName() + " opened. Size is " + QString::number(file_opened.size())
+        const QString log_msg = "[INFO] File " + fil_inf.fileName() + " opened. Size is " + QString::number(fil_inf.size())
                 + " bytes";
         log_message(log_msg);
 
-        file.close();
-
         ui->selected_file_name->setText(file_name);
-        ui->file_send_progress->setMaximum(file.size());
+        ui->file_send_progress->setMaximum(fil_inf.size());
         ui->file_send_progress->setValue(0);
         ui->button_send_file->setEnabled(true);
     }
+    else
+    {
+        log_message("[ERROR] File " + file_name + " cannot be read");
+        file_name.clear();
+    }
 }
 
+void MainWindow::on_button_benchmark_clicked()
+{
+    if (hdlc)
+    {
+        ui->button_benchmark->setEnabled(false);
+        log_message("[INFO] Benchmarking link rates");
+        emit hdlc_benchmark_baud_rates();
+    }
+}
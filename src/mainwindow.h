@@ -4,6 +4,7 @@
 #include <QMainWindow>
 #include <QLayout>
 #include <QSerialPort>
+#include <QThread>
 
 #include "comhdlc.h"
 #include "ledindicator.h"
@@ -26,24 +27,44 @@ private slots:
 
     void on_buttonConnect_clicked();
 
+    void comhdlc_comport_opened(bool opened);
+
     void comhdlc_device_connected(bool connected);
 
-    void comhdlc_file_transferred(bool transferred);
+    void comhdlc_file_transferred(eComHdlcTransferResult result, quint32 crc32);
 
     void comhdlc_chunk_transferred(quint16 chunk_size);
 
+    void comhdlc_rx_ceiling_measured(quint64 bytes_per_second);
+
+    void comhdlc_compression_measured(double ratio, double speedup);
+
+    void comhdlc_transfer_resumed(quint32 offset);
+
+    void comhdlc_baud_rate_changed(quint32 baud);
+
+    void comhdlc_baud_benchmark_result(quint32 baud, quint64 bytes_per_second);
+
+    void comhdlc_baud_benchmark_finished(quint32 best_baud);
+
     void on_button_send_file_clicked();
 
     void on_button_file_dialog_clicked();
 
+    void on_button_benchmark_clicked();
+
+signals:
+    void hdlc_transfer_file(const QString &file_name);
+    void hdlc_benchmark_baud_rates();
+
 private:
     void log_message(const QString &string);
     void disconnect_device();
 
     Ui::MainWindow *ui = nullptr;
     comhdlc *hdlc      = nullptr;
+    QThread *hdlc_thread = nullptr;
     QString file_name  = "";
-    QByteArray file_opened;
     LedIndicator *led_indicator = nullptr;
     quint32 file_size = 0;
 };
@@ -1,4 +1,17 @@
 #include "minihdlc.h"
+#include "checksum/checksum.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* Block encoder kernels. SSE2 is part of x86-64, AVX2 is picked at runtime, NEON is part of AArch64 */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MINIHDLC_SCAN_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON) && (defined(__GNUC__) || defined(__clang__))
+#define MINIHDLC_SCAN_NEON 1
+#include <arm_neon.h>
+#endif
 
 /* HDLC Asynchronous framing */
 /* The frame boundary octet is 01111110, (7E in hexadecimal notation) */
@@ -23,176 +36,580 @@
 #define lo8(x)		((x) & 0xff)
 #define hi8(x)		((x) >> 8)
 
-struct
-{
-	sendchar_type sendchar_function;
-	frame_handler_type frame_handler;
-	bool escape_character;
-	uint16_t frame_position;
-	uint16_t frame_checksum;
-	uint8_t receive_frame_buffer[MINIHDLC_MAX_FRAME_LENGTH + 1];
-} mhst;
+/* Link of the single link API and its callbacks */
+static minihdlc_context mhst;
+static sendchar_type mhst_sendchar_function;
+static frame_handler_type mhst_frame_handler;
 
 /*
  Polynomial: x^16 + x^12 + x^5 + 1 (0x8408) Initial value: 0xffff
  This is the CRC used by PPP and IrDA.
  See RFC1171 (PPP protocol) and IrDA IrLAP 1.1
+ The FCS is computed over whole blocks by checksum_crc_ccitt()
  */
-static uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data)
+
+void minihdlc_context_init(minihdlc_context *ctx,
+        minihdlc_sendchar_type sendchar_function,
+        minihdlc_frame_handler_type frame_handler_function, void *userdata)
 {
-	data ^= lo8(crc);
-	data ^= data << 4;
+	ctx->sendchar_function = sendchar_function;
+    ctx->frame_handler = frame_handler_function;
+    ctx->userdata = userdata;
+	ctx->frame_position = 0;
+	ctx->escape_character = false;
+    ctx->tx_buffer_size = 0;
+}
 
-	return ((((uint16_t) data << 8) | hi8(crc)) ^ (uint8_t) (data >> 4)
-			^ ((uint16_t) data << 3));
+/* Function to send a byte throug USART, I2C, SPI etc.*/
+static inline void minihdlc_sendchar(minihdlc_context *ctx, uint8_t data)
+{
+    if (ctx->sendchar_function)
+    {
+		(*ctx->sendchar_function)(ctx, data);
+	}
 }
 
-void minihdlc_init(sendchar_type sendchar_function,
-        frame_handler_type frame_handler_function)
+/* Closing flag: deliver the frame if its FCS matches, an escaped flag aborts it */
+static void receive_frame_end(minihdlc_context *ctx)
 {
-	mhst.sendchar_function = sendchar_function;
-    mhst.frame_handler = frame_handler_function;
-	mhst.frame_position = 0;
-	mhst.frame_checksum = CRC16_CCITT_INIT_VAL;
-	mhst.escape_character = false;
+    if (ctx->escape_character == true)
+    {
+        ctx->escape_character = false;
+    }
+    /* If a valid frame is detected */
+    else if ((ctx->frame_position >= 2)
+        && (checksum_crc_ccitt(CRC16_CCITT_INIT_VAL, ctx->receive_frame_buffer, ctx->frame_position - 2)
+        == ((ctx->receive_frame_buffer[ctx->frame_position - 1] << 8) | (ctx->receive_frame_buffer[ctx->frame_position - 2] & 0xff)))) // (msb << 8 ) | (lsb & 0xff)
+    {
+        /* Call the user defined function and pass frame to it */
+        if (ctx->frame_handler)
+        {
+            (*ctx->frame_handler)(ctx, ctx->receive_frame_buffer,
+                ctx->frame_position - 2);
+        }
+    }
+
+    ctx->frame_position = 0;
 }
 
-/* Function to send a byte throug USART, I2C, SPI etc.*/
-static inline void minihdlc_sendchar(uint8_t data)
+/* An unescaped byte. On overflow the frame starts over */
+static inline void receive_byte(minihdlc_context *ctx, uint8_t data)
 {
-    if (mhst.sendchar_function)
+    ctx->receive_frame_buffer[ctx->frame_position] = data;
+
+    ctx->frame_position++;
+
+    if (ctx->frame_position == MINIHDLC_MAX_FRAME_LENGTH)
     {
-		(*mhst.sendchar_function)(data);
-	}
+        ctx->frame_position = 0;
+    }
 }
 
-/* Function to find valid HDLC frame from incoming data */
-void minihdlc_char_receiver(uint8_t data)
+/* A run without flags and escapes, same as receive_byte() for every byte */
+static inline void receive_run(minihdlc_context *ctx, const uint8_t *data, size_t len)
 {
-	/* FRAME FLAG */
-    if (data == FRAME_BOUNDARY_OCTET)
+    size_t room;
+
+    while (len)
     {
-        if (mhst.escape_character == true)
+        room = MINIHDLC_MAX_FRAME_LENGTH - ctx->frame_position;
+        if (room > len)
         {
-			mhst.escape_character = false;
-		}
-		/* If a valid frame is detected */
-		else if ((mhst.frame_position >= 2)
-            && (mhst.frame_checksum
-            == ((mhst.receive_frame_buffer[mhst.frame_position - 1] << 8) | (mhst.receive_frame_buffer[mhst.frame_position - 2] & 0xff)))) // (msb << 8 ) | (lsb & 0xff)
+            room = len;
+        }
+
+        memcpy(ctx->receive_frame_buffer + ctx->frame_position, data, room);
+        ctx->frame_position += (uint16_t) room;
+        data += room;
+        len -= room;
+
+        if (ctx->frame_position == MINIHDLC_MAX_FRAME_LENGTH)
         {
-			/* Call the user defined function and pass frame to it */
-            if (mhst.frame_handler)
-            {
-                (*mhst.frame_handler)(mhst.receive_frame_buffer,
-					mhst.frame_position - 2);
-            }
-		}
+            ctx->frame_position = 0;
+        }
+    }
+}
 
-		mhst.frame_position = 0;
-		mhst.frame_checksum = CRC16_CCITT_INIT_VAL;
-		return;
-	}
+/* Function to find valid HDLC frame from incoming data */
+void minihdlc_context_char_receiver(minihdlc_context *ctx, uint8_t data)
+{
+    /* FRAME FLAG */
+    if (data == FRAME_BOUNDARY_OCTET)
+    {
+        receive_frame_end(ctx);
+        return;
+    }
 
-    if (mhst.escape_character)
+    if (ctx->escape_character)
     {
-		mhst.escape_character = false;
-		data ^= INVERT_OCTET;
+        ctx->escape_character = false;
+        data ^= INVERT_OCTET;
     }
     else if (data == CONTROL_ESCAPE_OCTET)
     {
-		mhst.escape_character = true;
-		return;
-	}
+        ctx->escape_character = true;
+        return;
+    }
+
+    receive_byte(ctx, data);
+}
 
-	mhst.receive_frame_buffer[mhst.frame_position] = data;
+#if MINIHDLC_SCAN_X86 || MINIHDLC_SCAN_NEON
 
-    if (mhst.frame_position - 2 >= 0)
+/*
+ Unescape a block without flags, branch free. The frame buffer must have
+ room for the whole block.
+ */
+static inline void receive_unescape(minihdlc_context *ctx, const uint8_t *data, size_t width)
+{
+    uint8_t *out = ctx->receive_frame_buffer + ctx->frame_position;
+    unsigned int pending = ctx->escape_character;
+    unsigned int escape;
+    size_t n = 0;
+    size_t i;
+
+    for (i = 0; i < width; i++)
     {
-		mhst.frame_checksum = _crc_ccitt_update(mhst.frame_checksum,
-				mhst.receive_frame_buffer[mhst.frame_position - 2]);
-	}
+        escape = (data[i] == CONTROL_ESCAPE_OCTET) & !pending;
+        out[n] = data[i] ^ (uint8_t) (pending * INVERT_OCTET);
+        n += !escape;
+        pending = escape;
+    }
 
-	mhst.frame_position++;
+    ctx->frame_position += (uint16_t) n;
+    if (ctx->frame_position == MINIHDLC_MAX_FRAME_LENGTH)
+    {
+        ctx->frame_position = 0;
+    }
+    ctx->escape_character = pending;
+}
+
+/*
+ One block holding flags or escapes, a set bit every (1 << shift) bits marks
+ one. No escape is pending when the block starts.
+ */
+static inline void receive_hits(minihdlc_context *ctx, const uint8_t *data, uint64_t hits, uint64_t flags,
+    unsigned int shift, size_t width)
+{
+    size_t pos = 0;
+    size_t at;
 
-    if (mhst.frame_position == MINIHDLC_MAX_FRAME_LENGTH)
+    /* Inside a frame, cheaper than copying the runs between the escapes */
+    if ((flags == 0) && ((size_t) (MINIHDLC_MAX_FRAME_LENGTH - ctx->frame_position) >= width))
     {
-		mhst.frame_position = 0;
-		mhst.frame_checksum = CRC16_CCITT_INIT_VAL;
-	}
+        receive_unescape(ctx, data, width);
+        return;
+    }
+
+    while (hits)
+    {
+        at = (size_t) __builtin_ctzll(hits) >> shift;
+        hits &= hits - 1;
+        receive_run(ctx, data + pos, at - pos);
+        pos = at + 1;
+
+        if (data[at] == FRAME_BOUNDARY_OCTET)
+        {
+            receive_frame_end(ctx);
+        }
+        else if (pos == width)
+        {
+            /* The escaped byte is in the next block */
+            ctx->escape_character = true;
+        }
+        else
+        {
+            /* The escaped byte is taken whatever it is, a flag aborts the frame */
+            if (data[pos] == FRAME_BOUNDARY_OCTET)
+            {
+                ctx->frame_position = 0;
+            }
+            else
+            {
+                receive_byte(ctx, data[pos] ^ INVERT_OCTET);
+            }
+
+            hits &= ~((uint64_t) 1 << (pos << shift));
+            pos++;
+        }
+    }
+
+    receive_run(ctx, data + pos, width - pos);
+}
+
+#endif
+
+/* Wrap-free runs go to the frame buffer whole, blocks are scanned 16 bytes at a time */
+void minihdlc_context_receive(minihdlc_context *ctx, const uint8_t *data, size_t length)
+{
+#if MINIHDLC_SCAN_X86
+    const __m128i flag   = _mm_set1_epi8((char) FRAME_BOUNDARY_OCTET);
+    const __m128i escape = _mm_set1_epi8((char) CONTROL_ESCAPE_OCTET);
+#elif MINIHDLC_SCAN_NEON
+    const uint8x16_t flag   = vdupq_n_u8(FRAME_BOUNDARY_OCTET);
+    const uint8x16_t escape = vdupq_n_u8(CONTROL_ESCAPE_OCTET);
+#endif
+
+#if MINIHDLC_SCAN_X86 || MINIHDLC_SCAN_NEON
+    while (length >= 16)
+    {
+        uint64_t hits;
+
+        if (ctx->escape_character)
+        {
+            minihdlc_context_char_receiver(ctx, *data++);
+            length--;
+            continue;
+        }
+
+#if MINIHDLC_SCAN_X86
+        {
+            const __m128i block = _mm_loadu_si128((const __m128i *) data);
+            const __m128i flags = _mm_cmpeq_epi8(block, flag);
+            hits = (unsigned int) _mm_movemask_epi8(_mm_or_si128(flags, _mm_cmpeq_epi8(block, escape)));
+            if (hits != 0)
+            {
+                receive_hits(ctx, data, hits, (unsigned int) _mm_movemask_epi8(flags), 0, 16);
+            }
+        }
+#else
+        {
+            const uint8x16_t block = vld1q_u8(data);
+            const uint8x16_t flags = vceqq_u8(block, flag);
+            const uint8x16_t match = vorrq_u8(flags, vceqq_u8(block, escape));
+            /* No movemask, narrowed to a nibble a byte and one bit kept of each */
+            hits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0)
+                    & 0x1111111111111111ull;
+            if (hits != 0)
+            {
+                receive_hits(ctx, data, hits, vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(flags), 4)), 0),
+                             2, 16);
+            }
+        }
+#endif
+
+        if (hits == 0)
+        {
+            receive_run(ctx, data, 16);
+        }
+
+        data += 16;
+        length -= 16;
+    }
+#endif
+
+    while (length--)
+    {
+        minihdlc_context_char_receiver(ctx, *data++);
+    }
 }
 
 /* Wrap given data in HDLC frame and send it out byte at a time*/
-void minihdlc_send_frame(const uint8_t *frame_buffer, uint16_t frame_length)
+void minihdlc_context_send_frame(minihdlc_context *ctx, const uint8_t *frame_buffer,
+    uint16_t frame_length)
 {
 	uint8_t data;
-	uint16_t fcs = CRC16_CCITT_INIT_VAL;
+	const uint16_t fcs = checksum_crc_ccitt(CRC16_CCITT_INIT_VAL, frame_buffer, frame_length);
 
-	minihdlc_sendchar((uint8_t) FRAME_BOUNDARY_OCTET);
+	minihdlc_sendchar(ctx, (uint8_t) FRAME_BOUNDARY_OCTET);
 
     while (frame_length)
     {
 		data = *frame_buffer++;
-		fcs = _crc_ccitt_update(fcs, data);
         if ((data == CONTROL_ESCAPE_OCTET) || (data == FRAME_BOUNDARY_OCTET))
         {
-			minihdlc_sendchar((uint8_t) CONTROL_ESCAPE_OCTET);
+			minihdlc_sendchar(ctx, (uint8_t) CONTROL_ESCAPE_OCTET);
 			data ^= INVERT_OCTET;
 		}
-        minihdlc_sendchar(data);
+        minihdlc_sendchar(ctx, data);
 		frame_length--;
 	}
 	data = low(fcs);
     if ((data == CONTROL_ESCAPE_OCTET) || (data == FRAME_BOUNDARY_OCTET))
     {
-		minihdlc_sendchar((uint8_t) CONTROL_ESCAPE_OCTET);
+		minihdlc_sendchar(ctx, (uint8_t) CONTROL_ESCAPE_OCTET);
 		data ^= (uint8_t) INVERT_OCTET;
 	}
-    minihdlc_sendchar(data);
+    minihdlc_sendchar(ctx, data);
 	data = high(fcs);
     if ((data == CONTROL_ESCAPE_OCTET) || (data == FRAME_BOUNDARY_OCTET))
     {
-		minihdlc_sendchar(CONTROL_ESCAPE_OCTET);
+		minihdlc_sendchar(ctx, CONTROL_ESCAPE_OCTET);
 		data ^= INVERT_OCTET;
 	}
-	minihdlc_sendchar(data);
-	minihdlc_sendchar(FRAME_BOUNDARY_OCTET);
+	minihdlc_sendchar(ctx, data);
+	minihdlc_sendchar(ctx, FRAME_BOUNDARY_OCTET);
+}
+
+static inline uint8_t *put_escaped(uint8_t *out, uint8_t data)
+{
+    if ((data == CONTROL_ESCAPE_OCTET) || (data == FRAME_BOUNDARY_OCTET))
+    {
+        *out++ = CONTROL_ESCAPE_OCTET;
+        data ^= INVERT_OCTET;
+    }
+    *out++ = data;
+
+    return out;
 }
 
-/* Wrap given data in HDLC frame and send it to static buffer */
+/*
+ Byte stuffing kernels for the block encoder. Each escapes len payload
+ bytes into out and returns the end of the output. The vector ones compare
+ a block at a time, store clean blocks whole and walk the bit mask of the
+ flag and escape octets in the others.
+ */
 
-static uint8_t frame_buffer[MINIHDLC_MAX_FRAME_LENGTH + 1];
-static uint32_t frame_buffer_size = 0;
+static uint8_t *stuff_bytes(uint8_t *out, const uint8_t *data, size_t len)
+{
+    while (len--)
+    {
+        out = put_escaped(out, *data++);
+    }
+
+    return out;
+}
 
-static void buffer_init()
+#if MINIHDLC_SCAN_X86 || MINIHDLC_SCAN_NEON
+
+/* One block with octets to escape, a set bit every (1 << shift) bits marks one */
+static inline uint8_t *stuff_hits(uint8_t *out, const uint8_t *data, uint64_t hits,
+    unsigned int shift, size_t width)
 {
-	frame_buffer_size = 0;
+    size_t pos = 0;
+    size_t at;
+
+    while (hits)
+    {
+        at = (size_t) __builtin_ctzll(hits) >> shift;
+        memcpy(out, data + pos, at - pos);
+        out += at - pos;
+        *out++ = CONTROL_ESCAPE_OCTET;
+        *out++ = data[at] ^ INVERT_OCTET;
+        pos = at + 1;
+        hits &= hits - 1;
+    }
+
+    memcpy(out, data + pos, width - pos);
+
+    return out + (width - pos);
 }
 
-static void buffer_push(uint8_t data)
+#endif
+
+#if MINIHDLC_SCAN_X86
+
+static uint8_t *stuff_sse2(uint8_t *out, const uint8_t *data, size_t len)
 {
-    if (frame_buffer_size >= MINIHDLC_MAX_FRAME_LENGTH)
+    const __m128i flag   = _mm_set1_epi8((char) FRAME_BOUNDARY_OCTET);
+    const __m128i escape = _mm_set1_epi8((char) CONTROL_ESCAPE_OCTET);
+
+    for (; len >= 16; len -= 16, data += 16)
     {
-		return;
-	}
-	frame_buffer[frame_buffer_size] = data;
-	frame_buffer_size++;
+        const __m128i block = _mm_loadu_si128((const __m128i *) data);
+        const unsigned int hits = (unsigned int) _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(block, flag), _mm_cmpeq_epi8(block, escape)));
+
+        if (hits == 0)
+        {
+            _mm_storeu_si128((__m128i *) out, block);
+            out += 16;
+        }
+        else
+        {
+            out = stuff_hits(out, data, hits, 0, 16);
+        }
+    }
+
+    return stuff_bytes(out, data, len);
+}
+
+/* The tail stays in this function, SSE code after AVX code would stall on the upper halves */
+__attribute__((target("avx2")))
+static uint8_t *stuff_avx2(uint8_t *out, const uint8_t *data, size_t len)
+{
+    const __m256i flag   = _mm256_set1_epi8((char) FRAME_BOUNDARY_OCTET);
+    const __m256i escape = _mm256_set1_epi8((char) CONTROL_ESCAPE_OCTET);
+
+    for (; len >= 32; len -= 32, data += 32)
+    {
+        const __m256i block = _mm256_loadu_si256((const __m256i *) data);
+        const unsigned int hits = (unsigned int) _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, flag), _mm256_cmpeq_epi8(block, escape)));
+
+        if (hits == 0)
+        {
+            _mm256_storeu_si256((__m256i *) out, block);
+            out += 32;
+        }
+        else
+        {
+            out = stuff_hits(out, data, hits, 0, 32);
+        }
+    }
+
+    _mm256_zeroupper();
+
+    while (len--)
+    {
+        out = put_escaped(out, *data++);
+    }
+
+    return out;
+}
+
+#elif MINIHDLC_SCAN_NEON
+
+static uint8_t *stuff_neon(uint8_t *out, const uint8_t *data, size_t len)
+{
+    const uint8x16_t flag   = vdupq_n_u8(FRAME_BOUNDARY_OCTET);
+    const uint8x16_t escape = vdupq_n_u8(CONTROL_ESCAPE_OCTET);
+
+    for (; len >= 16; len -= 16, data += 16)
+    {
+        const uint8x16_t block = vld1q_u8(data);
+        const uint8x16_t match = vorrq_u8(vceqq_u8(block, flag), vceqq_u8(block, escape));
+        /* No movemask, narrowed to a nibble a byte and one bit kept of each */
+        const uint64_t hits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0)
+                & 0x1111111111111111ull;
+
+        if (hits == 0)
+        {
+            vst1q_u8(out, block);
+            out += 16;
+        }
+        else
+        {
+            out = stuff_hits(out, data, hits, 2, 16);
+        }
+    }
+
+    return stuff_bytes(out, data, len);
+}
+
+#endif
+
+/* Every CPU of the build target has the baseline kernel, minihdlc_encode_init() may pick a wider one */
+#if MINIHDLC_SCAN_X86
+static uint8_t *(*stuff_kernel)(uint8_t *out, const uint8_t *data, size_t len) = stuff_sse2;
+static const char *stuff_kernel_name = "sse2";
+#elif MINIHDLC_SCAN_NEON
+static uint8_t *(*stuff_kernel)(uint8_t *out, const uint8_t *data, size_t len) = stuff_neon;
+static const char *stuff_kernel_name = "neon";
+#else
+static uint8_t *(*stuff_kernel)(uint8_t *out, const uint8_t *data, size_t len) = stuff_bytes;
+static const char *stuff_kernel_name = "bytes";
+#endif
+
+void minihdlc_encode_init(void)
+{
+#if MINIHDLC_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        stuff_kernel = stuff_avx2;
+        stuff_kernel_name = "avx2";
+    }
+#endif
+}
+
+/* Wrap given data in HDLC frame, clean blocks are copied whole */
+uint32_t minihdlc_encode(const uint8_t *frame_buffer, uint16_t frame_length,
+    uint8_t *out, uint32_t out_size)
+{
+    uint8_t *const out_start = out;
+    uint16_t fcs;
+
+    if (out_size < MINIHDLC_ENCODED_MAX(frame_length))
+    {
+        return 0;
+    }
+
+    /* One pass of the slicing-by-8 CRC over the whole payload */
+    fcs = checksum_crc_ccitt(CRC16_CCITT_INIT_VAL, frame_buffer, frame_length);
+
+    *out++ = FRAME_BOUNDARY_OCTET;
+    out = stuff_kernel(out, frame_buffer, frame_length);
+    out = put_escaped(out, (uint8_t) low(fcs));
+    out = put_escaped(out, (uint8_t) high(fcs));
+    *out++ = FRAME_BOUNDARY_OCTET;
+
+    return (uint32_t) (out - out_start);
+}
+
+const char *minihdlc_encode_kernel(void)
+{
+    return stuff_kernel_name;
+}
+
+/* Wrap given data in HDLC frame and send it to the link's buffer */
+void minihdlc_context_send_frame_to_buffer(minihdlc_context *ctx,
+    const uint8_t *frame_buffer, uint16_t frame_length)
+{
+    /* Frames longer than the receiver takes are not encoded, the buffer is left empty */
+    ctx->tx_buffer_size = minihdlc_encode(frame_buffer, frame_length, ctx->tx_buffer, sizeof(ctx->tx_buffer));
+}
+
+const uint8_t *minihdlc_context_get_buffer(const minihdlc_context *ctx)
+{
+    return ctx->tx_buffer;
+}
+
+uint32_t minihdlc_context_get_buffer_size(const minihdlc_context *ctx)
+{
+    return ctx->tx_buffer_size;
+}
+
+/* Single link API, the callbacks do not take the link */
+
+static void mhst_sendchar_bridge(minihdlc_context *ctx, uint8_t data)
+{
+    (void) ctx;
+    (*mhst_sendchar_function)(data);
+}
+
+static void mhst_frame_handler_bridge(minihdlc_context *ctx, const uint8_t *frame_buffer, uint16_t frame_length)
+{
+    (void) ctx;
+    (*mhst_frame_handler)(frame_buffer, frame_length);
+}
+
+void minihdlc_init(sendchar_type sendchar_function,
+        frame_handler_type frame_handler_function)
+{
+    mhst_sendchar_function = sendchar_function;
+    mhst_frame_handler = frame_handler_function;
+    minihdlc_context_init(&mhst, sendchar_function ? mhst_sendchar_bridge : NULL,
+        frame_handler_function ? mhst_frame_handler_bridge : NULL, NULL);
+}
+
+void minihdlc_char_receiver(uint8_t data)
+{
+    minihdlc_context_char_receiver(&mhst, data);
+}
+
+void minihdlc_receive(const uint8_t *data, size_t length)
+{
+    minihdlc_context_receive(&mhst, data, length);
+}
+
+void minihdlc_send_frame(const uint8_t *frame_buffer, uint16_t frame_length)
+{
+    minihdlc_context_send_frame(&mhst, frame_buffer, frame_length);
 }
 
 void minihdlc_send_frame_to_buffer(const uint8_t *frame_buffer,
     uint16_t frame_length)
 {
-	mhst.sendchar_function = buffer_push;
-	buffer_init();
-	minihdlc_send_frame(frame_buffer, frame_length);
+    minihdlc_context_send_frame_to_buffer(&mhst, frame_buffer, frame_length);
 }
 
-const uint8_t *minihdlc_get_buffer()
+const uint8_t *minihdlc_get_buffer(void)
 {
-	return frame_buffer;
+    return minihdlc_context_get_buffer(&mhst);
 }
 
 uint32_t minihdlc_get_buffer_size(void)
 {
-	return frame_buffer_size;
+    return minihdlc_context_get_buffer_size(&mhst);
 }
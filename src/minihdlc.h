@@ -0,0 +1,153 @@
+/**
+ * @file minihdlc.h
+ *
+ * HDLC-like asynchronous framing: 0x7E frame flags, 0x7D escapes and a
+ * CRC16-CCITT frame check sequence sent low byte first.
+ *
+ * Every link keeps its receive and transmit state in a minihdlc_context
+ * that the caller allocates, so any number of links can be framed at once,
+ * each from its own thread. The minihdlc_* functions without a context
+ * work on one built-in link.
+ */
+
+#ifndef MINIHDLC_H
+#define MINIHDLC_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Size of the receive buffer. A frame is received while its payload plus the
+ * two FCS bytes stay below it, longer frames are dropped.
+ */
+#ifndef MINIHDLC_MAX_FRAME_LENGTH
+#define MINIHDLC_MAX_FRAME_LENGTH 1536
+#endif
+
+/** Largest encoding of a payload: every byte and both FCS bytes escaped, two flags */
+#define MINIHDLC_ENCODED_MAX(payload_length) (2u * (uint32_t) (payload_length) + 6u)
+
+typedef struct minihdlc_context minihdlc_context;
+
+typedef void (*minihdlc_sendchar_type)(minihdlc_context *ctx, uint8_t data);
+typedef void (*minihdlc_frame_handler_type)(minihdlc_context *ctx,
+        const uint8_t *frame_buffer, uint16_t frame_length);
+
+/** State of one link. Fields are private, use the minihdlc_context_* functions */
+struct minihdlc_context
+{
+    minihdlc_sendchar_type sendchar_function;
+    minihdlc_frame_handler_type frame_handler;
+    void *userdata;             //!< for the callbacks, not touched by minihdlc
+    bool escape_character;
+    uint16_t frame_position;
+    uint8_t receive_frame_buffer[MINIHDLC_MAX_FRAME_LENGTH + 1];
+    uint32_t tx_buffer_size;
+    uint8_t tx_buffer[MINIHDLC_ENCODED_MAX(MINIHDLC_MAX_FRAME_LENGTH)];
+};
+
+/**
+ * Set up a link. Nothing is allocated. checksum_init() must have run before.
+ *
+ * @param ctx - link state
+ * @param sendchar_function - called for every byte minihdlc_context_send_frame() sends
+ * @param frame_handler_function - called with the payload of every valid frame
+ * @param userdata - stored in ctx->userdata
+ */
+void minihdlc_context_init(minihdlc_context *ctx,
+        minihdlc_sendchar_type sendchar_function,
+        minihdlc_frame_handler_type frame_handler_function, void *userdata);
+
+/** Feed one received byte to the link's deframer */
+void minihdlc_context_char_receiver(minihdlc_context *ctx, uint8_t data);
+
+/** Feed a received span to the link's deframer, see minihdlc_receive() */
+void minihdlc_context_receive(minihdlc_context *ctx, const uint8_t *data, size_t length);
+
+/** Frame a payload and send it through the link's sendchar function */
+void minihdlc_context_send_frame(minihdlc_context *ctx, const uint8_t *frame_buffer,
+    uint16_t frame_length);
+
+/** Frame a payload into the link's buffer, see minihdlc_send_frame_to_buffer() */
+void minihdlc_context_send_frame_to_buffer(minihdlc_context *ctx,
+    const uint8_t *frame_buffer, uint16_t frame_length);
+
+const uint8_t *minihdlc_context_get_buffer(const minihdlc_context *ctx);
+
+uint32_t minihdlc_context_get_buffer_size(const minihdlc_context *ctx);
+
+// Single link API, on a built-in context
+
+typedef void (*sendchar_type)(uint8_t data);
+typedef void (*frame_handler_type)(const uint8_t *frame_buffer, uint16_t frame_length);
+
+/**
+ * @param sendchar_function - called for every byte that goes out
+ * @param frame_handler_function - called with the payload of every valid frame
+ */
+void minihdlc_init(sendchar_type sendchar_function,
+        frame_handler_type frame_handler_function);
+
+/** Feed one received byte to the deframer */
+void minihdlc_char_receiver(uint8_t data);
+
+/**
+ * Feed a received span to the deframer, the same as minihdlc_char_receiver()
+ * for every byte. Flags and escapes are found with vector compares and the
+ * bytes between them are copied to the frame buffer as blocks.
+ */
+void minihdlc_receive(const uint8_t *data, size_t length);
+
+/** Frame a payload and send it through the sendchar function */
+void minihdlc_send_frame(const uint8_t *frame_buffer, uint16_t frame_length);
+
+/**
+ * Frame a payload into an internal buffer, read it back with
+ * minihdlc_get_buffer() and minihdlc_get_buffer_size(). Payloads longer
+ * than MINIHDLC_MAX_FRAME_LENGTH leave the buffer empty.
+ */
+void minihdlc_send_frame_to_buffer(const uint8_t *frame_buffer,
+    uint16_t frame_length);
+
+const uint8_t *minihdlc_get_buffer(void);
+
+uint32_t minihdlc_get_buffer_size(void);
+
+// Stateless, for any link
+
+/**
+ * Frame a payload into a caller supplied buffer in one go. Runs without
+ * 0x7E and 0x7D are found with vector compares and copied as blocks.
+ *
+ * @param frame_buffer - payload
+ * @param frame_length - payload length
+ * @param out - encoded frame, flags included
+ * @param out_size - must be at least MINIHDLC_ENCODED_MAX(frame_length)
+ * @return length of the encoded frame, 0 if out_size is too small
+ */
+uint32_t minihdlc_encode(const uint8_t *frame_buffer, uint16_t frame_length,
+    uint8_t *out, uint32_t out_size);
+
+/**
+ * Pick the escape scan kernel for the running CPU. Call it once at startup,
+ * from the main thread before any other thread starts, like checksum_init().
+ * Without it the kernel every CPU of the build target has is used.
+ */
+void minihdlc_encode_init(void);
+
+/**
+ * Name of the selected escape scan kernel, for logs and benchmarks
+ */
+const char *minihdlc_encode_kernel(void);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MINIHDLC_H
@@ -13,7 +13,6 @@ extern "C"
 #endif // __cplusplus
 
 #include <stdint.h>
-#include <stdio.h> // used by the TF_Error() macro defined below
 
 //----------------------------- FRAME FORMAT ---------------------------------
 // The format can be adjusted to fit your particular application needs
@@ -37,7 +36,10 @@ extern "C"
 //   TF_CKSUM_NONE, TF_CKSUM_XOR, TF_CKSUM_CRC8, TF_CKSUM_CRC16, TF_CKSUM_CRC32
 //   TF_CKSUM_CUSTOM8, TF_CKSUM_CUSTOM16, TF_CKSUM_CUSTOM32
 // Custom checksums require you to implement checksum functions (see TinyFrame.h)
+// Can be set from the build, the benchmarks compile TinyFrame once per type
+#ifndef TF_CKSUM_TYPE
 #define TF_CKSUM_TYPE TF_CKSUM_CRC16
+#endif
 
 // Use a SOF byte to mark the start of a frame
 #define TF_USE_SOF_BYTE 1
@@ -49,36 +51,57 @@ extern "C"
 // used for timeout tick counters - should be large enough for all used timeouts
 typedef uint16_t TF_TICKS;
 
-// used in loops iterating over listeners
-typedef uint8_t TF_COUNT;
+// used for listener slot numbers and counts, must hold the largest ID listener count
+typedef uint16_t TF_COUNT;
+
+// monotonic clock value used for deadlines (if TF_USE_DEADLINES == 1).
+// Must be an unsigned 32-bit type, wrap-around is handled.
+typedef uint32_t TF_TIME;
 
 //----------------------------- PARAMETERS ----------------------------------
 
-// Maximum received payload size (static buffer)
-// Larger payloads will be rejected.
+// Maximum received payload size (built-in buffer)
+// Larger payloads will be rejected. TF_ResizeBuffers() raises it at runtime.
 #define TF_MAX_PAYLOAD_RX 1024
 // Size of the sending buffer. Larger payloads will be split to pieces and sent
 // in multiple calls to the write function. This can be lowered to reduce RAM usage.
+// TF_ResizeBuffers() raises it at runtime.
 #define TF_SENDBUF_LEN    512
 
 // --- Listener counts - determine sizes of the static slot tables ---
 
-// Frame ID listeners (wait for response / multi-part message)
-#define TF_MAX_ID_LST   10
+// Frame ID listeners (wait for response / multi-part message), built-in slots.
+// A power of two. TF_ResizeIdListeners() adds more at runtime.
+#define TF_MAX_ID_LST   16
 // Frame Type listeners (wait for frame with a specific first payload byte)
 #define TF_MAX_TYPE_LST 10
 // Generic listeners (fallback if no other listener catches it)
 #define TF_MAX_GEN_LST  5
 
+// Bytes of a frame that failed its checksum which are parsed again, looking for
+// a frame that started inside it (e.g. after bytes were lost on the line).
+// A power of two, 0 to just wait for the next SOF. Needs TF_USE_SOF_BYTE.
+#define TF_RESYNC_LEN 64
+
 // Timeout for receiving & parsing a frame
-// ticks = number of calls to TF_Tick()
+// ticks = number of calls to TF_Tick(), or units of TF_GetTime() with deadlines
 #define TF_PARSER_TIMEOUT_TICKS 65535
 
+// Track timeouts as absolute deadlines on a monotonic clock instead of counting
+// TF_Tick() calls. Requires you to implement TF_GetTime(). TF_Tick() then only
+// has to be called when TF_NextDeadline() is due.
+#define TF_USE_DEADLINES 1
+
 // Whether to use mutex - requires you to implement TF_ClaimTx() and TF_ReleaseTx()
 #define TF_USE_MUTEX  0
 
-// Error reporting function. To disable debug, change to empty define
-#define TF_Error(format, ...) printf("[TF] " format "\n", ##__VA_ARGS__)
+// Tell the application where every frame ends - requires you to implement
+// TF_FrameEndImpl(). Needed by transports that wrap each frame, like HDLC.
+#define TF_USE_FRAME_END 1
+
+// Error reporting - requires you to implement TF_ErrorImpl(). To disable debug,
+// change to empty define
+#define TF_Error(format, ...) TF_ErrorImpl("[TF] " format, ##__VA_ARGS__)
 
 //------------------------- End of user config ------------------------------
 
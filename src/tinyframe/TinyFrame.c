@@ -1,5 +1,6 @@
 //---------------------------------------------------------------------------
 #include "TinyFrame.h"
+#include "checksum/checksum.h" // block checksum kernels
 #include <stdlib.h> // - for malloc() if dynamic constructor is used
 //---------------------------------------------------------------------------
 
@@ -20,6 +21,12 @@
 #define TF_ID_MASK (TF_ID)(((TF_ID)1 << (sizeof(TF_ID)*8 - 1)) - 1)
 #define TF_ID_PEERBIT (TF_ID)((TF_ID)1 << ((sizeof(TF_ID)*8) - 1))
 
+// No slot / not in the deadline heap
+#define TF_COUNT_NONE ((TF_COUNT) ~(TF_COUNT) 0)
+
+// Most ID index buckets worth having: one per frame ID, and within TF_COUNT
+#define TF_ID_INDEX_MAX (sizeof(TF_ID) == 1 ? 256u : (TF_COUNT_NONE / 2u + 1u))
+
 
 #if !TF_USE_MUTEX
     // Not thread safe lock implementation, used if user did not provide a better one.
@@ -201,8 +208,34 @@
 
 #endif
 
+/** Add a block of bytes to a checksum */
+static inline TF_CKSUM TF_CksumAddBlock(TF_CKSUM cksum, const uint8_t *data, uint32_t len)
+{
+#if TF_CKSUM_TYPE == TF_CKSUM_NONE
+    (void)data;
+    (void)len;
+    return cksum;
+#elif TF_CKSUM_TYPE == TF_CKSUM_XOR
+    return checksum_xor(cksum, data, len);
+#elif TF_CKSUM_TYPE == TF_CKSUM_CRC8
+    return checksum_crc8(cksum, data, len);
+#elif TF_CKSUM_TYPE == TF_CKSUM_CRC16
+    return checksum_crc16(cksum, data, len);
+#elif TF_CKSUM_TYPE == TF_CKSUM_CRC32
+    return checksum_crc32(cksum, data, len);
+#else
+    // Custom checksums are only known byte by byte
+    uint32_t i;
+    for (i = 0; i < len; i++) {
+        cksum = TF_CksumAdd(cksum, data[i]);
+    }
+    return cksum;
+#endif
+}
+
 #define CKSUM_RESET(cksum)     do { (cksum) = TF_CksumStart(); } while (0)
 #define CKSUM_ADD(cksum, byte) do { (cksum) = TF_CksumAdd((cksum), (byte)); } while (0)
+#define CKSUM_ADD_BLOCK(cksum, data, len) do { (cksum) = TF_CksumAddBlock((cksum), (data), (len)); } while (0)
 #define CKSUM_FINALIZE(cksum)  do { (cksum) = TF_CksumEnd((cksum)); } while (0)
 
 //endregion
@@ -210,6 +243,32 @@
 
 //region Init
 
+/** Chain the free ID listener slots, the lowest first */
+static void _TF_FN id_free_rebuild(TinyFrame *tf)
+{
+    TF_COUNT i = tf->max_id_lst;
+
+    tf->id_free = 0;
+    while (i-- > 0) {
+        if (tf->id_listeners[i].fn == NULL) {
+            tf->id_listeners[i].next = tf->id_free;
+            tf->id_free = (TF_COUNT) (i + 1);
+        }
+    }
+}
+
+/** Free ID listener slots allocated by TF_ResizeIdListeners() */
+static void _TF_FN id_listeners_release(TinyFrame *tf)
+{
+    if (tf->id_listeners != tf->id_listeners_builtin) {
+        free(tf->id_listeners);
+        free(tf->id_index);
+#if TF_USE_DEADLINES
+        free(tf->deadline_heap);
+#endif
+    }
+}
+
 /** Init with a user-allocated buffer */
 bool _TF_FN TF_InitStatic(TinyFrame *tf, TF_Peer peer_bit)
 {
@@ -227,6 +286,20 @@ bool _TF_FN TF_InitStatic(TinyFrame *tf, TF_Peer peer_bit)
     tf->usertag = usertag;
     tf->userdata = userdata;
 
+    tf->data = tf->data_builtin;
+    tf->max_payload_rx = TF_MAX_PAYLOAD_RX;
+    tf->sendbuf = tf->sendbuf_builtin;
+    tf->sendbuf_len = TF_SENDBUF_LEN;
+
+    tf->id_listeners = tf->id_listeners_builtin;
+    tf->id_index = tf->id_index_builtin;
+    tf->max_id_lst = TF_MAX_ID_LST;
+    tf->id_index_mask = (TF_COUNT) (TF_MIN(TF_MAX_ID_LST, TF_ID_INDEX_MAX) - 1);
+#if TF_USE_DEADLINES
+    tf->deadline_heap = tf->deadline_heap_builtin;
+#endif
+    id_free_rebuild(tf);
+
     tf->peer_bit = peer_bit;
     return true;
 }
@@ -248,18 +321,262 @@ TinyFrame * _TF_FN TF_Init(TF_Peer peer_bit)
 void TF_DeInit(TinyFrame *tf)
 {
     if (tf == NULL) return;
+    TF_ResizeBuffers(tf, 0, 0);
+    id_listeners_release(tf);
     free(tf);
 }
 
+/** Swap the receive and transmit buffers for ones of another size */
+bool _TF_FN TF_ResizeBuffers(TinyFrame *tf, TF_LEN max_payload_rx, uint32_t sendbuf_len)
+{
+    uint8_t *data = tf->data_builtin;
+    uint8_t *sendbuf = tf->sendbuf_builtin;
+
+#if !TF_USE_MUTEX
+    if (tf->soft_lock) {
+        TF_Error("TF_ResizeBuffers() while sending a frame");
+        return false;
+    }
+#endif
+
+    if (max_payload_rx > TF_MAX_PAYLOAD_RX) {
+        data = (max_payload_rx == tf->max_payload_rx) ? tf->data : malloc(max_payload_rx);
+    } else {
+        max_payload_rx = TF_MAX_PAYLOAD_RX;
+    }
+
+    if (sendbuf_len > TF_SENDBUF_LEN) {
+        sendbuf = (sendbuf_len == tf->sendbuf_len) ? tf->sendbuf : malloc(sendbuf_len);
+    } else {
+        sendbuf_len = TF_SENDBUF_LEN;
+    }
+
+    if (data == NULL || sendbuf == NULL) {
+        if (data != NULL && data != tf->data && data != tf->data_builtin) free(data);
+        if (sendbuf != NULL && sendbuf != tf->sendbuf && sendbuf != tf->sendbuf_builtin) free(sendbuf);
+        TF_Error("TF_ResizeBuffers() failed, out of memory.");
+        return false;
+    }
+
+    if (tf->data != data && tf->data != tf->data_builtin) free(tf->data);
+    if (tf->sendbuf != sendbuf && tf->sendbuf != tf->sendbuf_builtin) free(tf->sendbuf);
+
+    tf->data = data;
+    tf->max_payload_rx = max_payload_rx;
+    tf->sendbuf = sendbuf;
+    tf->sendbuf_len = sendbuf_len;
+
+    // A frame collected so far may not fit the new buffer
+    TF_ResetParser(tf);
+    return true;
+}
+
+/** Move the ID listeners to a table with another number of slots */
+bool _TF_FN TF_ResizeIdListeners(TinyFrame *tf, TF_COUNT count)
+{
+    struct TF_IdListener_ *listeners = tf->id_listeners_builtin;
+    TF_COUNT *index = tf->id_index_builtin;
+#if TF_USE_DEADLINES
+    TF_COUNT *heap = tf->deadline_heap_builtin;
+#endif
+    uint32_t buckets = TF_MAX_ID_LST;
+    TF_COUNT bucket, link, i;
+    TF_COUNT *tail;
+
+    if (count < TF_MAX_ID_LST) count = TF_MAX_ID_LST;
+    if (count == tf->max_id_lst) return true;
+
+    // Listeners keep their slot numbers, the deadline heap refers to them
+    for (i = count; i < tf->max_id_lst; i++) {
+        if (tf->id_listeners[i].fn != NULL) {
+            TF_Error("TF_ResizeIdListeners() failed, slot %d is in use", (int)i);
+            return false;
+        }
+    }
+
+    if (count > TF_MAX_ID_LST) {
+        while (buckets < count) buckets *= 2;
+        listeners = malloc(count * sizeof(struct TF_IdListener_));
+        index = malloc(TF_MIN(buckets, TF_ID_INDEX_MAX) * sizeof(TF_COUNT));
+#if TF_USE_DEADLINES
+        heap = malloc(count * sizeof(TF_COUNT));
+        if (heap == NULL) {
+            free(listeners);
+            listeners = NULL;
+        }
+#endif
+        if (listeners == NULL || index == NULL) {
+            free(listeners);
+            free(index);
+#if TF_USE_DEADLINES
+            free(heap);
+#endif
+            TF_Error("TF_ResizeIdListeners() failed, out of memory.");
+            return false;
+        }
+    }
+    buckets = TF_MIN(buckets, TF_ID_INDEX_MAX);
+
+    memset(listeners, 0, count * sizeof(struct TF_IdListener_));
+    memcpy(listeners, tf->id_listeners, TF_MIN(count, tf->max_id_lst) * sizeof(struct TF_IdListener_));
+    memset(index, 0, buckets * sizeof(TF_COUNT));
+#if TF_USE_DEADLINES
+    memcpy(heap, tf->deadline_heap, tf->count_deadline_heap * sizeof(TF_COUNT));
+#endif
+
+    // Rebuild the buckets, walking the old ones keeps the registration order
+    for (bucket = 0; bucket <= tf->id_index_mask; bucket++) {
+        for (link = tf->id_index[bucket]; link != 0; link = tf->id_listeners[link - 1].next) {
+            tail = &index[listeners[link - 1].id & (buckets - 1)];
+            while (*tail != 0) tail = &listeners[*tail - 1].next;
+            *tail = link;
+            listeners[link - 1].next = 0;
+        }
+    }
+
+    id_listeners_release(tf);
+
+    tf->id_listeners = listeners;
+    tf->id_index = index;
+    tf->max_id_lst = count;
+    tf->id_index_mask = (TF_COUNT) (buckets - 1);
+#if TF_USE_DEADLINES
+    tf->deadline_heap = heap;
+#endif
+    id_free_rebuild(tf);
+    return true;
+}
+
 //endregion Init
 
 
 //region Listeners
 
+#if TF_USE_DEADLINES
+
+// Deadline heap - ID listener slots with a timeout, the earliest deadline on top.
+// Comparisons use the signed difference, so the clock may wrap around.
+#define TF_DEADLINE_BEFORE(a, b) ((int32_t) ((TF_TIME) ((a) - (b))) < 0)
+
+/** Deadline of the listener at a heap position */
+static inline TF_TIME _TF_FN heap_deadline(TinyFrame *tf, TF_COUNT pos)
+{
+    return tf->id_listeners[tf->deadline_heap[pos]].deadline;
+}
+
+/** Put a listener slot at a heap position */
+static inline void _TF_FN heap_place(TinyFrame *tf, TF_COUNT pos, TF_COUNT slot)
+{
+    tf->deadline_heap[pos] = slot;
+    tf->id_listeners[slot].heap_pos = pos;
+}
+
+/** Move the entry at pos up or down until the heap order holds */
+static void _TF_FN heap_fix(TinyFrame *tf, TF_COUNT pos)
+{
+    TF_COUNT slot = tf->deadline_heap[pos];
+    TF_TIME deadline = tf->id_listeners[slot].deadline;
+    TF_COUNT parent, child;
+
+    while (pos > 0) {
+        parent = (TF_COUNT) ((pos - 1) / 2);
+        if (!TF_DEADLINE_BEFORE(deadline, heap_deadline(tf, parent))) break;
+        heap_place(tf, pos, tf->deadline_heap[parent]);
+        pos = parent;
+    }
+
+    while (1) {
+        child = (TF_COUNT) (2 * pos + 1);
+        if (child >= tf->count_deadline_heap) break;
+        if (child + 1 < tf->count_deadline_heap &&
+            TF_DEADLINE_BEFORE(heap_deadline(tf, child + 1), heap_deadline(tf, child))) {
+            child++;
+        }
+        if (!TF_DEADLINE_BEFORE(heap_deadline(tf, child), deadline)) break;
+        heap_place(tf, pos, tf->deadline_heap[child]);
+        pos = child;
+    }
+
+    heap_place(tf, pos, slot);
+}
+
+/** Remove a listener slot from the heap, if it's there */
+static void _TF_FN heap_remove(TinyFrame *tf, TF_COUNT slot)
+{
+    TF_COUNT pos = tf->id_listeners[slot].heap_pos;
+    TF_COUNT last;
+
+    if (pos == TF_COUNT_NONE) return;
+    tf->id_listeners[slot].heap_pos = TF_COUNT_NONE;
+
+    last = --tf->count_deadline_heap;
+    if (pos != last) {
+        heap_place(tf, pos, tf->deadline_heap[last]);
+        heap_fix(tf, pos);
+    }
+}
+
+/** (Re)start the listener's timeout, counting from now */
+static void _TF_FN heap_schedule(TinyFrame *tf, TF_COUNT slot)
+{
+    struct TF_IdListener_ *lst = &tf->id_listeners[slot];
+
+    if (lst->timeout_max == 0) return;
+
+    lst->deadline = TF_GetTime(tf) + lst->timeout_max;
+    if (lst->heap_pos == TF_COUNT_NONE) {
+        heap_place(tf, tf->count_deadline_heap++, slot);
+    }
+    heap_fix(tf, lst->heap_pos);
+}
+
+#endif // TF_USE_DEADLINES
+
 /** Reset ID listener's timeout to the original value */
-static inline void _TF_FN renew_id_listener(struct TF_IdListener_ *lst)
+static inline void _TF_FN renew_id_listener(TinyFrame *tf, TF_COUNT i, struct TF_IdListener_ *lst)
 {
     lst->timeout = lst->timeout_max;
+#if TF_USE_DEADLINES
+    heap_schedule(tf, i);
+#else
+    (void)tf;
+    (void)i;
+#endif
+}
+
+/** Index bucket of a frame ID, the chain of listener slots starts there */
+static inline TF_COUNT * _TF_FN id_bucket(TinyFrame *tf, TF_ID id)
+{
+    return &tf->id_index[id & tf->id_index_mask];
+}
+
+/** Slot of the first ID listener for a frame ID, TF_COUNT_NONE if there is none */
+static TF_COUNT _TF_FN id_find(TinyFrame *tf, TF_ID id)
+{
+    TF_COUNT link = *id_bucket(tf, id);
+
+    while (link != 0) {
+        if (tf->id_listeners[link - 1].id == id) return (TF_COUNT) (link - 1);
+        link = tf->id_listeners[link - 1].next;
+    }
+
+    return TF_COUNT_NONE;
+}
+
+/** Take the slot out of its bucket and put it on the free list */
+static void _TF_FN id_unlink(TinyFrame *tf, TF_COUNT i, struct TF_IdListener_ *lst)
+{
+    TF_COUNT *link = id_bucket(tf, lst->id);
+
+    while (*link != i + 1) {
+        link = &tf->id_listeners[*link - 1].next;
+    }
+    *link = lst->next;
+
+    lst->fn = NULL;
+    lst->next = tf->id_free;
+    tf->id_free = (TF_COUNT) (i + 1);
+    tf->count_id_lst--;
 }
 
 /** Notify callback about ID listener's demise & let it free any resources in userdata */
@@ -268,6 +585,10 @@ static void _TF_FN cleanup_id_listener(TinyFrame *tf, TF_COUNT i, struct TF_IdLi
     TF_Msg msg;
     if (lst->fn == NULL) return;
 
+#if TF_USE_DEADLINES
+    heap_remove(tf, i);
+#endif
+
     // Make user clean up their data - only if not NULL
     if (lst->userdata != NULL || lst->userdata2 != NULL) {
         msg.userdata = lst->userdata;
@@ -276,20 +597,26 @@ static void _TF_FN cleanup_id_listener(TinyFrame *tf, TF_COUNT i, struct TF_IdLi
         lst->fn(tf, &msg); // return value is ignored here - use TF_STAY or TF_CLOSE
     }
 
-    lst->fn = NULL; // Discard listener
+    id_unlink(tf, i, lst); // Discard listener
+}
 
-    if (i == tf->count_id_lst - 1) {
-        tf->count_id_lst--;
-    }
+/** Index bucket of a frame type */
+static inline TF_COUNT * _TF_FN type_bucket(TinyFrame *tf, TF_TYPE type)
+{
+    return &tf->type_index[type & (TF_TYPE_INDEX_LEN - 1)];
 }
 
 /** Clean up Type listener */
 static inline void _TF_FN cleanup_type_listener(TinyFrame *tf, TF_COUNT i, struct TF_TypeListener_ *lst)
 {
-    lst->fn = NULL; // Discard listener
-    if (i == tf->count_type_lst - 1) {
-        tf->count_type_lst--;
+    TF_COUNT *link = type_bucket(tf, lst->type);
+
+    while (*link != i + 1) {
+        link = &tf->type_listeners[*link - 1].next;
     }
+    *link = lst->next;
+
+    lst->fn = NULL; // Discard listener
 }
 
 /** Clean up Generic listener */
@@ -305,31 +632,45 @@ static inline void _TF_FN cleanup_generic_listener(TinyFrame *tf, TF_COUNT i, st
 bool _TF_FN TF_AddIdListener(TinyFrame *tf, TF_Msg *msg, TF_Listener cb, TF_TICKS timeout)
 {
     TF_COUNT i;
+    TF_COUNT *link;
     struct TF_IdListener_ *lst;
-    for (i = 0; i < TF_MAX_ID_LST; i++) {
-        lst = &tf->id_listeners[i];
-        // test for empty slot
-        if (lst->fn == NULL) {
-            lst->fn = cb;
-            lst->id = msg->frame_id;
-            lst->userdata = msg->userdata;
-            lst->userdata2 = msg->userdata2;
-            lst->timeout_max = lst->timeout = timeout;
-            if (i >= tf->count_id_lst) {
-                tf->count_id_lst = (TF_COUNT) (i + 1);
-            }
-            return true;
-        }
+
+    if (tf->id_free == 0) {
+        TF_Error("Failed to add ID listener");
+        return false;
     }
 
-    TF_Error("Failed to add ID listener");
-    return false;
+    i = (TF_COUNT) (tf->id_free - 1);
+    lst = &tf->id_listeners[i];
+    tf->id_free = lst->next;
+
+    lst->fn = cb;
+    lst->id = msg->frame_id;
+    lst->next = 0;
+    lst->userdata = msg->userdata;
+    lst->userdata2 = msg->userdata2;
+    lst->timeout_max = lst->timeout = timeout;
+
+    // Appended, so listeners on the same ID see frames in registration order
+    link = id_bucket(tf, lst->id);
+    while (*link != 0) {
+        link = &tf->id_listeners[*link - 1].next;
+    }
+    *link = (TF_COUNT) (i + 1);
+    tf->count_id_lst++;
+
+#if TF_USE_DEADLINES
+    lst->heap_pos = TF_COUNT_NONE;
+    heap_schedule(tf, i);
+#endif
+    return true;
 }
 
 /** Add a new Type listener. Returns 1 on success. */
 bool _TF_FN TF_AddTypeListener(TinyFrame *tf, TF_TYPE frame_type, TF_Listener cb)
 {
     TF_COUNT i;
+    TF_COUNT *link;
     struct TF_TypeListener_ *lst;
     for (i = 0; i < TF_MAX_TYPE_LST; i++) {
         lst = &tf->type_listeners[i];
@@ -337,9 +678,14 @@ bool _TF_FN TF_AddTypeListener(TinyFrame *tf, TF_TYPE frame_type, TF_Listener cb
         if (lst->fn == NULL) {
             lst->fn = cb;
             lst->type = frame_type;
-            if (i >= tf->count_type_lst) {
-                tf->count_type_lst = (TF_COUNT) (i + 1);
+
+            // Buckets are kept in slot order, the order listeners were always tried in
+            link = type_bucket(tf, frame_type);
+            while (*link != 0 && *link < i + 1) {
+                link = &tf->type_listeners[*link - 1].next;
             }
+            lst->next = *link;
+            *link = (TF_COUNT) (i + 1);
             return true;
         }
     }
@@ -372,15 +718,11 @@ bool _TF_FN TF_AddGenericListener(TinyFrame *tf, TF_Listener cb)
 /** Remove a ID listener by its frame ID. Returns 1 on success. */
 bool _TF_FN TF_RemoveIdListener(TinyFrame *tf, TF_ID frame_id)
 {
-    TF_COUNT i;
-    struct TF_IdListener_ *lst;
-    for (i = 0; i < tf->count_id_lst; i++) {
-        lst = &tf->id_listeners[i];
-        // test if live & matching
-        if (lst->fn != NULL && lst->id == frame_id) {
-            cleanup_id_listener(tf, i, lst);
-            return true;
-        }
+    TF_COUNT i = id_find(tf, frame_id);
+
+    if (i != TF_COUNT_NONE) {
+        cleanup_id_listener(tf, i, &tf->id_listeners[i]);
+        return true;
     }
 
     TF_Error("ID listener %d to remove not found", (int)frame_id);
@@ -390,15 +732,14 @@ bool _TF_FN TF_RemoveIdListener(TinyFrame *tf, TF_ID frame_id)
 /** Remove a type listener by its type. Returns 1 on success. */
 bool _TF_FN TF_RemoveTypeListener(TinyFrame *tf, TF_TYPE type)
 {
-    TF_COUNT i;
-    struct TF_TypeListener_ *lst;
-    for (i = 0; i < tf->count_type_lst; i++) {
-        lst = &tf->type_listeners[i];
-        // test if live & matching
-        if (lst->fn != NULL    && lst->type == type) {
-            cleanup_type_listener(tf, i, lst);
+    TF_COUNT link = *type_bucket(tf, type);
+
+    while (link != 0) {
+        if (tf->type_listeners[link - 1].type == type) {
+            cleanup_type_listener(tf, (TF_COUNT) (link - 1), &tf->type_listeners[link - 1]);
             return true;
         }
+        link = tf->type_listeners[link - 1].next;
     }
 
     TF_Error("Type listener %d to remove not found", (int)type);
@@ -426,7 +767,7 @@ bool _TF_FN TF_RemoveGenericListener(TinyFrame *tf, TF_Listener cb)
 /** Handle a message that was just collected & verified by the parser */
 static void _TF_FN TF_HandleReceivedMessage(TinyFrame *tf)
 {
-    TF_COUNT i;
+    TF_COUNT i, link;
     struct TF_IdListener_ *ilst;
     struct TF_TypeListener_ *tlst;
     struct TF_GenericListener_ *glst;
@@ -443,12 +784,12 @@ static void _TF_FN TF_HandleReceivedMessage(TinyFrame *tf)
 
     // Any listener can consume the message, or let someone else handle it.
 
-    // The loop upper bounds are the highest currently used slot index
-    // (or close to it, depending on the order of listener removals).
-
-    // ID listeners first
-    for (i = 0; i < tf->count_id_lst; i++) {
+    // ID listeners first, only the bucket of the frame ID is walked
+    link = *id_bucket(tf, msg.frame_id);
+    while (link != 0) {
+        i = (TF_COUNT) (link - 1);
         ilst = &tf->id_listeners[i];
+        link = ilst->next;
 
         if (ilst->fn && ilst->id == msg.frame_id) {
             msg.userdata = ilst->userdata; // pass userdata pointer to the callback
@@ -460,7 +801,7 @@ static void _TF_FN TF_HandleReceivedMessage(TinyFrame *tf)
             if (res != TF_NEXT) {
                 // if it's TF_CLOSE, we assume user already cleaned up userdata
                 if (res == TF_RENEW) {
-                    renew_id_listener(ilst);
+                    renew_id_listener(tf, i, ilst);
                 }
                 else if (res == TF_CLOSE) {
                     // Set userdata to NULL to avoid calling user for cleanup
@@ -477,9 +818,12 @@ static void _TF_FN TF_HandleReceivedMessage(TinyFrame *tf)
     msg.userdata = NULL;
     msg.userdata2 = NULL;
 
-    // Type listeners
-    for (i = 0; i < tf->count_type_lst; i++) {
+    // Type listeners, the bucket holds the types with the same low byte
+    link = *type_bucket(tf, msg.type);
+    while (link != 0) {
+        i = (TF_COUNT) (link - 1);
         tlst = &tf->type_listeners[i];
+        link = tlst->next;
 
         if (tlst->fn && tlst->type == msg.type) {
             res = tlst->fn(tf, &msg);
@@ -525,15 +869,11 @@ static void _TF_FN TF_HandleReceivedMessage(TinyFrame *tf)
 /** Externally renew an ID listener */
 bool _TF_FN TF_RenewIdListener(TinyFrame *tf, TF_ID id)
 {
-    TF_COUNT i;
-    struct TF_IdListener_ *lst;
-    for (i = 0; i < tf->count_id_lst; i++) {
-        lst = &tf->id_listeners[i];
-        // test if live & matching
-        if (lst->fn != NULL && lst->id == id) {
-            renew_id_listener(lst);
-            return true;
-        }
+    TF_COUNT i = id_find(tf, id);
+
+    if (i != TF_COUNT_NONE) {
+        renew_id_listener(tf, i, &tf->id_listeners[i]);
+        return true;
     }
 
     TF_Error("Renew listener: not found (id %d)", (int)id);
@@ -545,15 +885,6 @@ bool _TF_FN TF_RenewIdListener(TinyFrame *tf, TF_ID id)
 
 //region Parser
 
-/** Handle a received byte buffer */
-void _TF_FN TF_Accept(TinyFrame *tf, const uint8_t *buffer, uint32_t count)
-{
-    uint32_t i;
-    for (i = 0; i < count; i++) {
-        TF_AcceptChar(tf, buffer[i]);
-    }
-}
-
 /** Reset the parser's internal state. */
 void _TF_FN TF_ResetParser(TinyFrame *tf)
 {
@@ -570,24 +901,137 @@ static void _TF_FN pars_begin_frame(TinyFrame *tf) {
 #endif
 
     tf->discard_data = false;
+#if TF_RESYNC
+    tf->resync_head_len = 0;
+#endif
 
     // Enter ID state
     tf->state = TFState_ID;
     tf->rxi = 0;
 }
 
-/** Handle a received char - here's the main state machine */
-void _TF_FN TF_AcceptChar(TinyFrame *tf, unsigned char c)
+#if TF_RESYNC
+/** Append a part of the failed frame to the replay, once the first skip bytes are dropped */
+static uint32_t _TF_FN pars_replay_add(uint8_t *replay, uint32_t count,
+                                       const uint8_t *part, uint32_t len, uint32_t *skip)
 {
-    // Parser timeout - clear
-    if (tf->parser_timeout_ticks >= TF_PARSER_TIMEOUT_TICKS) {
-        if (tf->state != TFState_SOF) {
-            TF_ResetParser(tf);
-            TF_Error("Parser timeout");
+    uint32_t drop = TF_MIN(*skip, len);
+
+    *skip -= drop;
+    memcpy(replay + count, part + drop, len - drop);
+    return count + len - drop;
+}
+
+static void _TF_FN pars_char(TinyFrame *tf, uint8_t c);
+
+/**
+ * A frame failed its checksum. If bytes were lost, the next frame may have
+ * started inside it, so the last TF_RESYNC_LEN bytes after its SOF are parsed
+ * again. A frame found there that fails too is rescanned from past its own SOF.
+ *
+ * @param body - the payload and its checksum were received, not only the header
+ */
+static void _TF_FN pars_resync(TinyFrame *tf, bool body)
+{
+    uint8_t replay[TF_RESYNC_LEN];
+    uint8_t tail[sizeof(TF_CKSUM)];
+    uint32_t total = tf->resync_head_len;
+    uint32_t skip;
+    uint32_t count = 0;
+    uint32_t start = 0;
+    uint32_t i;
+
+    TF_ResetParser(tf);
+
+    if (tf->resync_active) {
+        // Failed inside the replay, the replay loop below rewinds
+        tf->resync_failed = true;
+        return;
+    }
+
+    // The payload is still in the data buffer, the checksum after it in ref_cksum
+    if (body) {
+        for (i = 0; i < sizeof(TF_CKSUM); i++) {
+            tail[i] = (uint8_t) (tf->ref_cksum >> (8 * (sizeof(TF_CKSUM) - 1 - i)));
         }
+        total += (uint32_t) tf->len + sizeof(TF_CKSUM);
+    }
+
+    // Copied out, the new frames are parsed into the same buffers
+    skip = (total > TF_RESYNC_LEN) ? total - TF_RESYNC_LEN : 0;
+    count = pars_replay_add(replay, count, tf->resync_head, tf->resync_head_len, &skip);
+    if (body) {
+        count = pars_replay_add(replay, count, tf->data, tf->len, &skip);
+        count = pars_replay_add(replay, count, tail, sizeof(TF_CKSUM), &skip);
+    }
+
+    tf->resync_active = true;
+    for (i = 0; i < count; i++) {
+        if (tf->state == TFState_SOF) {
+            start = i;
+        }
+
+        pars_char(tf, replay[i]);
+
+        if (tf->resync_failed) {
+            tf->resync_failed = false;
+            i = start;
+        }
+    }
+    tf->resync_active = false;
+}
+#endif
+
+/**
+ * Collect a run of payload bytes.
+ * The run must not be longer than what remains of the payload.
+ */
+static void _TF_FN pars_data_block(TinyFrame *tf, const uint8_t *data, uint32_t count)
+{
+    if (!tf->discard_data) {
+        memcpy(&tf->data[tf->rxi], data, count);
+        CKSUM_ADD_BLOCK(tf->cksum, data, count);
+    }
+    tf->rxi = (TF_LEN) (tf->rxi + count);
+
+    if (tf->rxi == tf->len) {
+        #if TF_CKSUM_TYPE == TF_CKSUM_NONE
+            // All done
+            TF_HandleReceivedMessage(tf);
+            TF_ResetParser(tf);
+        #else
+            // Enter DATA_CKSUM state
+            tf->state = TFState_DATA_CKSUM;
+            tf->rxi = 0;
+            tf->ref_cksum = 0;
+        #endif
     }
+}
+
+/** Reset a partial frame if the line was silent for too long. Done once per received block. */
+static void _TF_FN pars_check_timeout(TinyFrame *tf)
+{
+    bool expired;
+
+#if TF_USE_DEADLINES
+    TF_TIME now = TF_GetTime(tf);
+    expired = (TF_TIME) (now - tf->parser_last_rx) >= TF_PARSER_TIMEOUT_TICKS;
+    tf->parser_last_rx = now;
+#else
+    expired = tf->parser_timeout_ticks >= TF_PARSER_TIMEOUT_TICKS;
     tf->parser_timeout_ticks = 0;
+#endif
+
+    // Parser timeout - clear
+    if (expired && tf->state != TFState_SOF) {
+        TF_ResetParser(tf);
+        TF_Error("Parser timeout");
+    }
+}
 
+/** Handle a received char - here's the main state machine */
+static void _TF_FN pars_char(TinyFrame *tf, uint8_t c)
+{
 // DRY snippet - collect multi-byte number from the input stream, byte by byte
 // This is a little dirty, but makes the code easier to read. It's used like e.g. if(),
 // the body is run only after the entire number (of data type 'type') was received
@@ -601,6 +1045,13 @@ void _TF_FN TF_AcceptChar(TinyFrame *tf, unsigned char c)
     }
 #endif
 
+#if TF_RESYNC
+    // The header states all come before TFState_DATA
+    if (tf->state != TFState_SOF && tf->state < TFState_DATA) {
+        tf->resync_head[tf->resync_head_len++] = c;
+    }
+#endif
+
     //@formatter:off
     switch (tf->state) {
         case TFState_SOF:
@@ -649,7 +1100,11 @@ void _TF_FN TF_AcceptChar(TinyFrame *tf, unsigned char c)
 
                 if (tf->cksum != tf->ref_cksum) {
                     TF_Error("Rx head cksum mismatch");
+#if TF_RESYNC
+                    pars_resync(tf, false);
+#else
                     TF_ResetParser(tf);
+#endif
                     break;
                 }
 
@@ -666,7 +1121,7 @@ void _TF_FN TF_AcceptChar(TinyFrame *tf, unsigned char c)
 
                 CKSUM_RESET(tf->cksum); // Start collecting the payload
 
-                if (tf->len > TF_MAX_PAYLOAD_RX) {
+                if (tf->len > tf->max_payload_rx) {
                     TF_Error("Rx payload too long: %d", (int)tf->len);
                     // ERROR - frame too long. Consume, but do not store.
                     tf->discard_data = true;
@@ -675,25 +1130,7 @@ void _TF_FN TF_AcceptChar(TinyFrame *tf, unsigned char c)
             break;
 
         case TFState_DATA:
-            if (tf->discard_data) {
-                tf->rxi++;
-            } else {
-                CKSUM_ADD(tf->cksum, c);
-                tf->data[tf->rxi++] = c;
-            }
-
-            if (tf->rxi == tf->len) {
-                #if TF_CKSUM_TYPE == TF_CKSUM_NONE
-                    // All done
-                    TF_HandleReceivedMessage(tf);
-                    TF_ResetParser(tf);
-                #else
-                    // Enter DATA_CKSUM state
-                    tf->state = TFState_DATA_CKSUM;
-                    tf->rxi = 0;
-                    tf->ref_cksum = 0;
-                #endif
-            }
+            pars_data_block(tf, &c, 1);
             break;
 
         case TFState_DATA_CKSUM:
@@ -705,6 +1142,10 @@ void _TF_FN TF_AcceptChar(TinyFrame *tf, unsigned char c)
                         TF_HandleReceivedMessage(tf);
                     } else {
                         TF_Error("Body cksum mismatch");
+#if TF_RESYNC
+                        pars_resync(tf, true);
+                        break;
+#endif
                     }
                 }
 
@@ -715,6 +1156,37 @@ void _TF_FN TF_AcceptChar(TinyFrame *tf, unsigned char c)
     //@formatter:on
 }
 
+/** Handle a received char */
+void _TF_FN TF_AcceptChar(TinyFrame *tf, unsigned char c)
+{
+    pars_check_timeout(tf);
+    pars_char(tf, c);
+}
+
+/** Handle a received byte buffer */
+void _TF_FN TF_Accept(TinyFrame *tf, const uint8_t *buffer, uint32_t count)
+{
+    uint32_t i = 0;
+    uint32_t chunk;
+
+    if (count == 0) return;
+
+    pars_check_timeout(tf);
+
+    while (i < count) {
+        // Payload fast path - once the header is validated, take as much of the body
+        // as is available in one go. Everything else is parsed byte by byte.
+        if (tf->state == TFState_DATA) {
+            chunk = TF_MIN((uint32_t) (tf->len - tf->rxi), count - i);
+            pars_data_block(tf, buffer + i, chunk);
+            i += chunk;
+        }
+        else {
+            pars_char(tf, buffer[i++]);
+        }
+    }
+}
+
 //endregion Parser
 
 
@@ -826,17 +1298,10 @@ static inline uint32_t _TF_FN TF_ComposeBody(uint8_t *outbuff,
                                     const uint8_t *data, TF_LEN data_len,
                                     TF_CKSUM *cksum)
 {
-    TF_LEN i = 0;
-    uint8_t b = 0;
-    uint32_t pos = 0;
-
-    for (i = 0; i < data_len; i++) {
-        b = data[i];
-        outbuff[pos++] = b;
-        CKSUM_ADD(*cksum, b);
-    }
+    memcpy(outbuff, data, data_len);
+    CKSUM_ADD_BLOCK(*cksum, data, data_len);
 
-    return pos;
+    return data_len;
 }
 
 /**
@@ -903,13 +1368,13 @@ static void _TF_FN TF_SendFrame_Chunk(TinyFrame *tf, const uint8_t *buff, uint32
     remain = length;
     while (remain > 0) {
         // Write what can fit in the tx buffer
-        chunk = TF_MIN(TF_SENDBUF_LEN - tf->tx_pos, remain);
+        chunk = TF_MIN(tf->sendbuf_len - tf->tx_pos, remain);
         tf->tx_pos += TF_ComposeBody(tf->sendbuf+tf->tx_pos, buff+sent, (TF_LEN) chunk, &tf->tx_cksum);
         remain -= chunk;
         sent += chunk;
 
         // Flush if the buffer is full
-        if (tf->tx_pos == TF_SENDBUF_LEN) {
+        if (tf->tx_pos == tf->sendbuf_len) {
             TF_WriteImpl(tf, (const uint8_t *) tf->sendbuf, tf->tx_pos);
             tf->tx_pos = 0;
         }
@@ -926,7 +1391,7 @@ static void _TF_FN TF_SendFrame_End(TinyFrame *tf)
     // Checksum only if message had a body
     if (tf->tx_len > 0) {
         // Flush if checksum wouldn't fit in the buffer
-        if (TF_SENDBUF_LEN - tf->tx_pos < sizeof(TF_CKSUM)) {
+        if (tf->sendbuf_len - tf->tx_pos < sizeof(TF_CKSUM)) {
             TF_WriteImpl(tf, (const uint8_t *) tf->sendbuf, tf->tx_pos);
             tf->tx_pos = 0;
         }
@@ -936,6 +1401,9 @@ static void _TF_FN TF_SendFrame_End(TinyFrame *tf)
     }
 
     TF_WriteImpl(tf, (const uint8_t *) tf->sendbuf, tf->tx_pos);
+#if TF_USE_FRAME_END
+    TF_FrameEndImpl(tf);
+#endif
     TF_ReleaseTx(tf);
 }
 
@@ -1053,6 +1521,38 @@ void _TF_FN TF_Multipart_Close(TinyFrame *tf)
 //endregion Sending API funcs - multipart
 
 
+#if TF_USE_DEADLINES
+
+/** Timebase hook - expire the ID listeners that are due */
+void _TF_FN TF_Tick(TinyFrame *tf)
+{
+    TF_TIME now = TF_GetTime(tf);
+    TF_COUNT i;
+    struct TF_IdListener_ *lst;
+
+    // Listeners added from the cleanup callbacks get a later deadline, so this ends
+    while (tf->count_deadline_heap > 0) {
+        i = tf->deadline_heap[0];
+        lst = &tf->id_listeners[i];
+        if (TF_DEADLINE_BEFORE(now, lst->deadline)) break;
+
+        TF_Error("ID listener %d has expired", (int)lst->id);
+        // Listener has expired
+        cleanup_id_listener(tf, i, lst);
+    }
+}
+
+/** Earliest deadline to arm a timer for */
+bool _TF_FN TF_NextDeadline(TinyFrame *tf, TF_TIME *deadline)
+{
+    if (tf->count_deadline_heap == 0) return false;
+
+    *deadline = heap_deadline(tf, 0);
+    return true;
+}
+
+#else
+
 /** Timebase hook - for timeouts */
 void _TF_FN TF_Tick(TinyFrame *tf)
 {
@@ -1065,7 +1565,7 @@ void _TF_FN TF_Tick(TinyFrame *tf)
     }
 
     // decrement and expire ID listeners
-    for (i = 0; i < tf->count_id_lst; i++) {
+    for (i = 0; i < tf->max_id_lst; i++) {
         lst = &tf->id_listeners[i];
         if (!lst->fn || lst->timeout == 0) continue;
         // count down...
@@ -1076,3 +1576,5 @@ void _TF_FN TF_Tick(TinyFrame *tf)
         }
     }
 }
+
+#endif // TF_USE_DEADLINES
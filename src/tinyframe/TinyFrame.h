@@ -84,8 +84,26 @@ extern "C"
     #error Bad value for TF_CKSUM_TYPE
 #endif
 
+#if (TF_MAX_ID_LST & (TF_MAX_ID_LST - 1)) != 0
+    #error TF_MAX_ID_LST must be a power of two
+#endif
+
+#ifndef TF_RESYNC_LEN
+    #define TF_RESYNC_LEN 0
+#endif
+
+#if (TF_RESYNC_LEN & (TF_RESYNC_LEN - 1)) != 0
+    #error TF_RESYNC_LEN must be a power of two
+#endif
+
+// Failed frames can only be rescanned for a SOF, and without checksums none fail
+#define TF_RESYNC (TF_RESYNC_LEN > 0 && TF_USE_SOF_BYTE && TF_CKSUM_TYPE != TF_CKSUM_NONE)
+
 //endregion
 
+// Type listeners are found through a table indexed by the low byte of the type
+#define TF_TYPE_INDEX_LEN 256
+
 //---------------------------------------------------------------------------
 
 /** Peer bit enum (used for init) */
@@ -192,6 +210,37 @@ bool TF_InitStatic(TinyFrame *tf, TF_Peer peer_bit);
  */
 void TF_DeInit(TinyFrame *tf);
 
+/**
+ * Change the number of ID listener slots at runtime.
+ *
+ * The instance starts with TF_MAX_ID_LST built-in slots. More are allocated
+ * with malloc(), counts up to TF_MAX_ID_LST go back to the built-in slots and
+ * free the allocated ones. Registered listeners keep their slots, so the
+ * count cannot drop below the highest slot in use.
+ * Not to be called from a listener.
+ *
+ * @param tf - instance
+ * @param count - number of ID listeners that may be registered at once
+ * @return success, false when a listener is in the way or when out of memory
+ */
+bool TF_ResizeIdListeners(TinyFrame *tf, TF_COUNT count);
+
+/**
+ * Resize the receive and the transmit buffer at runtime.
+ *
+ * The instance starts with the built-in TF_MAX_PAYLOAD_RX and TF_SENDBUF_LEN
+ * buffers. Larger sizes are allocated with malloc(), sizes up to the built-in
+ * ones go back to the built-in buffers and free the allocated ones, which is
+ * also how an instance from TF_InitStatic() releases them. The parser is reset.
+ * Not to be called from a listener, the message data lives in the old buffer.
+ *
+ * @param tf - instance
+ * @param max_payload_rx - longest payload that is received
+ * @param sendbuf_len - size of the buffer frames are composed in
+ * @return success, false while a frame is being sent or when out of memory
+ */
+bool TF_ResizeBuffers(TinyFrame *tf, TF_LEN max_payload_rx, uint32_t sendbuf_len);
+
 
 // ---------------------------------- API CALLS --------------------------------------
 
@@ -220,10 +269,24 @@ void TF_AcceptChar(TinyFrame *tf, uint8_t c);
  *
  * A common place to call this from is the SysTick handler.
  *
+ * With TF_USE_DEADLINES it expires the ID listeners whose deadline has passed,
+ * and only needs to be called when the deadline from TF_NextDeadline() is due.
+ *
  * @param tf - instance
  */
 void TF_Tick(TinyFrame *tf);
 
+#if TF_USE_DEADLINES
+/**
+ * Get the earliest ID listener deadline, to arm a one-shot timer for it.
+ *
+ * @param tf - instance
+ * @param deadline - filled with the deadline in TF_GetTime() units
+ * @return false if no listener has a timeout (nothing to wait for)
+ */
+bool TF_NextDeadline(TinyFrame *tf, TF_TIME *deadline);
+#endif
+
 /**
  * Reset the frame parser state machine.
  * This does not affect registered listeners.
@@ -236,7 +299,9 @@ void TF_ResetParser(TinyFrame *tf);
 // ---------------------------- MESSAGE LISTENERS -------------------------------
 
 /**
- * Register a frame type listener.
+ * Register a frame ID listener.
+ * Listeners are indexed by frame ID. With several listeners on one ID, the
+ * earliest registered sees the frame first.
  *
  * @param tf - instance
  * @param msg - message (contains frame_id and userdata)
@@ -412,6 +477,11 @@ struct TF_IdListener_ {
     TF_Listener fn;
     TF_TICKS timeout;     // nr of ticks remaining to disable this listener
     TF_TICKS timeout_max; // the original timeout is stored here (0 = no timeout)
+#if TF_USE_DEADLINES
+    TF_TIME deadline;     // absolute expiry time, if timeout_max != 0
+    TF_COUNT heap_pos;    // position in the deadline heap
+#endif
+    TF_COUNT next;        // next slot + 1 in the same index bucket or in the free list, 0 ends
     void *userdata;
     void *userdata2;
 };
@@ -419,6 +489,7 @@ struct TF_IdListener_ {
 struct TF_TypeListener_ {
     TF_TYPE type;
     TF_Listener fn;
+    TF_COUNT next;        // next slot + 1 in the same index bucket, 0 ends
 };
 
 struct TF_GenericListener_ {
@@ -442,18 +513,30 @@ struct TinyFrame_ {
     /* Parser state */
     enum TF_State_ state;
     TF_TICKS parser_timeout_ticks;
+#if TF_USE_DEADLINES
+    TF_TIME parser_last_rx; //!< Time the last byte was received
+#endif
     TF_ID id;               //!< Incoming packet ID
     TF_LEN len;             //!< Payload length
-    uint8_t data[TF_MAX_PAYLOAD_RX]; //!< Data byte buffer
+    uint8_t *data;          //!< Data byte buffer, data_builtin or allocated by TF_ResizeBuffers()
+    TF_LEN max_payload_rx;  //!< Size of the data buffer
     TF_LEN rxi;             //!< Field size byte counter
     TF_CKSUM cksum;         //!< Checksum calculated of the data stream
     TF_CKSUM ref_cksum;     //!< Reference checksum read from the message
     TF_TYPE type;           //!< Collected message type number
     bool discard_data;      //!< Set if (len > TF_MAX_PAYLOAD) to read the frame, but ignore the data.
+#if TF_RESYNC
+    // Header bytes after the SOF, replayed with the payload when the frame fails
+    uint8_t resync_head[TF_ID_BYTES + TF_LEN_BYTES + TF_TYPE_BYTES + sizeof(TF_CKSUM)];
+    uint8_t resync_head_len;
+    bool resync_active;     //!< A failed frame is being replayed
+    bool resync_failed;     //!< A frame found in the replay failed too
+#endif
 
     /* Tx state */
     // Buffer for building frames
-    uint8_t sendbuf[TF_SENDBUF_LEN]; //!< Transmit temporary buffer
+    uint8_t *sendbuf;       //!< Transmit temporary buffer, sendbuf_builtin or allocated by TF_ResizeBuffers()
+    uint32_t sendbuf_len;   //!< Size of the transmit buffer
 
     uint32_t tx_pos;        //!< Next write position in the Tx buffer (used for multipart)
     uint32_t tx_len;        //!< Total expected Tx length
@@ -466,16 +549,39 @@ struct TinyFrame_ {
     /* --- Callbacks --- */
 
     /* Transaction callbacks */
-    struct TF_IdListener_ id_listeners[TF_MAX_ID_LST];
+
+    // ID listener slots, id_listeners_builtin or allocated by TF_ResizeIdListeners().
+    // A listener is chained in the index bucket of the low bits of its frame ID.
+    struct TF_IdListener_ *id_listeners;
+    TF_COUNT *id_index;        //!< first slot + 1 of every bucket, 0 is empty
+    TF_COUNT max_id_lst;       //!< number of slots
+    TF_COUNT id_index_mask;    //!< number of buckets - 1
+    TF_COUNT id_free;          //!< first free slot + 1, 0 when all are taken
+    TF_COUNT count_id_lst;     //!< registered ID listeners
+
     struct TF_TypeListener_ type_listeners[TF_MAX_TYPE_LST];
-    struct TF_GenericListener_ generic_listeners[TF_MAX_GEN_LST];
+    TF_COUNT type_index[TF_TYPE_INDEX_LEN]; //!< first slot + 1 for each low byte of the type
 
-    // Those counters are used to optimize look-up times.
-    // They point to the highest used slot number,
-    // or close to it, depending on the removal order.
-    TF_COUNT count_id_lst;
-    TF_COUNT count_type_lst;
+    struct TF_GenericListener_ generic_listeners[TF_MAX_GEN_LST];
+    // Highest used generic slot + 1, or close to it, depending on the removal order
     TF_COUNT count_generic_lst;
+
+#if TF_USE_DEADLINES
+    // Binary min-heap of ID listener slots with a timeout, ordered by deadline
+    TF_COUNT *deadline_heap;
+    TF_COUNT count_deadline_heap;
+#endif
+
+    /* Default buffers, used until TF_ResizeBuffers() asks for more */
+    uint8_t data_builtin[TF_MAX_PAYLOAD_RX];
+    uint8_t sendbuf_builtin[TF_SENDBUF_LEN];
+
+    /* Default ID listener slots, used until TF_ResizeIdListeners() asks for more */
+    struct TF_IdListener_ id_listeners_builtin[TF_MAX_ID_LST];
+    TF_COUNT id_index_builtin[TF_MAX_ID_LST];
+#if TF_USE_DEADLINES
+    TF_COUNT deadline_heap_builtin[TF_MAX_ID_LST];
+#endif
 };
 
 
@@ -488,6 +594,32 @@ struct TinyFrame_ {
  */
 extern void TF_WriteImpl(TinyFrame *tf, const uint8_t *buff, uint32_t len);
 
+/**
+ * Report an error found by TinyFrame, used by TF_Error(). Takes a printf
+ * format without the trailing newline. Where it goes is up to the application.
+ */
+extern void TF_ErrorImpl(const char *format, ...);
+
+#if TF_USE_DEADLINES
+
+    /**
+     * Read a monotonic clock. Listener timeouts and TF_PARSER_TIMEOUT_TICKS are
+     * counted in its units (e.g. milliseconds).
+     */
+    extern TF_TIME TF_GetTime(TinyFrame *tf);
+
+#endif
+
+#if TF_USE_FRAME_END
+
+    /**
+     * Called after the last TF_WriteImpl() of a frame, before TX is released.
+     * A frame larger than the send buffer takes several TF_WriteImpl() calls.
+     */
+    extern void TF_FrameEndImpl(TinyFrame *tf);
+
+#endif
+
 // Mutex functions
 #if TF_USE_MUTEX
 
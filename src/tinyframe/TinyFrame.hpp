@@ -0,0 +1,1158 @@
+/**
+ * @file TinyFrame.hpp
+ *
+ * Header-only C++11 TinyFrame.
+ *
+ * The frame format and the buffer sizes are template parameters rather than
+ * the TF_Config.h macros, so one program can hold engines for several
+ * device families side by side. The checksum is a policy class whose CRC
+ * tables are generated at compile time, so the per-byte paths inline fully.
+ *
+ * Frames are byte for byte those of TinyFrame.c built with the same
+ * settings: peers may mix the two implementations freely.
+ *
+ * Differences from the C API:
+ * - Timeouts always run on the clock passed to the constructor, in its
+ *   units, like TF_USE_DEADLINES. Without a clock they never expire.
+ * - Buffers are sized at compile time, there is no TF_ResizeBuffers().
+ */
+
+#ifndef TINYFRAME_HPP
+#define TINYFRAME_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// Error reporting, define it empty before including to silence the engine
+#ifndef TF_CPP_ERROR
+#define TF_CPP_ERROR(format, ...) std::printf("[TF] " format "\n", ##__VA_ARGS__)
+#endif
+
+namespace tinyframe
+{
+
+namespace detail
+{
+
+template <std::size_t... I>
+struct index_list
+{
+};
+
+template <typename A, typename B>
+struct index_concat;
+
+template <std::size_t... A, std::size_t... B>
+struct index_concat<index_list<A...>, index_list<B...> >
+{
+    typedef index_list<A..., (sizeof...(A) + B)...> type;
+};
+
+/** 0 .. N-1, built by halves to stay within the template depth limit */
+template <std::size_t N>
+struct make_index_list : index_concat<typename make_index_list<N / 2>::type, typename make_index_list<N - N / 2>::type>
+{
+};
+
+template <>
+struct make_index_list<0>
+{
+    typedef index_list<> type;
+};
+
+template <>
+struct make_index_list<1>
+{
+    typedef index_list<0> type;
+};
+
+/** Shifts a reflected CRC register through the given number of bit rounds */
+template <typename T>
+constexpr T crc_rounds(T crc, T poly, unsigned rounds)
+{
+    return (rounds == 0) ? crc : crc_rounds<T>(static_cast<T>((crc & 1u) ? ((crc >> 1) ^ poly) : (crc >> 1)), poly, rounds - 1);
+}
+
+/** Feeds one zero byte to a register */
+template <typename T>
+constexpr T crc_zero_byte(T crc, T poly)
+{
+    return static_cast<T>((crc >> 8) ^ crc_rounds<T>(static_cast<T>(crc & 0xFFu), poly, 8));
+}
+
+/** Slice k holds the CRC of a byte followed by k zero bytes */
+template <typename T>
+constexpr T crc_slice_entry(T poly, std::size_t slice, std::size_t index)
+{
+    return (slice == 0) ? crc_rounds<T>(static_cast<T>(index), poly, 8) : crc_zero_byte<T>(crc_slice_entry<T>(poly, slice - 1, index), poly);
+}
+
+/** Slicing-by-8 tables of a reflected CRC, slice 0 is the classic byte table */
+template <typename T, T Poly, typename Indices = typename make_index_list<8 * 256>::type>
+struct crc_tables;
+
+template <typename T, T Poly, std::size_t... I>
+struct crc_tables<T, Poly, index_list<I...> >
+{
+    static constexpr T values[8 * 256] = { crc_slice_entry<T>(Poly, I / 256, I % 256)... };
+};
+
+template <typename T, T Poly, std::size_t... I>
+constexpr T crc_tables<T, Poly, index_list<I...> >::values[8 * 256];
+
+template <unsigned Bytes>
+struct uint_bytes;
+
+template <>
+struct uint_bytes<1>
+{
+    typedef uint8_t type;
+};
+
+template <>
+struct uint_bytes<2>
+{
+    typedef uint16_t type;
+};
+
+template <>
+struct uint_bytes<4>
+{
+    typedef uint32_t type;
+};
+
+} // namespace detail
+
+//
+// Checksum policies. A policy names its value_type and its width on the
+// wire in bytes, and updates the checksum with start(), add(), add_block()
+// and end() like TF_CksumStart(), TF_CksumAdd() and TF_CksumEnd().
+//
+
+/** No checksum fields in the frame, TF_CKSUM_NONE */
+struct cksum_none
+{
+    typedef uint8_t value_type;
+    static constexpr std::size_t bytes = 0;
+
+    static value_type start() { return 0; }
+    static value_type add(value_type cksum, uint8_t) { return cksum; }
+    static value_type add_block(value_type cksum, const uint8_t *, std::size_t) { return cksum; }
+    static value_type end(value_type cksum) { return cksum; }
+};
+
+/**
+ * Base for checksums defined byte by byte, like the TF_CKSUM_CUSTOM types.
+ * The derived class provides start(), add() and end().
+ */
+template <typename Derived, typename T>
+struct cksum_bytewise
+{
+    typedef T value_type;
+    static constexpr std::size_t bytes = sizeof(T);
+
+    static T add_block(T cksum, const uint8_t *data, std::size_t len)
+    {
+        for (std::size_t i = 0; i < len; ++i)
+        {
+            cksum = Derived::add(cksum, data[i]);
+        }
+
+        return cksum;
+    }
+};
+
+/** Inverted XOR of all bytes, TF_CKSUM_XOR */
+struct cksum_xor
+{
+    typedef uint8_t value_type;
+    static constexpr std::size_t bytes = 1;
+
+    static uint8_t start() { return 0; }
+    static uint8_t add(uint8_t cksum, uint8_t byte) { return static_cast<uint8_t>(cksum ^ byte); }
+    static uint8_t end(uint8_t cksum) { return static_cast<uint8_t>(~cksum); }
+
+    /** Eight bytes per step, folded at the end */
+    static uint8_t add_block(uint8_t cksum, const uint8_t *data, std::size_t len)
+    {
+        uint64_t wide = 0;
+
+        for (; len >= 8; data += 8, len -= 8)
+        {
+            uint64_t w;
+            std::memcpy(&w, data, sizeof(w));
+            wide ^= w;
+        }
+
+        wide ^= wide >> 32;
+        wide ^= wide >> 16;
+        wide ^= wide >> 8;
+        cksum = static_cast<uint8_t>(cksum ^ wide);
+
+        for (; len > 0; --len)
+        {
+            cksum = static_cast<uint8_t>(cksum ^ *data++);
+        }
+
+        return cksum;
+    }
+};
+
+/** Reflected CRC with compile-time tables, blocks are processed eight bytes at a time */
+template <typename T, T Poly, T Init, T XorOut>
+struct cksum_crc
+{
+    typedef T value_type;
+    typedef detail::crc_tables<T, Poly> tables;
+    static constexpr std::size_t bytes = sizeof(T);
+
+    static T start() { return Init; }
+
+    static T add(T crc, uint8_t byte)
+    {
+        return static_cast<T>((crc >> 8) ^ tables::values[(crc ^ byte) & 0xFFu]);
+    }
+
+    static T add_block(T crc, const uint8_t *data, std::size_t len)
+    {
+        const T *t = tables::values;
+        uint32_t reg = crc;  // narrower registers sit in the low bits
+
+        for (; len >= 8; data += 8, len -= 8)
+        {
+            const uint32_t one = load_le32(data) ^ reg;
+            const uint32_t two = load_le32(data + 4);
+
+            reg = t[7 * 256 + (one & 0xFF)]         ^ t[6 * 256 + ((one >> 8) & 0xFF)]
+                ^ t[5 * 256 + ((one >> 16) & 0xFF)] ^ t[4 * 256 + (one >> 24)]
+                ^ t[3 * 256 + (two & 0xFF)]         ^ t[2 * 256 + ((two >> 8) & 0xFF)]
+                ^ t[1 * 256 + ((two >> 16) & 0xFF)] ^ t[two >> 24];
+        }
+
+        crc = static_cast<T>(reg);
+
+        for (; len > 0; --len)
+        {
+            crc = add(crc, *data++);
+        }
+
+        return crc;
+    }
+
+    static T end(T crc) { return static_cast<T>(crc ^ XorOut); }
+
+private:
+    static uint32_t load_le32(const uint8_t *p)
+    {
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8)
+             | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+};
+
+/** Dallas/Maxim CRC8 (1-wire), TF_CKSUM_CRC8 */
+typedef cksum_crc<uint8_t, 0x8C, 0x00, 0x00> cksum_crc8;
+
+/** CRC16 with the polynomial 0x8005, TF_CKSUM_CRC16 */
+typedef cksum_crc<uint16_t, 0xA001, 0x0000, 0x0000> cksum_crc16;
+
+/** CRC32 with the polynomial 0xEDB88320, TF_CKSUM_CRC32 */
+typedef cksum_crc<uint32_t, 0xEDB88320u, 0xFFFFFFFFu, 0xFFFFFFFFu> cksum_crc32;
+
+/**
+ * Frame format, what TF_Config.h sets for the C version. Both peers must
+ * use the same one.
+ *
+ * @tparam IdBytes, LenBytes, TypeBytes - field widths, 1, 2 or 4
+ * @tparam Checksum - checksum policy
+ * @tparam SofByte - value of the start of frame byte, -1 for none
+ */
+template <unsigned IdBytes, unsigned LenBytes, unsigned TypeBytes, typename Checksum, int SofByte = 0x01>
+struct format
+{
+    typedef typename detail::uint_bytes<IdBytes>::type id_type;
+    typedef typename detail::uint_bytes<LenBytes>::type len_type;
+    typedef typename detail::uint_bytes<TypeBytes>::type type_type;
+    typedef Checksum checksum;
+
+    static_assert((SofByte >= -1) && (SofByte <= 0xFF), "SofByte is a byte value or -1");
+
+    static constexpr bool use_sof = (SofByte >= 0);
+    static constexpr uint8_t sof_byte = static_cast<uint8_t>(SofByte);
+
+    /** Bytes before the payload, header checksum included */
+    static constexpr std::size_t header_size = (use_sof ? 1 : 0) + IdBytes + LenBytes + TypeBytes + Checksum::bytes;
+};
+
+/** The format of TF_Config.h */
+typedef format<1, 2, 1, cksum_crc16, 0x01> tf_config_format;
+
+/** Peer bit, TF_Peer */
+enum class peer
+{
+    slave,
+    master,
+};
+
+/** Listener verdict, TF_Result */
+enum class listener_result
+{
+    next,   //!< Not handled, let other listeners handle it
+    stay,   //!< Handled, stay
+    renew,  //!< Handled, stay, restart the timeout of an ID listener
+    close,  //!< Handled, remove self
+};
+
+/**
+ * TinyFrame instance.
+ *
+ * @tparam Format - frame format
+ * @tparam MaxPayloadRx - longest payload that is received, longer ones are dropped
+ * @tparam SendBufLen - buffer frames are composed in, longer frames leave in several writes
+ * @tparam IdListeners, TypeListeners, GenericListeners - listener slots
+ */
+template <typename Format, std::size_t MaxPayloadRx = 1024, std::size_t SendBufLen = 512,
+          std::size_t IdListeners = 16, std::size_t TypeListeners = 10, std::size_t GenericListeners = 5>
+class engine
+{
+public:
+    typedef typename Format::id_type id_type;
+    typedef typename Format::len_type len_type;
+    typedef typename Format::type_type type_type;
+    typedef typename Format::checksum checksum;
+    typedef typename checksum::value_type cksum_type;
+
+    static_assert(SendBufLen >= Format::header_size, "The frame header must fit the send buffer");
+    static_assert(MaxPayloadRx <= static_cast<len_type>(~len_type(0)), "MaxPayloadRx does not fit the LEN field");
+
+    /** Message to send or received, TF_Msg */
+    struct message
+    {
+        id_type frame_id = 0;
+        bool is_response = false;  //!< set by respond(), frame_id is then kept unchanged
+        type_type type = 0;
+
+        /**
+         * Payload. nullptr in an ID listener means the listener timed out or was
+         * removed, nullptr with a length when sending opens a multipart frame.
+         */
+        const uint8_t *data = nullptr;
+        len_type len = 0;
+
+        /** Stored in the ID listener slot and handed back to the listener */
+        void *userdata = nullptr;
+        void *userdata2 = nullptr;
+    };
+
+    typedef listener_result (*listener)(engine &tf, message &msg);
+
+    /** Sends bytes to the peer, TF_WriteImpl() */
+    typedef void (*write_function)(engine &tf, const uint8_t *data, uint32_t len);
+
+    /** Monotonic clock for the timeouts, TF_GetTime(). Wraps around at 32 bits */
+    typedef uint32_t (*time_function)(engine &tf);
+
+    /** Free for the application, kept by reset() */
+    void *userdata = nullptr;
+    uint32_t usertag = 0;
+
+    engine(peer own_peer, write_function write, time_function time = nullptr)
+        : write_fn(write)
+        , time_fn(time)
+        , peer_bit(own_peer)
+    {
+        reset();
+    }
+
+    engine(const engine &) = delete;
+    engine &operator=(const engine &) = delete;
+
+    /** Drop all listeners and any partial frame, TF_InitStatic() */
+    void reset()
+    {
+        next_id = 0;
+        tx_lock = false;
+        count_id_lst = 0;
+        count_type_lst = 0;
+        count_generic_lst = 0;
+
+        for (id_slot &slot : id_listeners)
+        {
+            slot = id_slot();
+        }
+
+        for (type_slot &slot : type_listeners)
+        {
+            slot = type_slot();
+        }
+
+        for (generic_slot &slot : generic_listeners)
+        {
+            slot = generic_slot();
+        }
+
+        reset_parser();
+    }
+
+    /** Time a partial frame may wait for its next byte, default 65535 */
+    void set_parser_timeout(uint32_t timeout)
+    {
+        parser_timeout = timeout;
+    }
+
+    //
+    // Receiving
+    //
+
+    void accept(const uint8_t *buffer, uint32_t count)
+    {
+        uint32_t i = 0;
+
+        if (count == 0)
+        {
+            return;
+        }
+
+        check_parser_timeout();
+
+        while (i < count)
+        {
+            // Payload fast path, the body is taken in one go once the header checked out
+            if (rx_state == state::data)
+            {
+                const uint32_t chunk = std::min<uint32_t>(rx_len - rxi, count - i);
+                data_block(buffer + i, chunk);
+                i += chunk;
+            }
+            else
+            {
+                parse_char(buffer[i++]);
+            }
+        }
+    }
+
+    void accept_char(uint8_t c)
+    {
+        check_parser_timeout();
+        parse_char(c);
+    }
+
+    void reset_parser()
+    {
+        rx_state = state::sof;
+    }
+
+    /** Expire the ID listeners that are due, TF_Tick() */
+    void tick()
+    {
+        if (time_fn == nullptr)
+        {
+            return;
+        }
+
+        const uint32_t now = time_fn(*this);
+
+        for (std::size_t i = 0; i < count_id_lst; ++i)
+        {
+            id_slot &lst = id_listeners[i];
+
+            if ((lst.fn != nullptr) && (lst.timeout != 0) && !deadline_before(now, lst.deadline))
+            {
+                TF_CPP_ERROR("ID listener %d has expired", static_cast<int>(lst.id));
+                cleanup_id_listener(i);
+            }
+        }
+    }
+
+    /** Earliest ID listener deadline, false if none has a timeout */
+    bool next_deadline(uint32_t &deadline) const
+    {
+        bool found = false;
+
+        for (std::size_t i = 0; i < count_id_lst; ++i)
+        {
+            const id_slot &lst = id_listeners[i];
+
+            if ((lst.fn != nullptr) && (lst.timeout != 0) && (!found || deadline_before(lst.deadline, deadline)))
+            {
+                deadline = lst.deadline;
+                found = true;
+            }
+        }
+
+        return found;
+    }
+
+    //
+    // Listeners
+    //
+
+    /** Listen for a frame ID, the timeout is in clock units, 0 is forever */
+    bool add_id_listener(const message &msg, listener fn, uint32_t timeout)
+    {
+        for (std::size_t i = 0; i < IdListeners; ++i)
+        {
+            id_slot &lst = id_listeners[i];
+
+            if (lst.fn == nullptr)
+            {
+                lst.fn = fn;
+                lst.id = msg.frame_id;
+                lst.userdata = msg.userdata;
+                lst.userdata2 = msg.userdata2;
+                lst.timeout = timeout;
+                schedule(lst);
+                count_id_lst = std::max(count_id_lst, i + 1);
+                return true;
+            }
+        }
+
+        TF_CPP_ERROR("Failed to add ID listener");
+        return false;
+    }
+
+    bool remove_id_listener(id_type frame_id)
+    {
+        for (std::size_t i = 0; i < count_id_lst; ++i)
+        {
+            if ((id_listeners[i].fn != nullptr) && (id_listeners[i].id == frame_id))
+            {
+                cleanup_id_listener(i);
+                return true;
+            }
+        }
+
+        TF_CPP_ERROR("ID listener %d to remove not found", static_cast<int>(frame_id));
+        return false;
+    }
+
+    /** Restart the timeout of an ID listener */
+    bool renew_id_listener(id_type frame_id)
+    {
+        for (std::size_t i = 0; i < count_id_lst; ++i)
+        {
+            if ((id_listeners[i].fn != nullptr) && (id_listeners[i].id == frame_id))
+            {
+                schedule(id_listeners[i]);
+                return true;
+            }
+        }
+
+        TF_CPP_ERROR("Renew listener: not found (id %d)", static_cast<int>(frame_id));
+        return false;
+    }
+
+    bool add_type_listener(type_type frame_type, listener fn)
+    {
+        for (std::size_t i = 0; i < TypeListeners; ++i)
+        {
+            if (type_listeners[i].fn == nullptr)
+            {
+                type_listeners[i].fn = fn;
+                type_listeners[i].type = frame_type;
+                count_type_lst = std::max(count_type_lst, i + 1);
+                return true;
+            }
+        }
+
+        TF_CPP_ERROR("Failed to add type listener");
+        return false;
+    }
+
+    bool remove_type_listener(type_type frame_type)
+    {
+        for (std::size_t i = 0; i < count_type_lst; ++i)
+        {
+            if ((type_listeners[i].fn != nullptr) && (type_listeners[i].type == frame_type))
+            {
+                cleanup_slot(type_listeners, count_type_lst, i);
+                return true;
+            }
+        }
+
+        TF_CPP_ERROR("Type listener %d to remove not found", static_cast<int>(frame_type));
+        return false;
+    }
+
+    bool add_generic_listener(listener fn)
+    {
+        for (std::size_t i = 0; i < GenericListeners; ++i)
+        {
+            if (generic_listeners[i].fn == nullptr)
+            {
+                generic_listeners[i].fn = fn;
+                count_generic_lst = std::max(count_generic_lst, i + 1);
+                return true;
+            }
+        }
+
+        TF_CPP_ERROR("Failed to add generic listener");
+        return false;
+    }
+
+    bool remove_generic_listener(listener fn)
+    {
+        for (std::size_t i = 0; i < count_generic_lst; ++i)
+        {
+            if (generic_listeners[i].fn == fn)
+            {
+                cleanup_slot(generic_listeners, count_generic_lst, i);
+                return true;
+            }
+        }
+
+        TF_CPP_ERROR("Generic listener to remove not found");
+        return false;
+    }
+
+    //
+    // Sending. A message with data == nullptr and a length opens a multipart
+    // frame, the payload follows with multipart_payload() and multipart_close().
+    //
+
+    bool send(message &msg)
+    {
+        return send_frame(msg, nullptr, 0);
+    }
+
+    bool send_simple(type_type type, const uint8_t *data, len_type len)
+    {
+        message msg;
+        msg.type = type;
+        msg.data = data;
+        msg.len = len;
+        return send_frame(msg, nullptr, 0);
+    }
+
+    /** Send and listen for the answer, the frame ID is stored in msg */
+    bool query(message &msg, listener fn, uint32_t timeout)
+    {
+        return send_frame(msg, fn, timeout);
+    }
+
+    bool query_simple(type_type type, const uint8_t *data, len_type len, listener fn, uint32_t timeout)
+    {
+        message msg;
+        msg.type = type;
+        msg.data = data;
+        msg.len = len;
+        return send_frame(msg, fn, timeout);
+    }
+
+    /** Answer with the frame ID of msg */
+    bool respond(message &msg)
+    {
+        msg.is_response = true;
+        return send_frame(msg, nullptr, 0);
+    }
+
+    void multipart_payload(const uint8_t *data, uint32_t len)
+    {
+        send_chunk(data, len);
+    }
+
+    void multipart_close()
+    {
+        send_end();
+    }
+
+private:
+    enum class state
+    {
+        sof,
+        id,
+        len,
+        type,
+        head_cksum,
+        data,
+        data_cksum,
+    };
+
+    struct id_slot
+    {
+        id_type id = 0;
+        listener fn = nullptr;
+        uint32_t timeout = 0;   //!< 0 is none
+        uint32_t deadline = 0;
+        void *userdata = nullptr;
+        void *userdata2 = nullptr;
+    };
+
+    struct type_slot
+    {
+        type_type type = 0;
+        listener fn = nullptr;
+    };
+
+    struct generic_slot
+    {
+        listener fn = nullptr;
+    };
+
+    static constexpr id_type id_peer_bit = static_cast<id_type>(id_type(1) << (sizeof(id_type) * 8 - 1));
+    static constexpr id_type id_mask = static_cast<id_type>(id_peer_bit - 1);
+
+    /** Comparison on the signed difference, so the clock may wrap around */
+    static bool deadline_before(uint32_t a, uint32_t b)
+    {
+        return static_cast<int32_t>(a - b) < 0;
+    }
+
+    void schedule(id_slot &lst)
+    {
+        if ((lst.timeout != 0) && (time_fn != nullptr))
+        {
+            lst.deadline = time_fn(*this) + lst.timeout;
+        }
+    }
+
+    /** Let the listener free its userdata, then free the slot */
+    void cleanup_id_listener(std::size_t i)
+    {
+        id_slot &lst = id_listeners[i];
+
+        if (lst.fn == nullptr)
+        {
+            return;
+        }
+
+        if ((lst.userdata != nullptr) || (lst.userdata2 != nullptr))
+        {
+            message msg;
+            msg.userdata = lst.userdata;
+            msg.userdata2 = lst.userdata2;
+            lst.fn(*this, msg);
+        }
+
+        cleanup_slot(id_listeners, count_id_lst, i);
+    }
+
+    template <typename Slot, std::size_t N>
+    static void cleanup_slot(Slot (&slots)[N], std::size_t &count, std::size_t i)
+    {
+        slots[i].fn = nullptr;
+
+        if (i == count - 1)
+        {
+            --count;
+        }
+    }
+
+    void handle_received_message()
+    {
+        message msg;
+        msg.frame_id = rx_id;
+        msg.type = rx_type;
+        msg.data = rx_data;
+        msg.len = rx_len;
+
+        for (std::size_t i = 0; i < count_id_lst; ++i)
+        {
+            id_slot &lst = id_listeners[i];
+
+            if ((lst.fn != nullptr) && (lst.id == msg.frame_id))
+            {
+                msg.userdata = lst.userdata;
+                msg.userdata2 = lst.userdata2;
+                const listener_result res = lst.fn(*this, msg);
+                lst.userdata = msg.userdata;
+                lst.userdata2 = msg.userdata2;
+
+                if (res != listener_result::next)
+                {
+                    if (res == listener_result::renew)
+                    {
+                        schedule(lst);
+                    }
+                    else if (res == listener_result::close)
+                    {
+                        // The listener cleaned up already
+                        lst.userdata = nullptr;
+                        lst.userdata2 = nullptr;
+                        cleanup_id_listener(i);
+                    }
+                    return;
+                }
+            }
+        }
+
+        // Userdata of an ID listener that passed does not leak to the others
+        msg.userdata = nullptr;
+        msg.userdata2 = nullptr;
+
+        for (std::size_t i = 0; i < count_type_lst; ++i)
+        {
+            if ((type_listeners[i].fn != nullptr) && (type_listeners[i].type == msg.type))
+            {
+                const listener_result res = type_listeners[i].fn(*this, msg);
+
+                if (res != listener_result::next)
+                {
+                    if (res == listener_result::close)
+                    {
+                        cleanup_slot(type_listeners, count_type_lst, i);
+                    }
+                    return;
+                }
+            }
+        }
+
+        for (std::size_t i = 0; i < count_generic_lst; ++i)
+        {
+            if (generic_listeners[i].fn != nullptr)
+            {
+                const listener_result res = generic_listeners[i].fn(*this, msg);
+
+                if (res != listener_result::next)
+                {
+                    if (res == listener_result::close)
+                    {
+                        cleanup_slot(generic_listeners, count_generic_lst, i);
+                    }
+                    return;
+                }
+            }
+        }
+
+        TF_CPP_ERROR("Unhandled message, type %d", static_cast<int>(msg.type));
+    }
+
+    //
+    // Parser
+    //
+
+    void check_parser_timeout()
+    {
+        if (time_fn == nullptr)
+        {
+            return;
+        }
+
+        const uint32_t now = time_fn(*this);
+        const bool expired = (now - rx_last) >= parser_timeout;
+        rx_last = now;
+
+        if (expired && (rx_state != state::sof))
+        {
+            reset_parser();
+            TF_CPP_ERROR("Parser timeout");
+        }
+    }
+
+    void begin_frame()
+    {
+        rx_cksum = checksum::start();
+
+        if (Format::use_sof)
+        {
+            rx_cksum = checksum::add(rx_cksum, Format::sof_byte);
+        }
+
+        rx_discard = false;
+        rx_state = state::id;
+        rxi = 0;
+    }
+
+    /** Shift in one byte of a big-endian field, true once the field is complete */
+    template <typename T>
+    bool collect(T &dest, uint8_t c)
+    {
+        dest = static_cast<T>((static_cast<uint32_t>(dest) << 8) | c);
+        return ++rxi == sizeof(T);
+    }
+
+    /** The header checked out, go on to the payload */
+    void header_complete()
+    {
+        if (rx_len == 0)
+        {
+            handle_received_message();
+            reset_parser();
+            return;
+        }
+
+        rx_state = state::data;
+        rxi = 0;
+        rx_cksum = checksum::start();
+
+        if (rx_len > MaxPayloadRx)
+        {
+            TF_CPP_ERROR("Rx payload too long: %d", static_cast<int>(rx_len));
+            rx_discard = true;
+        }
+    }
+
+    /** A run of payload bytes, no longer than what remains of the payload */
+    void data_block(const uint8_t *data, uint32_t count)
+    {
+        if (!rx_discard)
+        {
+            std::memcpy(rx_data + rxi, data, count);
+            rx_cksum = checksum::add_block(rx_cksum, data, count);
+        }
+
+        rxi += count;
+
+        if (rxi == rx_len)
+        {
+            if (checksum::bytes == 0)
+            {
+                if (!rx_discard)
+                {
+                    handle_received_message();
+                }
+                reset_parser();
+            }
+            else
+            {
+                rx_state = state::data_cksum;
+                rxi = 0;
+            }
+        }
+    }
+
+    void parse_char(uint8_t c)
+    {
+        if (!Format::use_sof && (rx_state == state::sof))
+        {
+            begin_frame();
+        }
+
+        switch (rx_state)
+        {
+        case state::sof:
+            if (c == Format::sof_byte)
+            {
+                begin_frame();
+            }
+            break;
+
+        case state::id:
+            rx_cksum = checksum::add(rx_cksum, c);
+            if (collect(rx_id, c))
+            {
+                rx_state = state::len;
+                rxi = 0;
+            }
+            break;
+
+        case state::len:
+            rx_cksum = checksum::add(rx_cksum, c);
+            if (collect(rx_len, c))
+            {
+                rx_state = state::type;
+                rxi = 0;
+            }
+            break;
+
+        case state::type:
+            rx_cksum = checksum::add(rx_cksum, c);
+            if (collect(rx_type, c))
+            {
+                rxi = 0;
+
+                if (checksum::bytes == 0)
+                {
+                    header_complete();
+                }
+                else
+                {
+                    rx_state = state::head_cksum;
+                }
+            }
+            break;
+
+        case state::head_cksum:
+            if (collect(rx_ref_cksum, c))
+            {
+                if (checksum::end(rx_cksum) != rx_ref_cksum)
+                {
+                    TF_CPP_ERROR("Rx head cksum mismatch");
+                    reset_parser();
+                    break;
+                }
+
+                header_complete();
+            }
+            break;
+
+        case state::data:
+            data_block(&c, 1);
+            break;
+
+        case state::data_cksum:
+            if (collect(rx_ref_cksum, c))
+            {
+                if (!rx_discard)
+                {
+                    if (checksum::end(rx_cksum) == rx_ref_cksum)
+                    {
+                        handle_received_message();
+                    }
+                    else
+                    {
+                        TF_CPP_ERROR("Body cksum mismatch");
+                    }
+                }
+
+                reset_parser();
+            }
+            break;
+        }
+    }
+
+    //
+    // Composing
+    //
+
+    /** Write a number big-endian */
+    template <typename T>
+    static uint32_t put_number(uint8_t *out, T num)
+    {
+        for (std::size_t k = 0; k < sizeof(T); ++k)
+        {
+            out[k] = static_cast<uint8_t>(num >> (8 * (sizeof(T) - 1 - k)));
+        }
+
+        return sizeof(T);
+    }
+
+    /** Header with its checksum into the send buffer, resolves the frame ID */
+    uint32_t compose_head(message &msg)
+    {
+        uint32_t pos = 0;
+
+        if (!msg.is_response)
+        {
+            msg.frame_id = static_cast<id_type>(next_id++ & id_mask);
+
+            if (peer_bit == peer::master)
+            {
+                msg.frame_id = static_cast<id_type>(msg.frame_id | id_peer_bit);
+            }
+        }
+
+        if (Format::use_sof)
+        {
+            sendbuf[pos++] = Format::sof_byte;
+        }
+
+        pos += put_number(sendbuf + pos, msg.frame_id);
+        pos += put_number(sendbuf + pos, msg.len);
+        pos += put_number(sendbuf + pos, msg.type);
+
+        if (checksum::bytes > 0)
+        {
+            const cksum_type cksum = checksum::end(checksum::add_block(checksum::start(), sendbuf, pos));
+            pos += put_number(sendbuf + pos, cksum);
+        }
+
+        return pos;
+    }
+
+    bool send_frame(message &msg, listener fn, uint32_t timeout)
+    {
+        if (tx_lock)
+        {
+            TF_CPP_ERROR("TF already locked for tx!");
+            return false;
+        }
+
+        tx_lock = true;
+        tx_pos = compose_head(msg);
+        tx_len = msg.len;
+
+        if ((fn != nullptr) && !add_id_listener(msg, fn, timeout))
+        {
+            tx_lock = false;
+            return false;
+        }
+
+        tx_cksum = checksum::start();
+
+        if ((msg.len == 0) || (msg.data != nullptr))
+        {
+            send_chunk(msg.data, msg.len);
+            send_end();
+        }
+
+        return true;
+    }
+
+    void send_chunk(const uint8_t *data, uint32_t len)
+    {
+        while (len > 0)
+        {
+            const uint32_t chunk = std::min<uint32_t>(static_cast<uint32_t>(SendBufLen) - tx_pos, len);
+
+            std::memcpy(sendbuf + tx_pos, data, chunk);
+            tx_cksum = checksum::add_block(tx_cksum, data, chunk);
+            tx_pos += chunk;
+            data += chunk;
+            len -= chunk;
+
+            if (tx_pos == SendBufLen)
+            {
+                write_fn(*this, sendbuf, tx_pos);
+                tx_pos = 0;
+            }
+        }
+    }
+
+    /** Checksum of the body, if any, and the final write */
+    void send_end()
+    {
+        if ((checksum::bytes > 0) && (tx_len > 0))
+        {
+            if (SendBufLen - tx_pos < checksum::bytes)
+            {
+                write_fn(*this, sendbuf, tx_pos);
+                tx_pos = 0;
+            }
+
+            tx_pos += put_number(sendbuf + tx_pos, checksum::end(tx_cksum));
+        }
+
+        write_fn(*this, sendbuf, tx_pos);
+        tx_lock = false;
+    }
+
+    write_function write_fn;
+    time_function time_fn;
+    uint32_t parser_timeout = 65535;
+
+    peer peer_bit;
+    id_type next_id = 0;
+
+    // Parser
+    state rx_state = state::sof;
+    uint32_t rx_last = 0;
+    uint32_t rxi = 0;
+    id_type rx_id = 0;
+    len_type rx_len = 0;
+    type_type rx_type = 0;
+    cksum_type rx_cksum = 0;
+    cksum_type rx_ref_cksum = 0;
+    bool rx_discard = false;
+    uint8_t rx_data[MaxPayloadRx];
+
+    // Composer
+    bool tx_lock = false;
+    uint32_t tx_pos = 0;
+    uint32_t tx_len = 0;
+    cksum_type tx_cksum = 0;
+    uint8_t sendbuf[SendBufLen];
+
+    id_slot id_listeners[IdListeners];
+    type_slot type_listeners[TypeListeners];
+    generic_slot generic_listeners[GenericListeners];
+    std::size_t count_id_lst = 0;
+    std::size_t count_type_lst = 0;
+    std::size_t count_generic_lst = 0;
+};
+
+} // namespace tinyframe
+
+#endif // TINYFRAME_HPP
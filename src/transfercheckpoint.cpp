@@ -0,0 +1,118 @@
+/**
+ * @file transfercheckpoint.cpp
+ */
+
+#include "transfercheckpoint.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QFile>
+#include <QStandardPaths>
+
+#include "checksum/checksum.h"
+
+transfer_checkpoint::transfer_checkpoint(const QString &port_name, const QString &image_path)
+    : port_name{port_name}
+{
+    const QFileInfo image_info(image_path);
+
+    this->image_path = image_info.absoluteFilePath();
+
+    if (image_info.exists())
+    {
+        image_size     = image_info.size();
+        image_modified = image_info.lastModified().toMSecsSinceEpoch();
+    }
+
+    // One checkpoint per port and image path, named after the CRC32 of both
+    const QByteArray key_utf8 = (this->port_name + "\n" + this->image_path).toUtf8();
+    const quint32 key_crc = ~checksum_crc32(0xFFFFFFFFu,
+                                            reinterpret_cast<const uint8_t*>(key_utf8.constData()),
+                                            static_cast<size_t>(key_utf8.size()));
+
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/checkpoints";
+
+    checkpoint_path = dir + "/" + QString::number(key_crc, 16) + ".json";
+}
+
+/**
+ * Reads the checkpoint. Returns false if there is none or it was written for
+ * another port or image, or for this path before the file was changed.
+ */
+bool transfer_checkpoint::load()
+{
+    QFile file(checkpoint_path);
+
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+
+    const QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+
+    if ((json.value("port").toString() != port_name)
+            || (json.value("image").toString() != image_path)
+            || (static_cast<qint64>(json.value("size").toDouble(-1)) != image_size)
+            || (static_cast<qint64>(json.value("modified").toDouble()) != image_modified))
+    {
+        qDebug() << "[INFO] Checkpoint " << checkpoint_path << " is stale";
+        return false;
+    }
+
+    image_offset = static_cast<quint32>(json.value("offset").toDouble());
+    image_crc    = static_cast<quint32>(json.value("crc32").toDouble());
+
+    return true;
+}
+
+bool transfer_checkpoint::save()
+{
+    QDir().mkpath(QFileInfo(checkpoint_path).absolutePath());
+
+    QJsonObject json;
+    json.insert("port",     port_name);
+    json.insert("image",    image_path);
+    json.insert("size",     static_cast<double>(image_size));
+    json.insert("modified", static_cast<double>(image_modified));
+    json.insert("offset",   static_cast<double>(image_offset));
+    json.insert("crc32",    static_cast<double>(image_crc));
+
+    // Written to a temporary file and renamed, a crash never leaves half a checkpoint
+    QSaveFile file(checkpoint_path);
+
+    if (!file.open(QIODevice::WriteOnly)
+            || (file.write(QJsonDocument(json).toJson(QJsonDocument::Compact)) < 0)
+            || !file.commit())
+    {
+        qDebug() << "[ERROR] Checkpoint " << checkpoint_path << " cannot be written. Error: " << file.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+void transfer_checkpoint::remove()
+{
+    QFile::remove(checkpoint_path);
+}
+
+quint32 transfer_checkpoint::offset() const
+{
+    return image_offset;
+}
+
+quint32 transfer_checkpoint::crc() const
+{
+    return image_crc;
+}
+
+void transfer_checkpoint::set_progress(quint32 offset, quint32 crc)
+{
+    image_offset = offset;
+    image_crc    = crc;
+}
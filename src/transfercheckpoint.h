@@ -0,0 +1,41 @@
+/**
+ * @file transfercheckpoint.h
+ */
+
+#ifndef TRANSFERCHECKPOINT_H
+#define TRANSFERCHECKPOINT_H
+
+#include <QString>
+
+/**
+ * On-disk progress of an image transfer, so an interrupted transfer can be
+ * resumed after the link comes back.
+ *
+ * Every port keeps its own checkpoint, a fleet flashes one image to many
+ * devices that stop at different offsets. The image is identified by its
+ * path, size and modification time. The checkpoint holds the offset up to
+ * which the device acknowledged every chunk and the CRC32 of the image up
+ * to that offset.
+ */
+class transfer_checkpoint
+{
+public:
+    transfer_checkpoint(const QString &port_name, const QString &image_path);
+    bool load(void);
+    bool save(void);
+    void remove(void);
+    quint32 offset(void) const;
+    quint32 crc(void) const;
+    void set_progress(quint32 offset, quint32 crc);
+
+private:
+    QString port_name;
+    QString image_path;
+    QString checkpoint_path;
+    qint64 image_size     = -1;
+    qint64 image_modified = 0;
+    quint32 image_offset  = 0;
+    quint32 image_crc     = 0;
+};
+
+#endif // TRANSFERCHECKPOINT_H
@@ -0,0 +1,124 @@
+/**
+ * @file transport.c
+ */
+
+#include "transport.h"
+
+#include <string.h>
+
+/** Bytes TinyFrame adds around every payload */
+#define TRANSPORT_TF_OVERHEAD (TF_USE_SOF_BYTE + TF_ID_BYTES + TF_LEN_BYTES + TF_TYPE_BYTES + 2 * sizeof(TF_CKSUM))
+
+/**
+ * Longest TinyFrame frame in one HDLC frame. The FCS shares the minihdlc
+ * receive buffer, which takes frames shorter than MINIHDLC_MAX_FRAME_LENGTH
+ */
+#define TRANSPORT_HDLC_FRAME_MAX (MINIHDLC_MAX_FRAME_LENGTH - 1 - 2)
+
+/* One whole TinyFrame frame per HDLC frame, the parser starts from scratch on each */
+static void transport_hdlc_frame(minihdlc_context *ctx, const uint8_t *frame_buffer,
+        uint16_t frame_length)
+{
+    transport *t = (transport *) ctx->userdata;
+
+    TF_ResetParser(t->tf);
+    TF_Accept(t->tf, frame_buffer, frame_length);
+}
+
+void transport_init(transport *t, TinyFrame *tf, transport_framing framing,
+        transport_output_type output_function, void *userdata)
+{
+    t->tf = tf;
+    t->framing = framing;
+    t->output_function = output_function;
+    t->userdata = userdata;
+    t->frame_length = 0;
+    t->frame_overflow = false;
+    t->frames_dropped = 0;
+
+    minihdlc_context_init(&t->hdlc, NULL, transport_hdlc_frame, t);
+}
+
+void transport_write(transport *t, const uint8_t *data, uint32_t length)
+{
+    if (t->framing == TRANSPORT_RAW)
+    {
+        t->output_function(t, data, length);
+        return;
+    }
+
+    // Collected until TinyFrame says the frame is complete, it may come in several writes
+    if (t->frame_overflow || (length > TRANSPORT_HDLC_FRAME_MAX - t->frame_length))
+    {
+        t->frame_overflow = true;
+        return;
+    }
+
+    memcpy(t->frame + t->frame_length, data, length);
+    t->frame_length += length;
+}
+
+void transport_frame_end(transport *t)
+{
+    if (t->framing == TRANSPORT_RAW)
+    {
+        return;
+    }
+
+    if (t->frame_overflow)
+    {
+        t->frames_dropped++;
+    }
+    else if (t->frame_length > 0)
+    {
+        minihdlc_context_send_frame_to_buffer(&t->hdlc, t->frame, (uint16_t) t->frame_length);
+        t->output_function(t, minihdlc_context_get_buffer(&t->hdlc),
+                minihdlc_context_get_buffer_size(&t->hdlc));
+    }
+
+    t->frame_length = 0;
+    t->frame_overflow = false;
+}
+
+void transport_receive(transport *t, const uint8_t *data, size_t length)
+{
+    if (t->framing == TRANSPORT_HDLC)
+    {
+        minihdlc_context_receive(&t->hdlc, data, length);
+        return;
+    }
+
+    TF_Accept(t->tf, data, (uint32_t) length);
+}
+
+TF_LEN transport_max_payload(const transport *t)
+{
+    if (t->framing == TRANSPORT_HDLC)
+    {
+        return (TF_LEN) (TRANSPORT_HDLC_FRAME_MAX - TRANSPORT_TF_OVERHEAD);
+    }
+
+    return (TF_LEN) ~(TF_LEN) 0;
+}
+
+const char *transport_framing_name(transport_framing framing)
+{
+    return (framing == TRANSPORT_HDLC) ? "hdlc" : "raw";
+}
+
+bool transport_framing_parse(const char *name, transport_framing *framing)
+{
+    if (strcmp(name, "raw") == 0)
+    {
+        *framing = TRANSPORT_RAW;
+        return true;
+    }
+
+    if (strcmp(name, "hdlc") == 0)
+    {
+        *framing = TRANSPORT_HDLC;
+        return true;
+    }
+
+    return false;
+}
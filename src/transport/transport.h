@@ -0,0 +1,102 @@
+/**
+ * @file transport.h
+ *
+ * Wire framing under TinyFrame, chosen per link.
+ *
+ * TRANSPORT_RAW sends TinyFrame's bytes as they are, the parser finds frames
+ * by TF_SOF_BYTE. A corrupted length field makes it swallow the following
+ * frames until that many bytes arrived, or until TF_PARSER_TIMEOUT_TICKS when
+ * the line goes quiet.
+ *
+ * TRANSPORT_HDLC carries every TinyFrame frame as the payload of one minihdlc
+ * frame. The parser is reset at every flag and only sees frames whose FCS
+ * matched, so a damaged frame is dropped on its own and the next one is
+ * received normally.
+ *
+ * The application forwards TF_WriteImpl() and TF_FrameEndImpl() to
+ * transport_write() and transport_frame_end(), and passes received bytes to
+ * transport_receive() instead of TF_Accept().
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "tinyframe/TinyFrame.h"
+#include "minihdlc.h"
+
+typedef enum
+{
+    TRANSPORT_RAW  = 0,
+    TRANSPORT_HDLC = 1,
+} transport_framing;
+
+typedef struct transport transport;
+
+/** Sends bytes on the wire */
+typedef void (*transport_output_type)(transport *t, const uint8_t *data, uint32_t length);
+
+/** State of one link. Fields are private, use the transport_* functions */
+struct transport
+{
+    TinyFrame *tf;
+    transport_framing framing;
+    transport_output_type output_function;
+    void *userdata;             //!< for the output function, not touched by the transport
+    uint32_t frame_length;      //!< TinyFrame bytes of the frame being sent, HDLC only
+    bool frame_overflow;        //!< the frame being sent does not fit in one HDLC frame
+    uint32_t frames_dropped;    //!< frames not sent because they were too long
+    uint8_t frame[MINIHDLC_MAX_FRAME_LENGTH];
+    minihdlc_context hdlc;
+};
+
+/**
+ * Set up a link. Nothing is allocated.
+ *
+ * @param t - link state
+ * @param tf - TinyFrame instance the link belongs to
+ * @param framing - wire framing
+ * @param output_function - called with the bytes to send
+ * @param userdata - stored in t->userdata
+ */
+void transport_init(transport *t, TinyFrame *tf, transport_framing framing,
+        transport_output_type output_function, void *userdata);
+
+/** Bytes from TF_WriteImpl() */
+void transport_write(transport *t, const uint8_t *data, uint32_t length);
+
+/** End of a frame, from TF_FrameEndImpl() */
+void transport_frame_end(transport *t);
+
+/** Received bytes, parsed into TinyFrame */
+void transport_receive(transport *t, const uint8_t *data, size_t length);
+
+/**
+ * Largest TinyFrame payload the framing carries. Both sides of an HDLC link
+ * must keep their payloads at or below it.
+ */
+TF_LEN transport_max_payload(const transport *t);
+
+/** "raw" or "hdlc" */
+const char *transport_framing_name(transport_framing framing);
+
+/**
+ * Parse a framing name
+ *
+ * @return false if the name is unknown
+ */
+bool transport_framing_parse(const char *name, transport_framing *framing);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // TRANSPORT_H
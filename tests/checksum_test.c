@@ -0,0 +1,133 @@
+/**
+ * @file checksum_test.c
+ *
+ * Checks every checksum kernel against a bit-by-bit reference, for every
+ * length from 0 to 4096 bytes and every start offset within 16 bytes.
+ * checksum.c is included, so the slicing-by-8 and PCLMULQDQ CRC32 kernels
+ * are called directly whichever of them checksum_init() selects.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "checksum/checksum.c"
+
+#define TEST_MAX_LEN     4096u
+#define TEST_ALIGN_SLACK 16u  /* start offsets tried, one full SSE register */
+
+static unsigned int failures;
+
+/* Same polynomials as checksum.c, one bit at a time */
+static uint32_t reference_crc(uint32_t crc, uint32_t poly, uint8_t byte)
+{
+    int bit;
+
+    crc ^= byte;
+    for (bit = 0; bit < 8; bit++)
+    {
+        crc = (crc & 1) ? ((crc >> 1) ^ poly) : (crc >> 1);
+    }
+
+    return crc;
+}
+
+static void expect(const char *name, size_t offset, size_t len, uint32_t got, uint32_t want)
+{
+    if (got != want)
+    {
+        if (failures < 20)
+        {
+            fprintf(stderr, "checksum_test: %s offset %u length %u: 0x%08x, expected 0x%08x\n",
+                    name, (unsigned) offset, (unsigned) len, (unsigned) got, (unsigned) want);
+        }
+
+        failures++;
+    }
+}
+
+static void check_block(const uint8_t *data, size_t offset, size_t len, const uint32_t reference[5], bool clmul)
+{
+    const uint8_t *block = data + offset;
+
+    expect("xor",       offset, len, checksum_xor(0x5A, block, len),             reference[0]);
+    expect("crc8",      offset, len, checksum_crc8(0x00, block, len),            reference[1]);
+    expect("crc16",     offset, len, checksum_crc16(0x0000, block, len),         reference[2]);
+    expect("crc_ccitt", offset, len, checksum_crc_ccitt(0xFFFF, block, len),     reference[3]);
+    expect("crc32",     offset, len, checksum_crc32(0xFFFFFFFFu, block, len),    reference[4]);
+    expect("slice8",    offset, len, crc32_slice8(0xFFFFFFFFu, block, len),      reference[4]);
+
+#if CHECKSUM_HAVE_CLMUL
+    if (clmul)
+    {
+        expect("pclmulqdq", offset, len, crc32_clmul(0xFFFFFFFFu, block, len), reference[4]);
+    }
+#else
+    (void) clmul;
+#endif
+}
+
+int main(void)
+{
+    uint8_t *data;
+    uint32_t rng = 0x12345678u;
+    bool clmul = false;
+    size_t offset;
+    size_t i;
+
+    checksum_init();
+
+#if CHECKSUM_HAVE_CLMUL
+    clmul = cpu_has_clmul();
+#endif
+    printf("checksum_test: crc32 kernel %s, pclmulqdq %s\n",
+           checksum_crc32_kernel(), clmul ? "tested" : "not available");
+
+    data = malloc(TEST_MAX_LEN + TEST_ALIGN_SLACK);
+    if (data == NULL)
+    {
+        fprintf(stderr, "checksum_test: out of memory\n");
+        return 1;
+    }
+
+    for (i = 0; i < TEST_MAX_LEN + TEST_ALIGN_SLACK; i++)
+    {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        data[i] = (uint8_t) rng;
+    }
+
+    for (offset = 0; offset < TEST_ALIGN_SLACK; offset++)
+    {
+        /* Initial values as TinyFrame and minihdlc use them, the reference grows a byte per length */
+        uint32_t reference[5] = { 0x5A, 0x00, 0x0000, 0xFFFF, 0xFFFFFFFFu };
+        size_t len;
+
+        for (len = 0; len <= TEST_MAX_LEN; len++)
+        {
+            if (len > 0)
+            {
+                const uint8_t byte = data[offset + len - 1];
+
+                reference[0] ^= byte;
+                reference[1] = reference_crc(reference[1], CRC8_POLY, byte);
+                reference[2] = reference_crc(reference[2], CRC16_POLY, byte);
+                reference[3] = reference_crc(reference[3], CRC_CCITT_POLY, byte);
+                reference[4] = reference_crc(reference[4], CRC32_POLY, byte);
+            }
+
+            check_block(data, offset, len, reference, clmul);
+        }
+    }
+
+    free(data);
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "checksum_test: %u mismatches\n", failures);
+        return 1;
+    }
+
+    printf("checksum_test: all kernels match the reference\n");
+    return 0;
+}